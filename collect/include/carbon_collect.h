@@ -0,0 +1,26 @@
+#pragma once
+#include <memory>
+#include <boost/filesystem.hpp>
+
+namespace clang {
+class FrontendAction;
+}
+
+namespace carbon {
+
+// what the plugin otherwise takes as arguments
+struct collect_options_t {
+  boost::filesystem::path root_src_dir;
+  boost::filesystem::path root_bin_dir;
+  bool syst_code = false;
+  bool syst_cache = true;
+  bool journal = false;
+};
+
+// defined in carbon_collect.cpp. makes an action which collects the translation
+// unit it runs on, as the plugin does for the one being compiled. any number of
+// them may run at once, on different threads.
+std::unique_ptr<clang::FrontendAction>
+new_collect_action(const collect_options_t &);
+
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include <iostream>
+
+//
+// what the tests (the *_test.cpp next to the sources they test) check with.
+// whatever doesn't hold is reported, and makes the test fail in the end, but
+// doesn't stop it.
+//
+namespace carbon {
+namespace check {
+
+inline unsigned &failures() {
+  static unsigned n = 0;
+  return n;
+}
+
+inline void that(bool cond, const char *what, const char *file, int line) {
+  if (cond)
+    return;
+
+  std::cerr << file << ':' << line << ": check failed: " << what << std::endl;
+  ++failures();
+}
+
+// the exit status of the test
+inline int result() {
+  if (failures())
+    std::cerr << failures() << " check(s) failed" << std::endl;
+  return failures() ? 1 : 0;
+}
+
+}
+}
+
+#define CHECK(cond) carbon::check::that((cond), #cond, __FILE__, __LINE__)
@@ -1,11 +1,15 @@
 #pragma once
+#include <chrono>
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <ostream>
 #include <list>
 #include <set>
+#include <thread>
 #include <boost/filesystem.hpp>
 #include <clang/Basic/SourceLocation.h>
+#include <llvm/ADT/StringRef.h>
 
 namespace carbon {
 
@@ -40,14 +44,67 @@ unsigned char_count_until_semicolon(const clang_source_range_t &cl_src_rng);
 // defined in carbon_collect.cpp
 clang_source_file_t top_level_system_header(const clang_source_file_t &);
 
+// defined in carbon_collect.cpp. the contents of the given file, and the
+// offset its ranges are shifted by (which depends on how many times the file
+// had been included before)
+llvm::StringRef buffer_of_clang_source_file(const clang_source_file_t &);
+clang_source_location_t offset_of_clang_source_file(const clang_source_file_t &);
+
+//
+// what collecting a translation unit did, and where the time went (in
+// nanoseconds). these are appended to .carbon/.stats, one line per translation
+// unit, which carbon-stats sums up over a build.
+//
+struct collect_stats_t {
+  uint64_t top_level_decls = 0;       // top-level declarations seen
+  uint64_t opaque_decls = 0;          // of them, in system headers not looked in
+  uint64_t uses = 0;                  // uses reported
+  uint64_t code_merges = 0;           // vertices merged by overlapping code
+  uint64_t inverse_edges_removed = 0; // edges removed by uses going the other way
+  uint64_t follow_edges = 0;          // edges added by follow_users_of()
+  uint64_t vertices = 0;              // in the graph written
+  uint64_t edges = 0;                 // in the graph written
+  uint64_t bytes = 0;                 // of the graph written
+
+  uint64_t ast_ns = 0;       // looking at top-level declarations
+  uint64_t pp_ns = 0;        // in preprocessor callbacks
+  uint64_t finish_ns = 0;    // resolving what is left once parsing is done
+  uint64_t fixup_ns = 0;     // fixup_static_functions()
+  uint64_t shrink_ns = 0;    // summarizing, pruning and sharing
+  uint64_t serialize_ns = 0; // writing the graph out
+};
+
+// adds the time from its construction to its destruction to the given count
+class stats_timer_t {
+  uint64_t &ns;
+  std::chrono::steady_clock::time_point beg;
+
+public:
+  explicit stats_timer_t(uint64_t &ns)
+      : ns(ns), beg(std::chrono::steady_clock::now()) {}
+  ~stats_timer_t() {
+    ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+              std::chrono::steady_clock::now() - beg)
+              .count();
+  }
+};
+
 struct collector_priv;
 class collector {
   boost::filesystem::path srcfp;
   boost::filesystem::path root_src_dir;
   boost::filesystem::path root_bin_dir;
 
+  // append the output to the journal rather than writing a file of its own
+  // (see journal_file_name)
+  bool journal;
+
   std::unique_ptr<collector_priv> priv;
 
+  // finishes and writes the output in the background (see
+  // write_carbon_output())
+  std::thread writer;
+
 public:
   collector();
   ~collector();
@@ -55,6 +112,7 @@ public:
   void set_args(const boost::filesystem::path& srcfp,
                 const boost::filesystem::path& root_src_dir,
                 const boost::filesystem::path& root_bin_dir);
+  void set_journal(bool);
   void set_invocation_macros(
       const std::vector<std::pair<std::string, bool /*isUndef*/>> &Macros);
   void
@@ -72,9 +130,40 @@ public:
   void follow_users_of(const clang_source_range_t &prior,
                        const clang_source_range_t &following);
 
+  // (only to be touched before write_carbon_output())
+  collect_stats_t &stats();
+
+  // uses are resolved lazily; this turns the ones reported so far into edges
+  void resolve_uses();
+
   void clang_source_file(const clang_source_file_t &);
 
+  // the compiler entered the given file (see depends_context_t::included_paths)
+  void included_file(const clang_source_file_t &);
+
+  // the given top-level system header was included where the given macro
+  // environment (as a digest) was in effect. the code coming from such
+  // headers is summarized once and shared between translation units (see
+  // write_carbon_output())
+  void system_header_environment(const clang_source_file_t &,
+                                 const std::string &digest);
+
+  // whether the code which the given top-level system header (given its
+  // environment) brings in has been summarized already. if so, its summary
+  // stands in for it: its declarations and macro definitions need not be
+  // coded, only what user code uses of them (which is widened to the code of
+  // the summary it is in). (a summary only stands in for it while the files
+  // it was made of are the same on disk.)
+  bool system_header_summarized(const clang_source_file_t &);
+
+  // resolve what needs the compiler's state, then hand the rest of the work
+  // (fixups, summarizing system headers, pruning, serialization) off to a
+  // background thread, so that it runs alongside the compiler's code
+  // generation
   void write_carbon_output();
+
+  // wait for the output to have been written
+  void wait_for_carbon_output();
 };
 
 }
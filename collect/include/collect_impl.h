@@ -1,5 +1,7 @@
 #pragma once
 #include <boost/graph/adjacency_list.hpp>
+#include <boost/serialization/version.hpp>
+#include <cstdint>
 #include <string>
 
 namespace carbon {
@@ -27,6 +29,52 @@ static const source_location_t location_dummy_end = INT32_MIN + 1;
 static const source_location_t location_entire_file_beg = INT32_MAX - 1;
 static const source_location_t location_entire_file_end = INT32_MAX;
 
+// directory under .carbon/ holding the summaries of system headers which are
+// shared between translation units (see depends_context_t::syst_summaries)
+static const char *const syst_summaries_dir_name = ".summaries";
+
+// directory under .carbon/ holding the graphs of user headers, each named by
+// the digest of its contents (see depends_context_t::user_hdr_blobs)
+static const char *const user_hdr_blobs_dir_name = ".blobs";
+
+//
+// file under .carbon/ to which the collector appends the graph of every
+// translation unit, in place of a .carbon file of its own, if asked to (see the
+// journal argument). each record is a journal_record_header_t, followed by the
+// path of the source file relative to the root source directory and by the
+// encoding of its graph (see depends_codec.h). the latest record of a source
+// file supersedes any earlier ones. a record without a graph is a tombstone,
+// which the collector leaves when it writes the .carbon file of a source file
+// instead, so that the file supersedes the records before it.
+//
+static const char *const journal_file_name = ".journal";
+
+static const uint32_t journal_record_magic = 0x4a425243; // "CRBJ"
+
+struct journal_record_header_t {
+  uint32_t magic;
+  uint32_t path_len;
+  uint64_t data_len;
+};
+
+// file under .carbon/ with a line for every translation unit collected, of
+// how that went (see collect_stats_t, and carbon-stats)
+static const char *const stats_file_name = ".stats";
+
+//
+// file under .carbon/ to which the collector appends the global symbols which
+// every translation unit defines, as a block of lines: "@\t" and the path of
+// its source file (relative to the root source directory), followed by "g\t"
+// or "s\t" and the name of each global or static definition. the latest block
+// of a source file supersedes any earlier ones.
+//
+// carbon-extract folds the blocks into symbols_index_file_name, a line for
+// every definition, sorted: its name, 'g' or 's', and the path, separated by
+// tabs. then it empties this file, under the same lock that appends to it take.
+//
+static const char *const symbols_file_name = ".symbols";
+static const char *const symbols_index_file_name = ".symbols.index";
+
 // pair of source locations, and which file they reside in
 // since source ranges never overlap source_range_uid_t can uniquely identify
 struct source_range_t {
@@ -96,11 +144,34 @@ struct depends_context_t {
     std::set<std::string> dirs;
   } include;
 
+  /* fingerprints of the system header summaries (under .carbon/.summaries/)
+   * which this graph refers to. the code in them is left out, save for the
+   * vertices which connect it to the rest of the graph. */
+  std::vector<std::string> syst_summaries;
+
+  /* digests of the graphs of user headers (under .carbon/.blobs/) which this
+   * graph refers to. the code in those headers is left out, along with the
+   * edges leaving it, save for the vertices which edges of this graph need.
+   * (their symbols are not.) */
+  std::vector<std::string> user_hdr_blobs;
+
+  /* every file the translation unit consists of (its source file, and all of
+   * the files it includes, directly or not), and parallel to it, the digests
+   * of their contents when it was collected. (see carbon-stale) */
+  std::vector<std::string> included_paths;
+  std::vector<std::string> included_digests;
+
   template <class Archive>
-  void serialize(Archive &ar, const unsigned int) {
+  void serialize(Archive &ar, const unsigned int version) {
     ar &glbl_defs &glbl_decls &static_defs &static_decls &user_src_f_paths
         &syst_src_f_paths &toplvl_syst_src_f_paths &macros.def &macros
             .und &include.dirs;
+    if (version >= 1)
+      ar &syst_summaries;
+    if (version >= 2)
+      ar &user_hdr_blobs;
+    if (version >= 3)
+      ar &included_paths &included_digests;
   }
 };
 
@@ -114,3 +185,5 @@ typedef boost::adjacency_list<
 typedef depends_t::vertex_descriptor depends_vertex_t;
 typedef depends_t::edge_descriptor depends_edge_t;
 }
+
+BOOST_CLASS_VERSION(carbon::depends_context_t, 3)
@@ -0,0 +1,160 @@
+#pragma once
+#include "collect_impl.h"
+#include <cstdint>
+#include <vector>
+
+namespace carbon {
+
+// index of a vertex in a depends_builder_t
+typedef uint32_t dense_vertex_t;
+
+//
+// the encoding of a graph (see depends_codec.h) only holds its vertices, edges
+// and graph property, independent of the containers it uses. so this graph is
+// written in place of a depends_t (and read back as one by carbon-extract),
+// without paying for the sets and in-edge lists which the latter keeps.
+//
+typedef boost::adjacency_list<boost::vecS, boost::vecS, boost::directedS,
+                              source_range_t, depends_edge_type_t,
+                              depends_context_t>
+    depends_archive_t;
+
+//
+// the dependency graph as the collector builds it. vertices are dense indices
+// into a vector, and every edge is a record in a single growable vector which
+// is threaded onto the (singly-linked) out-edge list of its source and the
+// in-edge list of its target. removing a vertex or an edge only marks it dead.
+//
+// merging vertices is a union in a disjoint-set forest: the merged vertex's
+// edge lists are spliced onto those of the representative, and edge records
+// keep the endpoints they were added with. every endpoint is mapped to its
+// representative whenever edges are looked at, so edges between vertices which
+// got merged vanish, and to_depends() rewrites them all once at the end.
+//
+// parallel edges are tolerated: they are folded together, with the same
+// semantics as adding them one after another to a depends_t, whenever edges
+// are enumerated and once more by to_depends().
+//
+class depends_builder_t {
+public:
+  static const uint32_t nil = UINT32_MAX;
+
+private:
+  struct vertex_t {
+    source_range_t rng;
+
+    uint32_t out_head, out_tail;
+    uint32_t in_head, in_tail;
+
+    // number of live edge records on each list
+    uint32_t out_deg, in_deg;
+
+    bool dead;
+  };
+
+  enum {
+    EDGE_DEAD = 1,
+
+    // the edge type was given explicitly, as opposed to being the default one
+    // which leaves the type of a preexisting parallel edge untouched
+    EDGE_ASSIGNS = 2
+  };
+
+  struct edge_t {
+    dense_vertex_t src, dst;
+    uint32_t next_out, next_in;
+    uint8_t t;
+    uint8_t flags;
+  };
+
+  std::vector<vertex_t> verts;
+  std::vector<edge_t> edges;
+
+  // disjoint-set forest; a vertex is its own parent iff it is a representative
+  mutable std::vector<dense_vertex_t> parent;
+
+  uint32_t num_live_verts;
+
+  void append_edge(dense_vertex_t u, dense_vertex_t v, DEPENDS_EDGE_TYPE t,
+                   uint8_t flags);
+  void kill_edge(uint32_t e);
+
+  // the live edge records on the out- (or in-) edge list of v, as (adjacent
+  // representative, record) pairs, skipping edges between merged vertices
+  typedef std::pair<dense_vertex_t, const edge_t *> edge_rec_t;
+  void edge_records(dense_vertex_t v, bool out,
+                    std::vector<edge_rec_t> &recs) const;
+
+public:
+  // an (adjacent vertex, edge type) pair
+  typedef std::pair<dense_vertex_t, DEPENDS_EDGE_TYPE> adjacent_t;
+
+  depends_builder_t() : num_live_verts(0) {}
+
+  dense_vertex_t add_vertex(const source_range_t &);
+
+  // merge the representative v into the representative u, which keeps
+  // representing both (and whose source range the caller widens)
+  void merge(dense_vertex_t u, dense_vertex_t v);
+
+  // the representative of the given vertex
+  dense_vertex_t find(dense_vertex_t v) const {
+    while (parent[v] != v) {
+      parent[v] = parent[parent[v]];
+      v = parent[v];
+    }
+    return v;
+  }
+
+  // the following all expect representatives
+
+  // remove all edges to and from the given vertex, and the vertex itself
+  void remove_vertex(dense_vertex_t);
+
+  // whether v is a representative which has not been removed
+  bool live(dense_vertex_t v) const {
+    return parent[v] == v && !verts[v].dead;
+  }
+
+  source_range_t &operator[](dense_vertex_t v) { return verts[v].rng; }
+  const source_range_t &operator[](dense_vertex_t v) const {
+    return verts[v].rng;
+  }
+
+  // add an edge u -> v. if one already exists, its type is left as it is
+  void add_edge(dense_vertex_t u, dense_vertex_t v);
+
+  // add an edge u -> v of the given type, overwriting the type of any
+  // preexisting one
+  void add_edge(dense_vertex_t u, dense_vertex_t v, DEPENDS_EDGE_TYPE t);
+
+  bool edge(dense_vertex_t u, dense_vertex_t v) const;
+  void remove_edge(dense_vertex_t u, dense_vertex_t v);
+
+  // distinct targets of the edges leaving v, with their effective types
+  void out_edges(dense_vertex_t v, std::vector<adjacent_t> &out) const;
+
+  // distinct sources of the edges entering v, with their effective types
+  void in_edges(dense_vertex_t v, std::vector<adjacent_t> &out) const;
+
+  uint32_t num_vertices() const { return num_live_verts; }
+
+  // one past the greatest vertex ever added
+  dense_vertex_t vertices_end() const {
+    return static_cast<dense_vertex_t>(verts.size());
+  }
+
+  // number of edge records, including dead and parallel ones
+  std::size_t num_edge_records() const { return edges.size(); }
+
+  void reserve(std::size_t num_verts, std::size_t num_edges) {
+    verts.reserve(num_verts);
+    parent.reserve(num_verts);
+    edges.reserve(num_edges);
+  }
+
+  // build the graph to be serialized, folding parallel edges
+  void to_depends(depends_archive_t &out) const;
+};
+
+}
@@ -0,0 +1,536 @@
+#pragma once
+#include "collect_impl.h"
+#include <algorithm>
+#include <cstdint>
+#include <istream>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace carbon {
+
+//
+// the encoding of a dependency graph in a .carbon file (or a journal record, a
+// summary, or a blob). it starts with depends_encoding_magic, the version and a
+// depends_header_t, and everything after is a varint (LEB128), signed ones
+// zigzagged:
+//
+// - a table of the strings (paths, symbols, digests) which the rest refers to
+//   by index, each stored once
+// - the depends_context_t
+// - the vertices, each as the delta of its file from that of the vertex before
+//   it, then the delta of its beginning from that of the last vertex in the
+//   same file (shifted left by 2, along with the kind of range it is), then
+//   its length
+// - the out-edges of every vertex: their number, then their targets in order,
+//   each as the delta from the one before it (the first from the vertex
+//   itself) shifted left by 2, along with the DEPENDS_EDGE_TYPE
+//
+// graphs written by older collectors are boost archives instead (see
+// is_depends_encoding()), or have no header (version 1).
+//
+static const uint32_t depends_encoding_magic = 0x47425243; // "CRBG"
+static const uint32_t depends_encoding_version = 2;
+
+namespace depends_codec {
+
+// FNV-1a, so that the bits set for a symbol don't depend on the host
+inline uint64_t hash_of_symbol(const std::string &s) {
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (char c : s) {
+    h ^= static_cast<unsigned char>(c);
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
+
+enum RANGE_KIND {
+  RANGE_NORMAL,       // beg, then end - beg
+  RANGE_ENTIRE_FILE,  // location_entire_file_{beg,end}
+  RANGE_DUMMY,        // location_dummy_{beg,end}
+  RANGE_BACKWARDS     // beg, then end (which is before it)
+};
+
+inline uint64_t zigzag(int64_t x) {
+  return (static_cast<uint64_t>(x) << 1) ^ static_cast<uint64_t>(x >> 63);
+}
+
+inline int64_t unzigzag(uint64_t x) {
+  return static_cast<int64_t>(x >> 1) ^ -static_cast<int64_t>(x & 1);
+}
+
+inline void put_varint(std::string &out, uint64_t x) {
+  while (x >= 0x80) {
+    out.push_back(static_cast<char>(x | 0x80));
+    x >>= 7;
+  }
+  out.push_back(static_cast<char>(x));
+}
+
+inline void put_svarint(std::string &out, int64_t x) {
+  put_varint(out, zigzag(x));
+}
+
+//
+// the beginning of the last vertex in every file (user files, and system files
+// apart), which the next one in the same file is relative to
+//
+class last_beg_t {
+  std::vector<int64_t> user, syst;
+
+public:
+  int64_t &operator[](source_file_t f) {
+    std::vector<int64_t> &v = is_system_source_file(f) ? syst : user;
+    unsigned idx = index_of_source_file(f);
+    if (idx >= v.size())
+      v.resize(idx + 1, 0);
+    return v[idx];
+  }
+};
+
+}
+
+//
+// what a graph holds, in a fixed number of bytes at a fixed offset (past the
+// magic and the version, a byte), so that it can be had without decoding any of
+// the graph. the Bloom filter has the names of the global and static
+// definitions (of glbl_defs and static_defs), so that a graph which doesn't
+// define a symbol is almost always known not to from its header alone.
+//
+static const unsigned depends_bloom_bits = 4096;
+static const unsigned depends_bloom_hashes = 4;
+
+struct depends_header_t {
+  uint64_t num_verts;
+  uint64_t num_edges;
+  uint64_t num_glbl_defs;
+  uint64_t num_static_defs;
+  uint8_t bloom[depends_bloom_bits / 8];
+
+  template <typename F> static void bits_of_symbol(const std::string &s, F f) {
+    uint64_t h = depends_codec::hash_of_symbol(s);
+    uint32_t h1 = static_cast<uint32_t>(h);
+    uint32_t h2 = static_cast<uint32_t>(h >> 32) | 1;
+    for (unsigned i = 0; i < depends_bloom_hashes; ++i)
+      f((h1 + i * h2) % depends_bloom_bits);
+  }
+
+  void add_symbol(const std::string &s) {
+    bits_of_symbol(s,
+                   [&](uint32_t b) -> void { bloom[b / 8] |= 1 << (b % 8); });
+  }
+
+  // false if the graph surely doesn't define the given symbol
+  bool may_define(const std::string &s) const {
+    bool res = true;
+    bits_of_symbol(s, [&](uint32_t b) -> void {
+      res = res && (bloom[b / 8] & (1 << (b % 8)));
+    });
+    return res;
+  }
+};
+
+//
+// the names of the global and static definitions of a translation unit, as it
+// defined them before any of its code was left to summaries and blobs (which
+// is what its header, and its block of .carbon/.symbols, tell)
+//
+struct defined_symbols_t {
+  std::vector<std::string> glbl_defs;
+  std::vector<std::string> static_defs;
+
+  defined_symbols_t() {}
+  explicit defined_symbols_t(const depends_context_t &depctx) {
+    for (const auto &sym : depctx.glbl_defs)
+      glbl_defs.push_back(sym.first);
+    for (const auto &sym : depctx.static_defs)
+      static_defs.push_back(sym.first);
+  }
+};
+
+//
+// encodes the given graph, which must have vertex indices (vecS). its header
+// counts the given definitions if any, otherwise those in its context.
+//
+template <typename Graph>
+void write_depends(std::string &out, const Graph &g,
+                   const defined_symbols_t *defs = nullptr) {
+  using namespace depends_codec;
+
+  const depends_context_t &depctx = g[boost::graph_bundle];
+
+  std::vector<const std::string *> strs;
+  std::unordered_map<std::string, uint64_t> str_idx;
+  std::string ctx;
+
+  auto put_string = [&](const std::string &s) -> void {
+    auto it = str_idx.find(s);
+    if (it == str_idx.end()) {
+      it = str_idx.insert(std::make_pair(s, strs.size())).first;
+      strs.push_back(&(*it).first);
+    }
+    put_varint(ctx, (*it).second);
+  };
+
+  auto put_location = [&](const full_source_location_t &loc) -> void {
+    put_svarint(ctx, loc.f);
+    put_svarint(ctx, loc.beg);
+  };
+
+  put_varint(ctx, depctx.glbl_defs.size());
+  for (const auto &sym : depctx.glbl_defs) {
+    put_string(sym.first);
+    put_location(sym.second);
+  }
+
+  for (const auto *tbl : {&depctx.glbl_decls, &depctx.static_defs,
+                          &depctx.static_decls}) {
+    put_varint(ctx, tbl->size());
+    for (const auto &sym : *tbl) {
+      put_string(sym.first);
+      put_varint(ctx, sym.second.size());
+      for (const full_source_location_t &loc : sym.second)
+        put_location(loc);
+    }
+  }
+
+  auto put_strings = [&](const auto &c) -> void {
+    put_varint(ctx, c.size());
+    for (const std::string &s : c)
+      put_string(s);
+  };
+
+  put_strings(depctx.user_src_f_paths);
+  put_strings(depctx.syst_src_f_paths);
+  put_strings(depctx.toplvl_syst_src_f_paths);
+  put_strings(depctx.macros.def);
+  put_strings(depctx.macros.und);
+  put_strings(depctx.include.dirs);
+  put_strings(depctx.syst_summaries);
+  put_strings(depctx.user_hdr_blobs);
+  put_strings(depctx.included_paths);
+  put_strings(depctx.included_digests);
+
+  defined_symbols_t ours;
+  if (!defs) {
+    ours = defined_symbols_t(depctx);
+    defs = &ours;
+  }
+
+  depends_header_t hdr = {};
+  hdr.num_verts = boost::num_vertices(g);
+  hdr.num_edges = boost::num_edges(g);
+  hdr.num_glbl_defs = defs->glbl_defs.size();
+  hdr.num_static_defs = defs->static_defs.size();
+  for (const std::string &s : defs->glbl_defs)
+    hdr.add_symbol(s);
+  for (const std::string &s : defs->static_defs)
+    hdr.add_symbol(s);
+
+  //
+  // header, strings, context
+  //
+  out.append(reinterpret_cast<const char *>(&depends_encoding_magic),
+             sizeof(depends_encoding_magic));
+  put_varint(out, depends_encoding_version);
+  out.append(reinterpret_cast<const char *>(&hdr), sizeof(hdr));
+
+  put_varint(out, strs.size());
+  for (const std::string *s : strs) {
+    put_varint(out, s->size());
+    out.append(*s);
+  }
+
+  out.append(ctx);
+
+  //
+  // vertices
+  //
+  put_varint(out, boost::num_vertices(g));
+
+  source_file_t prev_f = 0;
+  last_beg_t last_beg;
+
+  typename Graph::vertex_iterator vi, vi_end;
+  for (boost::tie(vi, vi_end) = boost::vertices(g); vi != vi_end; ++vi) {
+    const source_range_t &rng = g[*vi];
+
+    put_svarint(out, static_cast<int64_t>(rng.f) - prev_f);
+    prev_f = rng.f;
+
+    RANGE_KIND kind;
+    if (rng.beg == location_entire_file_beg &&
+        rng.end == location_entire_file_end)
+      kind = RANGE_ENTIRE_FILE;
+    else if (rng.beg == location_dummy_beg && rng.end == location_dummy_end)
+      kind = RANGE_DUMMY;
+    else if (rng.end < rng.beg)
+      kind = RANGE_BACKWARDS;
+    else
+      kind = RANGE_NORMAL;
+
+    if (kind == RANGE_ENTIRE_FILE || kind == RANGE_DUMMY) {
+      put_varint(out, kind);
+      continue;
+    }
+
+    int64_t &beg = last_beg[rng.f];
+    put_varint(out, (zigzag(rng.beg - beg) << 2) | kind);
+    beg = rng.beg;
+
+    if (kind == RANGE_NORMAL)
+      put_varint(out, static_cast<uint64_t>(rng.end - rng.beg));
+    else
+      put_svarint(out, rng.end);
+  }
+
+  //
+  // edges
+  //
+  std::vector<std::pair<uint64_t, DEPENDS_EDGE_TYPE>> adj;
+  for (boost::tie(vi, vi_end) = boost::vertices(g); vi != vi_end; ++vi) {
+    uint64_t v = boost::get(boost::vertex_index, g, *vi);
+
+    adj.clear();
+    typename Graph::out_edge_iterator ei, ei_end;
+    for (boost::tie(ei, ei_end) = boost::out_edges(*vi, g); ei != ei_end; ++ei)
+      adj.push_back(std::make_pair(
+          boost::get(boost::vertex_index, g, boost::target(*ei, g)),
+          g[*ei].t));
+    std::sort(adj.begin(), adj.end());
+
+    put_varint(out, adj.size());
+
+    bool first = true;
+    uint64_t prev = v;
+    for (const auto &a : adj) {
+      uint64_t delta = first ? zigzag(static_cast<int64_t>(a.first - v))
+                             : a.first - prev;
+      put_varint(out, (delta << 2) | a.second);
+      prev = a.first;
+      first = false;
+    }
+  }
+}
+
+//
+// whether the stream is at a graph in this encoding, rather than at a boost
+// archive (it is left where it was either way)
+//
+inline bool is_depends_encoding(std::istream &is) {
+  std::streampos pos = is.tellg();
+
+  uint32_t magic = 0;
+  is.read(reinterpret_cast<char *>(&magic), sizeof(magic));
+  bool res = is && magic == depends_encoding_magic;
+
+  is.clear();
+  is.seekg(pos);
+  return res;
+}
+
+//
+// reads the header of the graph which the stream is at, leaving the stream
+// wherever. false if it has none (being a boost archive, or of version 1).
+//
+inline bool read_depends_header(std::istream &is, depends_header_t &hdr) {
+  uint32_t magic = 0;
+  char version = 0;
+  is.read(reinterpret_cast<char *>(&magic), sizeof(magic));
+  is.get(version);
+  if (!is || magic != depends_encoding_magic || version < 2)
+    return false;
+
+  return !!is.read(reinterpret_cast<char *>(&hdr), sizeof(hdr));
+}
+
+//
+// reads a graph as it goes, straight from the stream. the context comes first,
+// so a reader only after it (e.g. the symbols, or the included files) needn't
+// read any further.
+//
+class depends_reader_t {
+  std::streambuf &sb;
+  std::vector<std::string> strs;
+  bool read_ctx;
+  bool has_hdr;
+  depends_header_t hdr;
+
+  [[noreturn]] static void truncated() {
+    throw std::runtime_error("graph is cut short");
+  }
+
+  uint64_t varint() {
+    uint64_t res = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+      int c = sb.sbumpc();
+      if (c == std::char_traits<char>::eof())
+        truncated();
+
+      res |= static_cast<uint64_t>(c & 0x7f) << shift;
+      if (!(c & 0x80))
+        return res;
+    }
+    throw std::runtime_error("graph is corrupt");
+  }
+
+  int64_t svarint() { return depends_codec::unzigzag(varint()); }
+
+  const std::string &string() {
+    uint64_t idx = varint();
+    if (idx >= strs.size())
+      throw std::runtime_error("graph is corrupt");
+    return strs[idx];
+  }
+
+  full_source_location_t location() {
+    full_source_location_t loc;
+    loc.f = static_cast<source_file_t>(svarint());
+    loc.beg = static_cast<source_location_t>(svarint());
+    return loc;
+  }
+
+public:
+  depends_reader_t(std::istream &is)
+      : sb(*is.rdbuf()), read_ctx(false), has_hdr(false) {
+    uint32_t magic;
+    if (sb.sgetn(reinterpret_cast<char *>(&magic), sizeof(magic)) !=
+            sizeof(magic) ||
+        magic != depends_encoding_magic)
+      throw std::runtime_error("not a dependency graph");
+
+    uint64_t version = varint();
+    if (version < 1 || version > depends_encoding_version)
+      throw std::runtime_error("dependency graph of another version");
+
+    if (version >= 2) {
+      if (sb.sgetn(reinterpret_cast<char *>(&hdr), sizeof(hdr)) !=
+          sizeof(hdr))
+        truncated();
+      has_hdr = true;
+    }
+
+    strs.resize(varint());
+    for (std::string &s : strs) {
+      s.resize(varint());
+      if (sb.sgetn(&s[0], static_cast<std::streamsize>(s.size())) !=
+          static_cast<std::streamsize>(s.size()))
+        truncated();
+    }
+  }
+
+  // (nullptr for a graph of version 1)
+  const depends_header_t *header() const { return has_hdr ? &hdr : nullptr; }
+
+  void read_context(depends_context_t &depctx) {
+    read_ctx = true;
+
+    if (has_hdr) {
+      depctx.glbl_defs.reserve(hdr.num_glbl_defs);
+      depctx.static_defs.reserve(hdr.num_static_defs);
+    }
+
+    for (uint64_t n = varint(); n; --n) {
+      const std::string &nm = string();
+      depctx.glbl_defs[nm] = location();
+    }
+
+    for (auto *tbl : {&depctx.glbl_decls, &depctx.static_defs,
+                      &depctx.static_decls})
+      for (uint64_t n = varint(); n; --n) {
+        std::set<full_source_location_t> &locs = (*tbl)[string()];
+        for (uint64_t m = varint(); m; --m)
+          locs.insert(location());
+      }
+
+    auto get_vector = [&](std::vector<std::string> &c) -> void {
+      c.resize(varint());
+      for (std::string &s : c)
+        s = string();
+    };
+    auto get_set = [&](std::set<std::string> &c) -> void {
+      for (uint64_t n = varint(); n; --n)
+        c.insert(string());
+    };
+
+    get_vector(depctx.user_src_f_paths);
+    get_vector(depctx.syst_src_f_paths);
+    get_vector(depctx.toplvl_syst_src_f_paths);
+    get_set(depctx.macros.def);
+    get_set(depctx.macros.und);
+    get_set(depctx.include.dirs);
+    get_vector(depctx.syst_summaries);
+    get_vector(depctx.user_hdr_blobs);
+    get_vector(depctx.included_paths);
+    get_vector(depctx.included_digests);
+  }
+
+  // the vertices and edges, into g (whose context is read first, unless it
+  // was already)
+  template <typename Graph> void read_graph(Graph &g) {
+    using namespace depends_codec;
+
+    if (!read_ctx)
+      read_context(g[boost::graph_bundle]);
+
+    uint64_t num_verts = varint();
+
+    std::vector<typename Graph::vertex_descriptor> verts;
+    verts.reserve(num_verts);
+
+    source_range_t rng;
+    rng.f = 0;
+    last_beg_t last_beg;
+
+    for (uint64_t i = 0; i < num_verts; ++i) {
+      rng.f = static_cast<source_file_t>(rng.f + svarint());
+
+      uint64_t x = varint();
+      RANGE_KIND kind = static_cast<RANGE_KIND>(x & 3);
+
+      if (kind == RANGE_ENTIRE_FILE) {
+        rng.beg = location_entire_file_beg;
+        rng.end = location_entire_file_end;
+      } else if (kind == RANGE_DUMMY) {
+        rng.beg = location_dummy_beg;
+        rng.end = location_dummy_end;
+      } else {
+        int64_t &beg = last_beg[rng.f];
+        beg += unzigzag(x >> 2);
+        rng.beg = static_cast<source_location_t>(beg);
+
+        if (kind == RANGE_NORMAL)
+          rng.end = static_cast<source_location_t>(beg + varint());
+        else
+          rng.end = static_cast<source_location_t>(svarint());
+      }
+
+      verts.push_back(boost::add_vertex(rng, g));
+    }
+
+    depends_edge_type_t t;
+    for (uint64_t v = 0; v < num_verts; ++v) {
+      uint64_t prev = v;
+      for (uint64_t n = varint(), k = 0; k < n; ++k) {
+        uint64_t x = varint();
+        uint64_t delta = x >> 2;
+        uint64_t target = k == 0 ? v + static_cast<uint64_t>(unzigzag(delta))
+                                 : prev + delta;
+        if (target >= num_verts)
+          throw std::runtime_error("graph is corrupt");
+
+        t.t = static_cast<DEPENDS_EDGE_TYPE>(x & 3);
+        boost::add_edge(verts[v], verts[target], t, g);
+        prev = target;
+      }
+    }
+  }
+};
+
+template <typename Graph> void read_depends(std::istream &is, Graph &g) {
+  depends_reader_t(is).read_graph(g);
+}
+
+}
@@ -0,0 +1,114 @@
+#pragma once
+#include "collect_impl.h"
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <string>
+
+namespace carbon {
+
+//
+// go through the records of the journal at the given path (see
+// journal_file_name) from beginning to end, passing the path of the source
+// file of each, and the offset and length of its graph in the journal, which
+// is skipped over. a record which was cut short (its writer was killed, say) is
+// passed over, up to the next record, which then begins where it should have
+// ended; so a record is whole if what follows it is another one, or nothing.
+// returns how many bytes were passed over.
+//
+inline uint64_t scan_journal(
+    const std::string &p,
+    const std::function<void(const std::string &rel, uint64_t off,
+                             uint64_t len)> &record) {
+  std::ifstream ifs(p, std::ios::binary);
+  if (!ifs)
+    return 0;
+
+  ifs.seekg(0, std::ios::end);
+  uint64_t size = ifs.tellg();
+
+  auto magic_at = [&](uint64_t off) -> bool {
+    uint32_t magic = 0;
+    ifs.clear();
+    ifs.seekg(off, std::ios::beg);
+    return ifs.read(reinterpret_cast<char *>(&magic), sizeof(magic)) &&
+           magic == journal_record_magic;
+  };
+
+  auto next_magic = [&](uint64_t off) -> uint64_t {
+    const char *magic = reinterpret_cast<const char *>(&journal_record_magic);
+    std::string buf;
+    for (; off < size; off += buf.size() - (sizeof(journal_record_magic) - 1)) {
+      buf.resize(std::min<uint64_t>(size - off, 1 << 16));
+      ifs.clear();
+      ifs.seekg(off, std::ios::beg);
+      ifs.read(&buf[0], buf.size());
+
+      auto it = std::search(buf.begin(), buf.end(), magic,
+                            magic + sizeof(journal_record_magic));
+      if (it != buf.end())
+        return off + (it - buf.begin());
+      if (buf.size() < sizeof(journal_record_magic))
+        break;
+    }
+    return size;
+  };
+
+  uint64_t off = 0, skipped = 0;
+  while (off < size) {
+    journal_record_header_t hdr;
+    ifs.clear();
+    ifs.seekg(off, std::ios::beg);
+
+    uint64_t end = 0;
+    bool whole = size - off >= sizeof(hdr) &&
+                 ifs.read(reinterpret_cast<char *>(&hdr), sizeof(hdr)) &&
+                 hdr.magic == journal_record_magic &&
+                 size - off - sizeof(hdr) >=
+                     uint64_t(hdr.path_len) + hdr.data_len;
+    if (whole) {
+      end = off + sizeof(hdr) + hdr.path_len + hdr.data_len;
+      whole = end == size || magic_at(end);
+    }
+
+    if (!whole) {
+      uint64_t next = next_magic(off + 1);
+      skipped += next - off;
+      off = next;
+      continue;
+    }
+
+    std::string rel(hdr.path_len, '\0');
+    ifs.clear();
+    ifs.seekg(off + sizeof(hdr), std::ios::beg);
+    ifs.read(&rel[0], hdr.path_len);
+
+    record(rel, off + sizeof(hdr) + hdr.path_len, hdr.data_len);
+    off = end;
+  }
+
+  return skipped;
+}
+
+//
+// the latest record of each source file in the journal at the given path, by
+// the path of the source file: the offset and length of its graph. a source
+// file whose latest record is a tombstone (see journal_file_name) has none, as
+// its .carbon file stands in for it. sets the number of bytes passed over (see
+// scan_journal()).
+//
+inline std::map<std::string, std::pair<uint64_t, uint64_t>>
+latest_journal_records(const std::string &p, uint64_t &skipped) {
+  std::map<std::string, std::pair<uint64_t, uint64_t>> res;
+  skipped = scan_journal(
+      p, [&](const std::string &rel, uint64_t off, uint64_t len) -> void {
+        if (len == 0)
+          res.erase(rel);
+        else
+          res[rel] = std::make_pair(off, len);
+      });
+  return res;
+}
+
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+namespace carbon {
+
+//
+// the positions of the line breaks ('\r' and '\n') and NUL characters of a
+// file buffer, found in a single (vectorized, where possible) pass over it.
+// this answers the questions the collector asks about the line surrounding a
+// source range with a binary search instead of walking the buffer.
+//
+class line_breaks_t {
+  std::vector<uint32_t> brks;
+  std::vector<uint32_t> nuls;
+  uint32_t size;
+
+public:
+  line_breaks_t(const char *buf, uint32_t size);
+
+  // number of characters between the start of the line containing off and off
+  uint32_t offset_from_line_start(uint32_t off) const;
+
+  // number of characters between off and the end of its line (the next line
+  // break, NUL character, or the end of the buffer)
+  uint32_t offset_to_line_end(uint32_t off) const;
+};
+
+}
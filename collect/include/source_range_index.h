@@ -0,0 +1,127 @@
+#pragma once
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <vector>
+
+namespace carbon {
+
+//
+// maps the right-open source ranges [beg, end) of a single file to the vertex
+// which represents them. the ranges never overlap, so they are kept sorted (by
+// both their beginning and their end) in parallel flat arrays; looking up a
+// location or a range is a binary search, and a range which overlaps existing
+// ones replaces them in place.
+//
+template <typename Location, typename Vertex> class source_range_index {
+  std::vector<Location> begs;
+  std::vector<Location> ends;
+  std::vector<Vertex> verts;
+
+public:
+  typedef std::size_t size_type;
+  static constexpr size_type npos = static_cast<size_type>(-1);
+
+  size_type size() const { return verts.size(); }
+  bool empty() const { return verts.empty(); }
+
+  Location beg(size_type i) const { return begs[i]; }
+  Location end(size_type i) const { return ends[i]; }
+  Vertex vertex(size_type i) const { return verts[i]; }
+  Vertex &vertex(size_type i) { return verts[i]; }
+
+  void reserve(size_type n) {
+    begs.reserve(n);
+    ends.reserve(n);
+    verts.reserve(n);
+  }
+
+  //
+  // position of the range containing the given location, or npos
+  //
+  size_type find(Location l) const {
+    size_type i = static_cast<size_type>(
+        std::upper_bound(ends.begin(), ends.end(), l) - ends.begin());
+    if (i == ends.size() || begs[i] > l)
+      return npos;
+    return i;
+  }
+
+  //
+  // positions [first, last) of the ranges which overlap [beg, end). an empty
+  // range overlaps nothing.
+  //
+  std::pair<size_type, size_type> overlapping(Location beg,
+                                              Location end) const {
+    if (!(beg < end))
+      return std::make_pair(size_type(0), size_type(0));
+
+    size_type first = static_cast<size_type>(
+        std::upper_bound(ends.begin(), ends.end(), beg) - ends.begin());
+    size_type last = static_cast<size_type>(
+        std::lower_bound(begs.begin() + static_cast<std::ptrdiff_t>(first),
+                         begs.end(), end) -
+        begs.begin());
+
+    return std::make_pair(first, std::max(first, last));
+  }
+
+  //
+  // position of the first range which overlaps [beg, end), or npos
+  //
+  size_type find(Location beg, Location end) const {
+    std::pair<size_type, size_type> ovlp = overlapping(beg, end);
+    return ovlp.first == ovlp.second ? npos : ovlp.first;
+  }
+
+  //
+  // replace the ranges at positions [first, last) by [beg, end) -> v. the
+  // caller guarantees that [beg, end) covers exactly the replaced ranges and
+  // does not overlap any other (see overlapping()). an empty range is not
+  // stored.
+  //
+  void assign(size_type first, size_type last, Location beg, Location end,
+              Vertex v) {
+    assert(first <= last && last <= size());
+
+    if (!(beg < end)) {
+      erase(first, last);
+      return;
+    }
+
+    if (first == last) {
+      begs.insert(begs.begin() + static_cast<std::ptrdiff_t>(first), beg);
+      ends.insert(ends.begin() + static_cast<std::ptrdiff_t>(first), end);
+      verts.insert(verts.begin() + static_cast<std::ptrdiff_t>(first), v);
+      return;
+    }
+
+    begs[first] = beg;
+    ends[first] = end;
+    verts[first] = v;
+    erase(first + 1, last);
+  }
+
+  //
+  // add [beg, end) -> v, which must not overlap any existing range
+  //
+  void insert(Location beg, Location end, Vertex v) {
+    std::pair<size_type, size_type> ovlp = overlapping(beg, end);
+    assert(ovlp.first == ovlp.second);
+    assign(ovlp.first, ovlp.second, beg, end, v);
+  }
+
+  void erase(size_type first, size_type last) {
+    if (first == last)
+      return;
+
+    begs.erase(begs.begin() + static_cast<std::ptrdiff_t>(first),
+               begs.begin() + static_cast<std::ptrdiff_t>(last));
+    ends.erase(ends.begin() + static_cast<std::ptrdiff_t>(first),
+               ends.begin() + static_cast<std::ptrdiff_t>(last));
+    verts.erase(verts.begin() + static_cast<std::ptrdiff_t>(first),
+                verts.begin() + static_cast<std::ptrdiff_t>(last));
+  }
+};
+
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <boost/filesystem.hpp>
+
+namespace carbon {
+
+// defined in stale.cpp. the source files of the translation units collected
+// into the given root build directory which are out of date: the contents of
+// the source file, or of any file it included (directly or not), are no longer
+// what they were when it was collected. (so are those collected before the
+// collector recorded what they included.)
+std::vector<boost::filesystem::path>
+stale_translation_units(const boost::filesystem::path &root_src_dir,
+                        const boost::filesystem::path &root_bin_dir);
+
+}
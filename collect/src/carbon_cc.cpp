@@ -0,0 +1,472 @@
+//
+// carbon-cc (and carbon-c++) stands in for the C (C++) compiler of a build,
+// and runs clang with the collector loaded on every C translation unit it
+// compiles. everything else goes to the fallback compiler untouched.
+//
+// it is run for every compile step, so it does no more than it has to: no
+// interpreter, no libraries besides the C++ runtime, one configuration file at
+// most, and then it execs the compiler in its place.
+//
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace carbon {
+
+//
+// the settings, each of which is taken from the environment variable
+// CARBON_CC_<NAME> (in capitals, with dashes as underscores), or else from the
+// configuration file ($CARBON_CC_CONFIG, or ../etc/carbon-cc.conf relative to
+// this program). the latter has a 'name = value' per line, and '#' comments.
+//
+//   cc              clang, to collect with (clang). like the fallback
+//                   compilers, may come with arguments of its own (ccache
+//                   clang, say)
+//   fallback-cc     the compiler for everything else (cc)
+//   fallback-cxx    the compiler carbon-c++ runs (c++)
+//   plugin          the collector (../lib/libcarbon-collect.so relative to
+//                   this program)
+//   src, bin        the root source and build directories (the working
+//                   directory)
+//   under           only collect when the working directory is under this one
+//   plugin-args     further arguments to the collector (sys-code, journal...)
+//   flags           further arguments to clang when collecting
+//   fallback-flags  further arguments to the fallback compiler
+//   file-flags      a substring of an argument, then further arguments to
+//                   the compiler when some argument contains it (for the files
+//                   which need special treatment). may be given more than once
+//                   in the file, or separated by ';' in the environment
+//   shadow          if 1, compile with the fallback compiler as if carbon-cc
+//                   weren't there, and collect in a separate -fsyntax-only run
+//                   of clang in the background (see run_shadow())
+//   shadow-jobs     how many of the latter may run at once (as many as there
+//                   are processors)
+//
+struct config_t {
+  map<string, string> vals;
+  vector<string> file_flags;
+
+  const string &get(const string &name, const string &dflt) const {
+    auto it = vals.find(name);
+    return it == vals.end() ? dflt : (*it).second;
+  }
+};
+
+static string trim(const string &s) {
+  string::size_type beg = s.find_first_not_of(" \t\r");
+  if (beg == string::npos)
+    return string();
+  string::size_type end = s.find_last_not_of(" \t\r");
+  return s.substr(beg, end - beg + 1);
+}
+
+static vector<string> split(const string &s, char sep) {
+  vector<string> res;
+  string::size_type beg = 0;
+  for (;;) {
+    string::size_type end = s.find(sep, beg);
+    string tok(trim(s.substr(beg, end == string::npos ? end : end - beg)));
+    if (!tok.empty())
+      res.push_back(tok);
+    if (end == string::npos)
+      break;
+    beg = end + 1;
+  }
+  return res;
+}
+
+static string program_directory(void) {
+  char buf[PATH_MAX];
+  ssize_t n = readlink("/proc/self/exe", buf, sizeof(buf) - 1);
+  if (n <= 0)
+    return ".";
+  buf[n] = '\0';
+
+  char *slash = strrchr(buf, '/');
+  if (slash)
+    *slash = '\0';
+  return buf;
+}
+
+static void read_config(config_t &cfg, const string &prog_dir) {
+  static const char *const names[] = {
+      "cc",          "fallback-cc", "fallback-cxx",   "plugin",
+      "src",         "bin",         "under",          "plugin-args",
+      "flags",       "fallback-flags", "file-flags",  "shadow",
+      "shadow-jobs"};
+
+  const char *cfg_path = getenv("CARBON_CC_CONFIG");
+  ifstream ifs(cfg_path ? string(cfg_path)
+                        : prog_dir + "/../etc/carbon-cc.conf");
+
+  string ln;
+  while (getline(ifs, ln)) {
+    ln = trim(ln.substr(0, ln.find('#')));
+    string::size_type eq = ln.find('=');
+    if (eq == string::npos)
+      continue;
+
+    string name(trim(ln.substr(0, eq)));
+    string val(trim(ln.substr(eq + 1)));
+    if (name == "file-flags")
+      cfg.file_flags.push_back(val);
+    else
+      cfg.vals[name] = val;
+  }
+
+  //
+  // the environment trumps the file
+  //
+  for (const char *name : names) {
+    string var("CARBON_CC_");
+    for (const char *p = name; *p; ++p)
+      var += *p == '-' ? '_' : static_cast<char>(toupper(*p));
+
+    const char *val = getenv(var.c_str());
+    if (!val)
+      continue;
+
+    if (strcmp(name, "file-flags") == 0)
+      cfg.file_flags = split(val, ';');
+    else
+      cfg.vals[name] = val;
+  }
+}
+
+// options which take the following argument as their value
+static bool takes_separate_value(const char *arg) {
+  static const char *const opts[] = {
+      "-o",          "-x",          "-I",       "-D",          "-U",
+      "-L",          "-include",    "-imacros", "-isystem",    "-iquote",
+      "-idirafter",  "-iprefix",    "-isysroot", "-MF",        "-MT",
+      "-MQ",         "-Xclang",     "-Xlinker", "-Xassembler", "-Xpreprocessor",
+      "-target",     "-arch",       "--sysroot", "-aux-info",  "-T"};
+
+  for (const char *opt : opts)
+    if (strcmp(arg, opt) == 0)
+      return true;
+  return false;
+}
+
+static bool ends_with(const char *s, const char *suffix) {
+  size_t n = strlen(s), m = strlen(suffix);
+  return n >= m && strcmp(s + n - m, suffix) == 0;
+}
+
+//
+// whether the command compiles C code (and so whether there is something for
+// the collector to look at). it doesn't if it only preprocesses, or only links,
+// or its inputs are in another language.
+//
+static bool compiles_c(int argc, char **argv) {
+  bool c_input = false;
+  const char *lang = nullptr;
+
+  for (int i = 1; i < argc; ++i) {
+    const char *arg = argv[i];
+
+    if (arg[0] != '-' || arg[1] == '\0') {
+      if (lang ? strcmp(lang, "c") == 0 : ends_with(arg, ".c"))
+        c_input = true;
+      continue;
+    }
+
+    if (strcmp(arg, "-E") == 0 || strcmp(arg, "-M") == 0 ||
+        strcmp(arg, "-MM") == 0)
+      return false;
+
+    if (strcmp(arg, "-x") == 0 && i + 1 < argc) {
+      lang = strcmp(argv[i + 1], "none") == 0 ? nullptr : argv[i + 1];
+      ++i;
+      continue;
+    }
+    if (strncmp(arg, "-x", 2) == 0) {
+      lang = strcmp(arg + 2, "none") == 0 ? nullptr : arg + 2;
+      continue;
+    }
+
+    if (takes_separate_value(arg))
+      ++i;
+  }
+
+  return c_input;
+}
+
+static bool is_under(const string &dir, const string &root) {
+  char buf[PATH_MAX];
+  string r(realpath(root.c_str(), buf) ? buf : root);
+
+  while (r.size() > 1 && r.back() == '/')
+    r.pop_back();
+
+  return dir.compare(0, r.size(), r) == 0 &&
+         (dir.size() == r.size() || dir[r.size()] == '/' || r == "/");
+}
+
+//
+// the arguments which have the compiler write something besides its output
+// proper (dependency files), and so which a -fsyntax-only run must not get
+//
+static bool writes_output(const char *arg, bool &takes_value) {
+  takes_value = strcmp(arg, "-o") == 0 || strcmp(arg, "-MF") == 0 ||
+                strcmp(arg, "-MT") == 0 || strcmp(arg, "-MQ") == 0;
+
+  return takes_value || strncmp(arg, "-o", 2) == 0 ||
+         strcmp(arg, "-MD") == 0 || strcmp(arg, "-MMD") == 0 ||
+         strcmp(arg, "-MP") == 0 || strncmp(arg, "-Wp,-MD", 7) == 0 ||
+         strncmp(arg, "-Wp,-MMD", 8) == 0;
+}
+
+static void execute(vector<string> &cmd) {
+  if (cmd.empty()) {
+    fprintf(stderr, "carbon-cc: no compiler to run\n");
+    return;
+  }
+
+  vector<char *> exec_argv;
+  exec_argv.reserve(cmd.size() + 1);
+  for (string &arg : cmd)
+    exec_argv.push_back(&arg[0]);
+  exec_argv.push_back(nullptr);
+
+  execvp(exec_argv[0], exec_argv.data());
+
+  fprintf(stderr, "carbon-cc: failed to execute %s (%s)\n", exec_argv[0],
+          strerror(errno));
+}
+
+//
+// the shadow collections of a build coordinate through files in
+// <bin>/.carbon/.shadow: every one holds a shared lock on 'pending' from
+// before the compile step which started it returns until it is done (so that
+// --carbon-wait, taking an exclusive lock on it, waits for all of them), and
+// an exclusive lock on one of 'slot.<n>' while clang runs. their output goes to
+// 'log'.
+//
+static string shadow_directory(const string &bin) {
+  string dir(bin + "/.carbon");
+  mkdir(dir.c_str(), 0777);
+  dir += "/.shadow";
+  mkdir(dir.c_str(), 0777);
+  return dir;
+}
+
+static int lock_file(const string &p, int op) {
+  int fd = open(p.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+  if (fd < 0)
+    return -1;
+
+  while (flock(fd, op) < 0) {
+    if (errno == EINTR)
+      continue;
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+//
+// run the given (-fsyntax-only) command in the background once a slot is
+// free, with the compile step carrying on without waiting for it
+//
+static void run_shadow(vector<string> &cmd, const string &dir, unsigned jobs) {
+  //
+  // taken here, before the compile step can return, and handed down to the
+  // background process (which has the same open file, so the same lock)
+  //
+  int pending_fd = lock_file(dir + "/pending", LOCK_SH);
+  if (pending_fd < 0) {
+    fprintf(stderr, "carbon-cc: failed to lock %s/pending (%s)\n", dir.c_str(),
+            strerror(errno));
+    return;
+  }
+
+  pid_t pid = fork();
+  if (pid != 0) {
+    // (the lock lives on in the background process)
+    close(pending_fd);
+    if (pid > 0)
+      waitpid(pid, nullptr, 0);
+    return;
+  }
+
+  //
+  // fork once more and let go of the grandchild, which the build doesn't
+  // know about. nor does it keep the build's pipes open.
+  //
+  setsid();
+  if (fork() != 0)
+    _exit(0);
+
+  int null_fd = open("/dev/null", O_RDONLY);
+  int log_fd = open((dir + "/log").c_str(), O_WRONLY | O_APPEND | O_CREAT, 0666);
+  if (null_fd >= 0)
+    dup2(null_fd, STDIN_FILENO);
+  if (log_fd >= 0) {
+    dup2(log_fd, STDOUT_FILENO);
+    dup2(log_fd, STDERR_FILENO);
+  }
+
+  //
+  // take whichever slot is free, or else wait on one of them
+  //
+  int slot_fd = -1;
+  for (unsigned i = 0; i < jobs && slot_fd < 0; ++i)
+    slot_fd = lock_file(dir + "/slot." + to_string(i), LOCK_EX | LOCK_NB);
+  if (slot_fd < 0)
+    slot_fd = lock_file(dir + "/slot." + to_string(getpid() % jobs), LOCK_EX);
+
+  pid = fork();
+  if (pid == 0) {
+    execute(cmd);
+    _exit(127);
+  }
+
+  int status = 0;
+  if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+      WEXITSTATUS(status) != 0) {
+    string line("carbon-cc: failed to collect:");
+    for (const string &arg : cmd)
+      line += " " + arg;
+    fprintf(stderr, "%s\n", line.c_str());
+  }
+
+  _exit(0);
+}
+
+//
+// the barrier (carbon-cc --carbon-wait): waits for every shadow collection
+// started so far to be done
+//
+static int wait_for_shadows(const string &bin) {
+  string dir(shadow_directory(bin));
+  if (lock_file(dir + "/pending", LOCK_EX) < 0) {
+    fprintf(stderr, "carbon-cc: failed to lock %s/pending (%s)\n", dir.c_str(),
+            strerror(errno));
+    return 1;
+  }
+
+  struct stat st;
+  if (stat((dir + "/log").c_str(), &st) == 0 && st.st_size > 0)
+    fprintf(stderr, "carbon-cc: see %s/log for the output of collecting\n",
+            dir.c_str());
+
+  return 0;
+}
+
+}
+
+using namespace carbon;
+
+int main(int argc, char **argv) {
+  string prog_dir(program_directory());
+  bool cxx = ends_with(argv[0], "++");
+
+  config_t cfg;
+  read_config(cfg, prog_dir);
+
+  char buf[PATH_MAX];
+  string cwd(getcwd(buf, sizeof(buf)) ? buf : ".");
+
+  if (argc == 2 && strcmp(argv[1], "--carbon-wait") == 0)
+    return wait_for_shadows(cfg.get("bin", cwd));
+
+  //
+  // the plugin only ever collects C, so anything else skips clang altogether
+  //
+  bool collect = !cxx && compiles_c(argc, argv);
+  if (collect && cfg.vals.count("under"))
+    collect = is_under(cwd, cfg.get("under", ""));
+
+  bool shadow = collect && cfg.get("shadow", "0") == "1";
+
+  vector<string> file_args;
+  for (const string &ff : cfg.file_flags) {
+    vector<string> toks(split(ff, ' '));
+    if (toks.empty())
+      continue;
+
+    for (int i = 1; i < argc; ++i) {
+      if (strstr(argv[i], toks[0].c_str())) {
+        file_args.insert(file_args.end(), toks.begin() + 1, toks.end());
+        break;
+      }
+    }
+  }
+
+  //
+  // the build's own arguments go first, so that ours come after (and override)
+  // them
+  //
+  vector<string> cmd;
+
+  if (collect) {
+    cmd = split(cfg.get("cc", "clang"), ' ');
+
+    for (int i = 1; i < argc; ++i) {
+      bool takes_value;
+      if (shadow && writes_output(argv[i], takes_value)) {
+        i += takes_value;
+        continue;
+      }
+
+      cmd.push_back(argv[i]);
+    }
+
+    for (const string &flag : split(cfg.get("flags", ""), ' '))
+      cmd.push_back(flag);
+    cmd.insert(cmd.end(), file_args.begin(), file_args.end());
+
+    vector<string> plugin_args = {cfg.get("src", cwd), cfg.get("bin", cwd)};
+    for (const string &arg : split(cfg.get("plugin-args", ""), ' '))
+      plugin_args.push_back(arg);
+
+    cmd.insert(cmd.end(),
+               {"-Xclang", "-load", "-Xclang",
+                cfg.get("plugin", prog_dir + "/../lib/libcarbon-collect.so"),
+                "-Xclang", "-add-plugin", "-Xclang", "carbon-collect"});
+    for (const string &arg : plugin_args)
+      cmd.insert(cmd.end(),
+                 {"-Xclang", "-plugin-arg-carbon-collect", "-Xclang", arg});
+
+    if (!shadow) {
+      execute(cmd);
+      return 127;
+    }
+
+    cmd.push_back("-fsyntax-only");
+
+    long jobs = atol(cfg.get("shadow-jobs", "0").c_str());
+    if (jobs <= 0)
+      jobs = sysconf(_SC_NPROCESSORS_ONLN);
+
+    run_shadow(cmd, shadow_directory(cfg.get("bin", cwd)),
+                 static_cast<unsigned>(jobs > 0 ? jobs : 1));
+  }
+
+  cmd = split(cxx ? cfg.get("fallback-cxx", "c++")
+                  : cfg.get("fallback-cc", "cc"),
+              ' ');
+  cmd.insert(cmd.end(), argv + 1, argv + argc);
+  for (const string &flag : split(cfg.get("fallback-flags", ""), ' '))
+    cmd.push_back(flag);
+  cmd.insert(cmd.end(), file_args.begin(), file_args.end());
+
+  execute(cmd);
+  return 127;
+}
@@ -1,16 +1,24 @@
+#include "carbon_collect.h"
 #include "collect.h"
+#include "line_breaks.h"
 #include "utilities_clang.h"
 #include <iostream>
-#include <unordered_set>
 #include <unordered_map>
 #include <sstream>
+#include <cstring>
 #include <clang/AST/RecursiveASTVisitor.h>
 #include <clang/Frontend/CompilerInstance.h>
+#include <clang/Frontend/FrontendAction.h>
 #include <clang/Frontend/FrontendPluginRegistry.h>
+#include <clang/Lex/Lexer.h>
 #include <clang/Lex/Preprocessor.h>
 #include <clang/Lex/PreprocessorOptions.h>
 #include <clang/Basic/FileManager.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/DenseSet.h>
 #include <llvm/Support/FormatVariadic.h>
+#include <llvm/Support/MD5.h>
+#include <llvm/Support/TimeProfiler.h>
 
 using namespace clang;
 using namespace std;
@@ -20,23 +28,119 @@ namespace carbon {
 
 static const bool debugMode = false;
 
-static collector c;
-static fs::path root_src_dir;
-static fs::path root_bin_dir;
+/// Everything there is to know about a FileID for the purpose of mapping its
+/// locations, computed once on its first sighting. All the FileID's of a file
+/// share its buffer, so Buf also identifies the file.
+struct FileIDInfo {
+  const char *Buf; // the file's buffer (null if not yet known)
+  int Size;        // N
+  int Offset;      // M * N
 
-// we keep a list of macro uses to apply at the close since the preprocessor
-// will expand macros before the parser will notify of the AST's therein
-static list<pair<clang_source_range_t, clang_source_range_t>> if_def_uses;
+  // the buffer's line breaks, computed on demand (see lineBreaksOf())
+  const line_breaks_t *Breaks;
+
+  FileIDInfo() : Buf(nullptr), Size(0), Offset(0), Breaks(nullptr) {}
+};
 
 //
-// stores most-recent #define for a given macro
+// the state of collecting a translation unit. the plugin collects the one being
+// compiled, while carbon-collect-batch collects many at once (one per thread),
+// so it is reached through a thread-local pointer which is set for as long as
+// a translation unit is being collected.
 //
-static unordered_map<string, clang_source_range_t> _macro_defs;
-static unordered_map<string, SourceRange> macro_defs;
+struct CollectState {
+  collector c;
+  fs::path root_src_dir;
+  fs::path root_bin_dir;
+
+  //
+  // whether to look inside of the code in system headers (sys-code argument).
+  // by default it's opaque: carbon-extract only ever emits an #include for it
+  // unless run with --sys-code, so its internal dependencies are of no use.
+  //
+  bool syst_code = false;
+
+  //
+  // whether to share the code in system headers between translation units
+  // through summaries, rather than having it in each of their .carbon files
+  // (unless the no-sys-cache argument is given)
+  //
+  bool syst_cache = true;
+
+  // whether to append the output to the build's journal rather than writing
+  // a .carbon file of its own (journal argument)
+  bool journal = false;
+
+  // we keep a list of macro uses to apply at the close since the preprocessor
+  // will expand macros before the parser will notify of the AST's therein
+  vector<pair<clang_source_range_t, clang_source_range_t>> if_def_uses;
+
+  //
+  // stores most-recent #define for a given macro (identifiers are unique to
+  // the preprocessor, so their IdentifierInfo's stand for their names, and no
+  // string is built to look one up. the macro callbacks still allocate
+  // though, as the collector's tables grow.)
+  //
+  struct MacroDef {
+    SourceRange SR;
+    clang_source_range_t Range;
+  };
+  llvm::DenseMap<const IdentifierInfo *, MacroDef> MacroDefs;
+
+  /// Whether each FileID without a file is <built-in> or <scratch space>.
+  llvm::DenseMap<FileID, bool> BuiltinFileIDs;
+
+  SourceManager *SM = nullptr;
+
+  /// Note: SM assigns unique FileID's for each unique \#include chain. The
+  /// n'th FileID seen for a file has its offsets shifted by n times the size
+  /// of the file, so that ranges from different inclusions never overlap. This
+  /// maps each file to the number of its FileID's seen so far.
+  map<llvm::sys::fs::UniqueID, int> FileMultMap;
+
+  /// Only the FileID's of files are looked up, but macro expansions take up
+  /// local FileID's as well, so those of the files included late in a
+  /// translation unit are large (and FileID's loaded from a PCH or module are
+  /// negative): a hash table rather than a vector indexed by them. (Entries
+  /// move as it grows, so a reference to one doesn't outlast the next lookup.)
+  llvm::DenseMap<FileID, FileIDInfo> FileIDInfos;
+
+  /// The canonical path of each file, resolved on its first sighting (it takes
+  /// a realpath, i.e. a system call per path component) and shared by all its
+  /// FileID's.
+  map<llvm::sys::fs::UniqueID, fs::path> CanonicalPaths;
+
+  /// The top-level system header of each system FileID walked through so far.
+  /// It depends on the #include chain, so it is per FileID, not per file.
+  map<FileID, FileID> TopLevelSystemHeaders;
+
+  /// The top-level system headers whose code a summary stands in for (see
+  /// collector::system_header_summarized()), so that their declarations and
+  /// macro definitions are left uncoded.
+  llvm::DenseSet<FileID> SkippedSystemHeaders;
+
+  /// A digest of each macro defined so far, and the sum of them all: the macro
+  /// environment a system header is included in is then known without going
+  /// through the macro table (see CarbonCollectPP::macroEnvironmentDigest()).
+  /// The macros (re)defined since the last time it was needed are only
+  /// digested the next time it is, so that a #define costs a lookup.
+  struct MacroDigest {
+    const MacroInfo *MI; // (until it is digested)
+    pair<uint64_t, uint64_t> D;
+  };
+  llvm::DenseMap<const IdentifierInfo *, MacroDigest> MacroDigests;
+  vector<const IdentifierInfo *> UndigestedMacros;
+  pair<uint64_t, uint64_t> MacroEnvironment{0, 0};
+
+  /// Line breaks are only needed for the (few) files declarations are found
+  /// in, and are shared by all the FileID's of a file.
+  unordered_map<const char *, line_breaks_t> LineBreaksOfBuffer;
+};
+
+static thread_local CollectState *TU;
 
 static clang_source_file_t clang_source_file(FileID);
 static clang_source_range_t clang_source_range(const SourceRange &);
-static SourceManager *gl_SM;
 #if 0
 static llvm::raw_ostream &operator<<(llvm::raw_ostream &os,
                                      const clang_source_file_t &f);
@@ -52,9 +156,40 @@ normalize_source_range(const clang_source_range_t &);
 
 static void needsDecl(const clang_source_range_t &user, const Decl *D);
 static void needsType(const clang_source_range_t& user_src_rng, const Type* T);
+
+// \brief Return true if \c Loc is a location in a built-in macro.
 static bool isInBuiltin(SourceLocation Loc) {
-  auto buffNm = gl_SM->getBufferName(gl_SM->getSpellingLoc(Loc));
-  return buffNm == "<built-in>" || buffNm == "<scratch space>";
+  SourceManager &SM = *TU->SM;
+
+  FileID FID = SM.getFileID(SM.getSpellingLoc(Loc));
+  if (SM.getFileEntryForID(FID))
+    return false;
+
+  auto it = TU->BuiltinFileIDs.find(FID);
+  if (it == TU->BuiltinFileIDs.end()) {
+    StringRef buffNm = SM.getBufferName(SM.getLocForStartOfFile(FID));
+    it = TU->BuiltinFileIDs
+             .insert({FID, buffNm == "<built-in>" || buffNm == "<scratch space>"})
+             .first;
+  }
+
+  return (*it).second;
+}
+
+// \brief Return true if \c Loc is in the code of a system header which a
+// summary stands in for.
+static bool isInSkippedSystemHeader(SourceLocation Loc) {
+  if (TU->SkippedSystemHeaders.empty())
+    return false;
+
+  SourceManager &SM = *TU->SM;
+
+  FileID FID = SM.getFileID(SM.getExpansionLoc(Loc));
+  if (!SM.getFileEntryForID(FID) || !clang_is_system_source_file(FID) ||
+      SM.getIncludeLoc(FID).isInvalid())
+    return false;
+
+  return TU->SkippedSystemHeaders.count(top_level_system_header(FID)) != 0;
 }
 
 class CarbonCollectVisitor : public RecursiveASTVisitor<CarbonCollectVisitor> {
@@ -63,11 +198,6 @@ class CarbonCollectVisitor : public RecursiveASTVisitor<CarbonCollectVisitor> {
 public:
   CarbonCollectVisitor(CompilerInstance &CI) : SM(CI.getSourceManager()) {}
 
-  bool isInBuiltin(SourceLocation Loc) {
-    auto buffNm = SM.getBufferName(SM.getSpellingLoc(Loc));
-    return buffNm == "<built-in>" || buffNm == "<scratch space>";
-  }
-
   bool VisitMemberExpr(MemberExpr *e) {
     if (debugMode)
       llvm::errs() << "MemberExpr\n";
@@ -169,21 +299,32 @@ static const char *CharacteristicKindStrings[] = {
     "C_System_ModuleMap"};
 #endif
 
+//
+// times a part of collecting, into the translation unit's stats as well as
+// clang's -ftime-trace (where each name gets a total)
+//
+class CollectTimer {
+  stats_timer_t Timer;
+  llvm::TimeTraceScope Scope;
+
+public:
+  CollectTimer(uint64_t &NS, StringRef Name) : Timer(NS), Scope(Name) {}
+};
+
 class CarbonCollectPP : public PPCallbacks {
   CompilerInstance &CI;
   SourceManager &SM;
-  unordered_set<string> macrosSeen;
 
 public:
   CarbonCollectPP(CompilerInstance &CI) : CI(CI), SM(CI.getSourceManager()) {}
 
-  // \brief Return true if \c Loc is a location in a built-in macro.
-  bool isInBuiltin(SourceLocation Loc) {
-    auto buffNm = SM.getBufferName(SM.getSpellingLoc(Loc));
-    return buffNm == "<built-in>" || buffNm == "<scratch space>";
+  // \brief Return true if \c UserLoc and \c UseeLoc both lie in system
+  // headers, and we don't look inside of those (see TU->syst_code).
+  bool isSystemToSystemUse(SourceLocation UserLoc, SourceLocation UseeLoc) {
+    return !TU->syst_code && SM.isInSystemHeader(SM.getExpansionLoc(UserLoc)) &&
+           SM.isInSystemHeader(SM.getExpansionLoc(UseeLoc));
   }
 
-
   bool isSourceRangeSensible(const SourceRange& SR) {
     pair<FileID, unsigned> beg = SM.getDecomposedExpansionLoc(SR.getBegin());
     pair<FileID, unsigned> end = SM.getDecomposedExpansionLoc(SR.getEnd());
@@ -191,9 +332,129 @@ public:
     return beg.first == end.first && SM.getFileEntryForID(beg.first);
   }
 
+  // \brief Return the definition of the given macro as written.
+  StringRef macroDefinitionText(const MacroInfo *MI) {
+    SourceLocation Beg = SM.getSpellingLoc(MI->getDefinitionLoc());
+    SourceLocation End = SM.getSpellingLoc(MI->getDefinitionEndLoc());
+    if (Beg.isInvalid() || End.isInvalid() ||
+        SM.getFileID(Beg) != SM.getFileID(End))
+      return StringRef();
+
+    const char *BegPtr = SM.getCharacterData(Beg);
+    const char *EndPtr = SM.getCharacterData(End) +
+                         Lexer::MeasureTokenLength(End, SM, CI.getLangOpts());
+    return StringRef(BegPtr, static_cast<size_t>(EndPtr - BegPtr));
+  }
+
+  // \brief Note the (re)definition of a macro, or its #undef (if \c MI is
+  // null), in the macro environment. (it is digested once the environment is
+  // needed, see digestMacroDefinitions().)
+  void noteMacroDefinition(const IdentifierInfo *II, const MacroInfo *MI) {
+    pair<uint64_t, uint64_t> &Env = TU->MacroEnvironment;
+
+    auto it = TU->MacroDigests.find(II);
+    bool Undigested = it != TU->MacroDigests.end() && (*it).second.MI;
+    if (it != TU->MacroDigests.end()) {
+      Env.first -= (*it).second.D.first;
+      Env.second -= (*it).second.D.second;
+    }
+
+    if (!MI) {
+      if (it != TU->MacroDigests.end())
+        TU->MacroDigests.erase(it);
+      return;
+    }
+
+    // (a macro waiting to be digested is noted as such already)
+    if (!Undigested)
+      TU->UndigestedMacros.push_back(II);
+
+    CollectState::MacroDigest &Entry = TU->MacroDigests[II];
+    Entry.MI = MI;
+    Entry.D = make_pair(0, 0);
+  }
+
+  // \brief Digest the macros (re)defined since this was last done, into the
+  // macro environment.
+  void digestMacroDefinitions() {
+    pair<uint64_t, uint64_t> &Env = TU->MacroEnvironment;
+
+    for (const IdentifierInfo *II : TU->UndigestedMacros) {
+      auto it = TU->MacroDigests.find(II);
+      if (it == TU->MacroDigests.end() || !(*it).second.MI)
+        continue;
+
+      llvm::MD5 Hash;
+      Hash.update(II->getName());
+      Hash.update(StringRef("", 1));
+      Hash.update(macroDefinitionText((*it).second.MI));
+
+      llvm::MD5::MD5Result Res;
+      Hash.final(Res);
+
+      pair<uint64_t, uint64_t> D(Res.high(), Res.low());
+      Env.first += D.first;
+      Env.second += D.second;
+      (*it).second.MI = nullptr;
+      (*it).second.D = D;
+    }
+
+    TU->UndigestedMacros.clear();
+  }
+
+  // \brief Return a digest of the macros defined at this point (along with
+  // anything else which decides what the code in a system header is).
+  //
+  // (the macros are summed up as they are defined and undefined, since going
+  // through the macro table for every system header included from user code
+  // costs more than the rest of collecting a small translation unit. a sum
+  // doesn't depend on the order they were defined in.)
+  string macroEnvironmentDigest() {
+    digestMacroDefinitions();
+
+    const pair<uint64_t, uint64_t> &Env = TU->MacroEnvironment;
+
+    llvm::MD5 Hash;
+    Hash.update(TU->syst_code ? "sys-code" : "");
+    Hash.update(StringRef("", 1));
+    Hash.update(llvm::formatv("{0:x16}{1:x16}", Env.first, Env.second).str());
+
+    llvm::MD5::MD5Result Res;
+    Hash.final(Res);
+    return Res.digest().str().str();
+  }
+
   void FileChanged(SourceLocation Loc, FileChangeReason Reason,
                    SrcMgr::CharacteristicKind FileType,
                    FileID PrevFID) override {
+    CollectTimer Timer(TU->c.stats().pp_ns, "CarbonCollectPP");
+
+    if (Reason == EnterFile) {
+      FileID FID = SM.getFileID(Loc);
+      if (SM.getFileEntryForID(FID))
+        TU->c.included_file(clang_source_file(FID));
+    }
+
+    //
+    // the code which a system header included from user code brings in is
+    // summarized, given the macro environment it was included in (see
+    // collector::system_header_environment()). if it has been already, what
+    // it declares and defines is left uncoded.
+    //
+    if (TU->syst_cache && Reason == EnterFile && SrcMgr::isSystem(FileType)) {
+      FileID FID = SM.getFileID(Loc);
+      SourceLocation IncLoc = SM.getIncludeLoc(FID);
+
+      if (SM.getFileEntryForID(FID) && IncLoc.isValid() &&
+          SM.getFileCharacteristic(IncLoc) == SrcMgr::C_User) {
+        TU->c.system_header_environment(clang_source_file(FID),
+                                        macroEnvironmentDigest());
+
+        if (!TU->syst_code &&
+            TU->c.system_header_summarized(clang_source_file(FID)))
+          TU->SkippedSystemHeaders.insert(FID);
+      }
+    }
 
     if (debugMode) {
       FileID FID = SM.getDecomposedExpansionLoc(Loc).first;
@@ -212,7 +473,8 @@ public:
         if (isSys)
           llvm::errs() << FE->getName();
         else
-          llvm::errs() << fs::relative(FE->getName().str(), root_src_dir).string();
+          llvm::errs()
+              << fs::relative(FE->getName().str(), TU->root_src_dir).string();
         llvm::errs() << " (" << FileChangeReasonStrings[Reason] << ")\n";
       }
     }
@@ -243,6 +505,8 @@ public:
                           StringRef RelativePath,
                           const Module *Imported,
                           SrcMgr::CharacteristicKind FileType) override {
+    CollectTimer Timer(TU->c.stats().pp_ns, "CarbonCollectPP");
+
     if (!IncludeTok.is(tok::identifier))
       return;
 
@@ -267,7 +531,8 @@ public:
         if (isSys)
           llvm::errs() << FE->getName();
         else
-          llvm::errs() << fs::relative(FE->getName().str(), root_src_dir).string();
+          llvm::errs()
+              << fs::relative(FE->getName().str(), TU->root_src_dir).string();
 
         llvm::errs() << ")\n";
       }
@@ -279,6 +544,8 @@ public:
   //
   void MacroDefined(const Token &MacroNameTok,
                     const MacroDirective *MD) override {
+    CollectTimer Timer(TU->c.stats().pp_ns, "CarbonCollectPP");
+
     const MacroInfo *MI = MD->getMacroInfo();
     if (!MI)
       return;
@@ -287,6 +554,9 @@ public:
     if (!II)
       return;
 
+    if (TU->syst_cache)
+      noteMacroDefinition(II, MI);
+
     SourceRange SR(MI->getDefinitionLoc(), MI->getDefinitionEndLoc());
 
     if (!isSourceRangeSensible(SR))
@@ -294,7 +564,17 @@ public:
 
     StringRef Nm = II->getName();
 
-    bool redefined = macro_defs.find(Nm.str()) != macro_defs.end();
+    auto PrevDef = TU->MacroDefs.find(II);
+    bool redefined = PrevDef != TU->MacroDefs.end();
+
+    //
+    // a summary has the code of a system header, though user code redefining
+    // one of its macros still needs to follow it
+    //
+    if (!redefined && isInSkippedSystemHeader(SR.getBegin())) {
+      TU->MacroDefs[II] = {SR, clang_source_range(SR)};
+      return;
+    }
 
     if (debugMode) {
       if (redefined)
@@ -315,7 +595,7 @@ public:
                                            SM, CI.getLangOpts(), nullptr)
                           .size());
     src_rng.beg -= get_backwards_offset_to_new_line(src_rng);
-    c.code(src_rng);
+    TU->c.code(src_rng);
 
     if (debugMode)
       llvm::errs() << ' ' << src_rng << '\n';
@@ -326,21 +606,29 @@ public:
     // redefinition to preserve the textual ordering when we perform a
     // topological sort of the dependency graph
     //
-    if (redefined && !is_counterpart(src_rng, _macro_defs[Nm.str()])) {
-      auto it = macro_defs.find(Nm.str());
-      auto _it = _macro_defs.find(Nm.str());
-
+    if (redefined && !is_counterpart(src_rng, (*PrevDef).second.Range)) {
       if (debugMode)
         llvm::errs() << "  PrevDefLoc: "
-                     << (*it).second.getBegin().printToString(SM) << '\n'
+                     << (*PrevDef).second.SR.getBegin().printToString(SM) << '\n'
                      << "  PrevDefEndLoc: "
-                     << (*it).second.getEnd().printToString(SM) << '\n';
+                     << (*PrevDef).second.SR.getEnd().printToString(SM) << '\n';
 
-      c.follow_users_of((*_it).second, src_rng);
+      TU->c.follow_users_of((*PrevDef).second.Range, src_rng);
     }
 
-    macro_defs[Nm.str()] = SR;
-    _macro_defs[Nm.str()] = src_rng;
+    TU->MacroDefs[II] = {SR, src_rng};
+  }
+
+  //
+  // Hook called whenever a macro is #undef'd.
+  //
+  void MacroUndefined(const Token &MacroNameTok, const MacroDefinition &MD,
+                      const MacroDirective *Undef) override {
+    CollectTimer Timer(TU->c.stats().pp_ns, "CarbonCollectPP");
+
+    IdentifierInfo *II = MacroNameTok.getIdentifierInfo();
+    if (II && TU->syst_cache)
+      noteMacroDefinition(II, nullptr);
   }
 
   //
@@ -348,6 +636,8 @@ public:
   //
   void MacroExpands(const Token &MacroNameTok, const MacroDefinition &MD,
                     SourceRange userSR, const MacroArgs *Args) override {
+    CollectTimer Timer(TU->c.stats().pp_ns, "CarbonCollectPP");
+
     const MacroInfo *MI = MD.getMacroInfo();
     if (!MI)
       return;
@@ -363,6 +653,13 @@ public:
     if (!isSourceRangeSensible(useeSR))
       return;
 
+    //
+    // the expansions of macros from system headers within system headers (say
+    // glibc's __THROW) are many, and all end up within an #include
+    //
+    if (isSystemToSystemUse(userSR.getBegin(), useeSR.getBegin()))
+      return;
+
     StringRef Nm = II->getName();
 #if 0
     if (debugMode)
@@ -380,7 +677,7 @@ public:
                    << usee << '\n';
 #endif
 
-    c.use(user, usee);
+    TU->c.use(user, usee);
   }
 
   //
@@ -388,6 +685,8 @@ public:
   //
   void Defined(const Token &MacroNameTok, const MacroDefinition &MD,
                SourceRange Range) override {
+    CollectTimer Timer(TU->c.stats().pp_ns, "CarbonCollectPP");
+
     const MacroInfo *MI = MD.getMacroInfo();
 
     if (!MI || MI->isBuiltinMacro() || isInBuiltin(MI->getDefinitionLoc()) ||
@@ -397,12 +696,15 @@ public:
     SourceRange userSR(Range);
     SourceRange useeSR(MI->getDefinitionLoc(), MI->getDefinitionEndLoc());
 
+    if (isSystemToSystemUse(userSR.getBegin(), useeSR.getBegin()))
+      return;
+
     clang_source_range_t user(clang_source_range(userSR));
     user.beg -= get_backwards_offset_to_new_line(user);
 
     clang_source_range_t usee(clang_source_range(useeSR));
 
-    if_def_uses.push_back(make_pair(user, normalize_source_range(usee)));
+    TU->if_def_uses.emplace_back(user, normalize_source_range(usee));
   }
 
   //
@@ -410,6 +712,8 @@ public:
   //
   void Ifdef(SourceLocation Loc, const Token &MacroNameTok,
              const MacroDefinition &MD) override {
+    CollectTimer Timer(TU->c.stats().pp_ns, "CarbonCollectPP");
+
     const MacroInfo *MI = MD.getMacroInfo();
     if (!MI || MI->isBuiltinMacro() || isInBuiltin(MI->getDefinitionLoc()) ||
         isInBuiltin(Loc))
@@ -418,12 +722,15 @@ public:
     SourceRange userSR(Loc, Loc);
     SourceRange useeSR(MI->getDefinitionLoc(), MI->getDefinitionEndLoc());
 
+    if (isSystemToSystemUse(userSR.getBegin(), useeSR.getBegin()))
+      return;
+
     clang_source_range_t user(clang_source_range(userSR));
     user.beg -= get_backwards_offset_to_new_line(user);
 
     clang_source_range_t usee(clang_source_range(useeSR));
 
-    if_def_uses.push_back(make_pair(user, normalize_source_range(usee)));
+    TU->if_def_uses.emplace_back(user, normalize_source_range(usee));
   }
 
   //
@@ -431,6 +738,8 @@ public:
   //
   void Ifndef(SourceLocation Loc, const Token &MacroNameTok,
               const MacroDefinition &MD) override {
+    CollectTimer Timer(TU->c.stats().pp_ns, "CarbonCollectPP");
+
     const MacroInfo *MI = MD.getMacroInfo();
     if (!MI || MI->isBuiltinMacro() || isInBuiltin(MI->getDefinitionLoc()) ||
         isInBuiltin(Loc))
@@ -439,12 +748,15 @@ public:
     SourceRange userSR(Loc, Loc);
     SourceRange useeSR(MI->getDefinitionLoc(), MI->getDefinitionEndLoc());
 
+    if (isSystemToSystemUse(userSR.getBegin(), useeSR.getBegin()))
+      return;
+
     clang_source_range_t user(clang_source_range(userSR));
     user.beg -= get_backwards_offset_to_new_line(user);
 
     clang_source_range_t usee(clang_source_range(useeSR));
 
-    if_def_uses.push_back(make_pair(user, normalize_source_range(usee)));
+    TU->if_def_uses.emplace_back(user, normalize_source_range(usee));
   }
 };
 
@@ -472,18 +784,40 @@ public:
   }
 
   bool HandleTopLevelDecl(DeclGroupRef DR) override {
+    CollectTimer Timer(TU->c.stats().ast_ns, "CarbonCollectDecl");
+
     for (DeclGroupRef::iterator b = DR.begin(), e = DR.end(); b != e; ++b) {
       Decl *D = *b;
 
       if (D->getKind() == Decl::Empty)
         continue;
 
+      //
+      // a summary of the system header it is in has it (and its symbol)
+      // already
+      //
+      if (isInSkippedSystemHeader(D->getBeginLoc())) {
+        ++TU->c.stats().top_level_decls;
+        ++TU->c.stats().opaque_decls;
+        continue;
+      }
+
       clang_source_range_t src_rng = sourceRangeOfTopLevelDecl(D);
 
       //
       // mark this declaration as a piece of code
       //
-      c.code(src_rng);
+      TU->c.code(src_rng);
+
+      //
+      // a declaration in a system header still gets a vertex (and its symbol
+      // is noted), but unless asked otherwise we don't look inside of it
+      //
+      bool opaque = !TU->syst_code && clang_is_system_source_file(src_rng.f);
+
+      ++TU->c.stats().top_level_decls;
+      if (opaque)
+        ++TU->c.stats().opaque_decls;
 
       if (debugMode) {
         llvm::errs() << "TopLevel " << D->getDeclKindName() << ' ';
@@ -507,203 +841,365 @@ public:
         //
 
         if (cast<FunctionDecl>(D)->getStorageClass() == SC_Static)
-          c.static_code(src_rng, FD->getName().str(), FD->hasBody());
+          TU->c.static_code(src_rng, FD->getName().str(), FD->hasBody());
         else
-          c.global_code(src_rng, FD->getName().str(), FD->hasBody());
+          TU->c.global_code(src_rng, FD->getName().str(), FD->hasBody());
 
         // 
         // examine return type
         //
-        needsType(src_rng, FD->getReturnType().getTypePtrOrNull());
+        if (!opaque)
+          needsType(src_rng, FD->getReturnType().getTypePtrOrNull());
       } else if (isa<VarDecl>(D)) {
         //
         // global symbol across object files
         //
 
         VarDecl *VD = cast<VarDecl>(D);
-        c.global_code(src_rng, VD->getName().str(), !VD->hasExternalStorage());
+        TU->c.global_code(src_rng, VD->getName().str(),
+                          !VD->hasExternalStorage());
       } else if (isa<TypedefDecl>(D)) {
         //
         // examine type being typedef'd
         //
 
         TypedefDecl *TD = cast<TypedefDecl>(D);
-        needsType(src_rng, TD->getUnderlyingType().getTypePtrOrNull());
+        if (!opaque)
+          needsType(src_rng, TD->getUnderlyingType().getTypePtrOrNull());
       }
 
       //
       // traverse declaration's insides
       //
-      Visitor.TraverseDecl(*b);
+      if (!opaque)
+        Visitor.TraverseDecl(*b);
     }
 
     return true;
   }
 
-  void HandleTranslationUnit(ASTContext &Context) override {
+  // (what is left once every top-level declaration has been seen)
+  void resolveRemainingUses() {
+    //
+    // turn all the uses seen during the traversal into edges in one go, now
+    // that every top-level declaration has been coded
+    //
+    TU->c.resolve_uses();
+
+    if (debugMode)
+      llvm::errs() << llvm::formatv(
+          "collect: {0} of {1} top-level declarations left opaque\n",
+          TU->c.stats().opaque_decls, TU->c.stats().top_level_decls);
+
     //
     // handle preprocessor ifdef, ifndef, if defined at the end, because we only
     // want to consider those uses which fall within top-level declarations and
     // we'll only be able to know that at the end
     //
-    for (auto &user_usee_pair : if_def_uses) {
+    for (auto &user_usee_pair : TU->if_def_uses) {
       clang_source_range_t &user = user_usee_pair.first;
       clang_source_range_t &usee = user_usee_pair.second;
 
       if (debugMode)
         llvm::errs() << "MacroIfDef " << user << ' ' << usee << '\n';
 
-      c.use_if_user_exists(user, usee);
+      TU->c.use_if_user_exists(user, usee);
+    }
+  }
+
+  void HandleTranslationUnit(ASTContext &Context) override {
+    llvm::TimeTraceScope Scope("CarbonCollectFinish");
+
+    {
+      stats_timer_t Timer(TU->c.stats().finish_ns);
+      resolveRemainingUses();
     }
 
-    c.write_carbon_output();
+    // (which times its own part of the rest)
+    TU->c.write_carbon_output();
   }
 };
 
-class CarbonCollectAction : public PluginASTAction {
-public:
-  CarbonCollectAction() {}
+//
+// whether the main file of the given compiler instance is something we collect,
+// and if so, start collecting it into TU
+//
+static bool beginCollecting(const CompilerInstance &CI) {
+  SourceManager &SM = CI.getSourceManager();
+  const StringRef& src = SM.getFileEntryForID(SM.getMainFileID())->getName();
 
-  unique_ptr<ASTConsumer> CreateASTConsumer(CompilerInstance &CI,
-                                            llvm::StringRef file) override {
-    // XXX
-    gl_SM = &CI.getSourceManager();
+  //
+  // we only process C code
+  //
+  {
+    const LangStandard &LS =
+        LangStandard::getLangStandardForKind(CI.getLangOpts().LangStd);
+    if (LS.getLanguage() != Language::C) {
+      llvm::outs() << llvm::formatv("collect: skipping {0} ({1} code)\n", src,
+                                    LS.getDescription());
+      return false;
+    }
+  }
+
+  TU->c.set_args(fs::canonical(fs::path(src.str())), TU->root_src_dir,
+                 TU->root_bin_dir);
+  TU->c.set_journal(TU->journal);
+
+  TU->SM = &CI.getSourceManager(); /* XXX */
+  return true;
+}
+
+static unique_ptr<ASTConsumer> newCollectConsumer(CompilerInstance &CI) {
+  // XXX
+  TU->SM = &CI.getSourceManager();
 
 #if 0
-    llvm::outs() << "CI.getFrontendOpts().LLVMArgs:" << '\n';
-    for (const auto& p : CI.getInvocation().getPreprocessorOpts().Macros) {
-      string macronm;
-      bool isundef;
-      tie(macronm, isundef) = move(p);
-      llvm::outs() << "  -" << (isundef ? 'U' : 'D') << macronm << '\n';
-    }
+  llvm::outs() << "CI.getFrontendOpts().LLVMArgs:" << '\n';
+  for (const auto& p : CI.getInvocation().getPreprocessorOpts().Macros) {
+    string macronm;
+    bool isundef;
+    tie(macronm, isundef) = move(p);
+    llvm::outs() << "  -" << (isundef ? 'U' : 'D') << macronm << '\n';
+  }
 #endif
-    c.set_invocation_macros(CI.getInvocation().getPreprocessorOpts().Macros);
+  TU->c.set_invocation_macros(CI.getInvocation().getPreprocessorOpts().Macros);
 
 #if 0
-    llvm::errs() << "header search options:\n";
-    llvm::errs() << "  Sysroot: " << CI.getHeaderSearchOpts().Sysroot << '\n';
-    llvm::errs() << "  SystemHeaderPrefixes:\n";
-    for (const HeaderSearchOptions::SystemHeaderPrefix &p :
-         CI.getHeaderSearchOpts().SystemHeaderPrefixes)
-      llvm::errs() << "    " << p.Prefix << '\n';
-    llvm::errs() << "  UserEntries:\n";
-    static const char *IncludeDirGroupStrings[] = {
-        "Quoted",        "Angled",  "IndexHeaderMap", "System",
-        "ExternCSystem", "CSystem", "CXXSystem",      "ObjCSystem",
-        "ObjCXXSystem",  "After"};
-    for (const HeaderSearchOptions::Entry &e :
-         CI.getHeaderSearchOpts().UserEntries)
-      llvm::errs() << "    " << e.Path << ' ' << IncludeDirGroupStrings[e.Group]
-                   << '\n';
+  llvm::errs() << "header search options:\n";
+  llvm::errs() << "  Sysroot: " << CI.getHeaderSearchOpts().Sysroot << '\n';
+  llvm::errs() << "  SystemHeaderPrefixes:\n";
+  for (const HeaderSearchOptions::SystemHeaderPrefix &p :
+       CI.getHeaderSearchOpts().SystemHeaderPrefixes)
+    llvm::errs() << "    " << p.Prefix << '\n';
+  llvm::errs() << "  UserEntries:\n";
+  static const char *IncludeDirGroupStrings[] = {
+      "Quoted",        "Angled",  "IndexHeaderMap", "System",
+      "ExternCSystem", "CSystem", "CXXSystem",      "ObjCSystem",
+      "ObjCXXSystem",  "After"};
+  for (const HeaderSearchOptions::Entry &e :
+       CI.getHeaderSearchOpts().UserEntries)
+    llvm::errs() << "    " << e.Path << ' ' << IncludeDirGroupStrings[e.Group]
+                 << '\n';
 #endif
 
-    std::set<std::string> hdr_dirs;
+  std::set<std::string> hdr_dirs;
 
-    for (const HeaderSearchOptions::Entry &h :
-         CI.getHeaderSearchOpts().UserEntries)
-      if (fs::is_directory(h.Path))
-        hdr_dirs.insert(fs::canonical(h.Path).string());
+  for (const HeaderSearchOptions::Entry &h :
+       CI.getHeaderSearchOpts().UserEntries)
+    if (fs::is_directory(h.Path))
+      hdr_dirs.insert(fs::canonical(h.Path).string());
 
-    c.set_invocation_header_directories(hdr_dirs);
+  TU->c.set_invocation_header_directories(hdr_dirs);
 
 #if 0
-    llvm::errs() << "SystemHeaderPrefixes:\n";
-    for (const HeaderSearchOptions::SystemHeaderPrefix &h :
-         CI.getHeaderSearchOpts().SystemHeaderPrefixes) {
-      llvm::errs() << h.Prefix << ' '
-                   << (fs::is_directory(h.Prefix) ? 'Y' : 'N') << '\n';
-    }
+  llvm::errs() << "SystemHeaderPrefixes:\n";
+  for (const HeaderSearchOptions::SystemHeaderPrefix &h :
+       CI.getHeaderSearchOpts().SystemHeaderPrefixes) {
+    llvm::errs() << h.Prefix << ' '
+                 << (fs::is_directory(h.Prefix) ? 'Y' : 'N') << '\n';
+  }
 #endif
 
 #if 0
-    llvm::errs() << "header dirs:\n";
-    for (const string& d : hdr_dirs)
-      llvm::errs() << "  " << d << '\n';
+  llvm::errs() << "header dirs:\n";
+  for (const string& d : hdr_dirs)
+    llvm::errs() << "  " << d << '\n';
 #endif
 
-    return std::make_unique<CarbonCollectConsumer>(CI);
+  return std::make_unique<CarbonCollectConsumer>(CI);
+}
+
+//
+// the plugin collects the translation unit being compiled. the driver runs cc1
+// in-process (unless given -fno-integrated-cc1), so one process may compile
+// several translation units, one after another: each gets a state of its own.
+//
+static unique_ptr<CollectState> PluginTU;
+
+//
+// the output is written in the background while the compiler goes on with code
+// generation (see collector::write_carbon_output()). nothing of ours gets to
+// run after that (the consumer isn't even destroyed under -disable-free), so
+// wait for it at exit. (registering after llvm::errs() has been constructed
+// ensures that this runs before its destruction.)
+//
+static void waitForCarbonOutput(void) {
+  if (PluginTU)
+    PluginTU->c.wait_for_carbon_output();
+}
+
+class CarbonCollectAction : public PluginASTAction {
+public:
+  CarbonCollectAction() {}
+
+  //
+  // run before the main action, so that our HandleTranslationUnit() gets to
+  // hand off the output to the background before code generation starts. (only
+  // when asked for with -add-plugin; merely loading the plugin, as a build
+  // might for other compiles, collects nothing.)
+  //
+  ActionType getActionType() override { return CmdlineBeforeMainAction; }
+
+  unique_ptr<ASTConsumer> CreateASTConsumer(CompilerInstance &CI,
+                                            llvm::StringRef file) override {
+    return newCollectConsumer(CI);
   }
 
   bool ParseArgs(const CompilerInstance &CI,
                  const vector<string> &args) override {
-    SourceManager &SM = CI.getSourceManager();
-    const StringRef& src = SM.getFileEntryForID(SM.getMainFileID())->getName();
-
     //
-    // we only process C code
+    // (the output of the translation unit before, if any, is still being
+    // written from its state)
     //
-    {
-      const LangStandard &LS =
-          LangStandard::getLangStandardForKind(CI.getLangOpts().LangStd);
-      if (LS.getLanguage() != Language::C) {
-        llvm::outs() << llvm::formatv("collect: skipping {0} ({1} code)\n", src,
-                                      LS.getDescription());
-        return false;
-      }
-    }
+    waitForCarbonOutput();
+    PluginTU.reset(new CollectState());
+    TU = PluginTU.get();
 
     //
     // parse arguments
     //
-    if (args.size() != 2 ||
-        !fs::is_directory(args[0]) ||
-        !fs::is_directory(args[1])) {
+    auto usage = [&](void) -> bool {
       llvm::errs() << "Usage: "
                       "-load carbon-collect.so "
                       "-add-plugin carbon-collect "
                       "-plugin-arg-carbon-collect root_source_directory "
-                      "-plugin-arg-carbon-collect root_build_directory\n";
+                      "-plugin-arg-carbon-collect root_build_directory "
+                      "[-plugin-arg-carbon-collect sys-code] "
+                      "[-plugin-arg-carbon-collect no-sys-cache] "
+                      "[-plugin-arg-carbon-collect journal]\n";
       return false;
+    };
+
+    if (args.size() < 2 ||
+        !fs::is_directory(args[0]) ||
+        !fs::is_directory(args[1]))
+      return usage();
+
+    for (unsigned i = 2; i < args.size(); ++i) {
+      if (args[i] == "sys-code")
+        TU->syst_code = true;
+      else if (args[i] == "no-sys-cache")
+        TU->syst_cache = false;
+      else if (args[i] == "journal")
+        TU->journal = true;
+      else
+        return usage();
     }
 
-    root_src_dir = fs::canonical(args[0]);
-    root_bin_dir = fs::canonical(args[1]);
+    TU->root_src_dir = fs::canonical(args[0]);
+    TU->root_bin_dir = fs::canonical(args[1]);
 
-    c.set_args(fs::canonical(fs::path(src.str())), root_src_dir, root_bin_dir);
+    if (!beginCollecting(CI))
+      return false;
+
+    static bool waitRegistered = false;
+    if (!waitRegistered) {
+      llvm::errs();
+      atexit(waitForCarbonOutput);
+      waitRegistered = true;
+    }
 
-    gl_SM = &CI.getSourceManager(); /* XXX */
     return true;
   }
 };
 
-struct MultipliersForFileIDs {
-  int Curr;
-  map<FileID, int> FIDMap;
+//
+// carbon-collect-batch runs this on every translation unit, each with its own
+// state, and possibly many at once on different threads
+//
+class CarbonCollectFrontendAction : public ASTFrontendAction {
+  CollectState State;
+
+public:
+  CarbonCollectFrontendAction(const collect_options_t &opts) {
+    State.root_src_dir = fs::canonical(opts.root_src_dir);
+    State.root_bin_dir = fs::canonical(opts.root_bin_dir);
+    State.syst_code = opts.syst_code;
+    State.syst_cache = opts.syst_cache;
+    State.journal = opts.journal;
+  }
+
+  unique_ptr<ASTConsumer> CreateASTConsumer(CompilerInstance &CI,
+                                            llvm::StringRef file) override {
+    TU = &State;
+
+    if (!beginCollecting(CI))
+      return std::make_unique<ASTConsumer>();
+
+    return newCollectConsumer(CI);
+  }
 
-  MultipliersForFileIDs() : Curr(0) {}
+  void EndSourceFileAction() override {
+    State.c.wait_for_carbon_output();
+    TU = nullptr;
+  }
 };
 
-/// Note: SM assigns unique FileID's for each unique \#include chain.
-static map<llvm::sys::fs::UniqueID, MultipliersForFileIDs> FileMultMap;
+unique_ptr<FrontendAction> new_collect_action(const collect_options_t &opts) {
+  return std::make_unique<CarbonCollectFrontendAction>(opts);
+}
+
+static FileIDInfo &computeFileIDInfo(FileID FID) {
+  SourceManager &SM = *TU->SM;
+
+  FileIDInfo &Info = TU->FileIDInfos[FID];
+
+  StringRef MB = SM.getBufferData(FID);
+
+  Info.Buf = MB.data();
+  Info.Size = static_cast<int>(MB.size());
+  Info.Offset =
+      TU->FileMultMap[SM.getFileEntryForID(FID)->getUniqueID()]++ * Info.Size;
+
+  return Info;
+}
+
+static inline FileIDInfo &fileIDInfo(FileID FID) {
+  auto it = TU->FileIDInfos.find(FID);
+  if (it != TU->FileIDInfos.end())
+    return (*it).second;
+
+  return computeFileIDInfo(FID);
+}
+
+static const line_breaks_t &lineBreaksOf(FileIDInfo &Info) {
+  if (!Info.Breaks) {
+    auto it = TU->LineBreaksOfBuffer.find(Info.Buf);
+    if (it == TU->LineBreaksOfBuffer.end())
+      it = TU->LineBreaksOfBuffer
+               .emplace(Info.Buf,
+                        line_breaks_t(Info.Buf,
+                                      static_cast<uint32_t>(Info.Size)))
+               .first;
+    Info.Breaks = &(*it).second;
+  }
+
+  return *Info.Breaks;
+}
 
 bool is_counterpart(const clang_source_range_t &lhs,
                     const clang_source_range_t &rhs) {
   if ((lhs.end - lhs.beg) != (rhs.end - rhs.beg))
     return false;
 
-  SourceManager &SM = *gl_SM;
+  // (copied, since looking up the other FileID may grow the cache)
+  FileIDInfo lhsInfo = fileIDInfo(lhs.f);
+  FileIDInfo rhsInfo = fileIDInfo(rhs.f);
 
-  if (SM.getFileEntryForID(lhs.f)->getUniqueID() !=
-      SM.getFileEntryForID(rhs.f)->getUniqueID())
+  if (lhsInfo.Buf != rhsInfo.Buf)
     return false;
 
-  StringRef MB = SM.getBufferData(lhs.f);
-  return lhs.beg % static_cast<int>(MB.size()) ==
-         rhs.beg % static_cast<int>(MB.size());
+  return lhs.beg % lhsInfo.Size == rhs.beg % lhsInfo.Size;
 }
 
 clang_source_range_t
 normalize_source_range(const clang_source_range_t &cl_src_rng) {
-  SourceManager &SM = *gl_SM;
-
-  int beg =
-      cl_src_rng.beg % static_cast<int>(SM.getBufferData(cl_src_rng.f).size());
+  int beg = cl_src_rng.beg % fileIDInfo(cl_src_rng.f).Size;
   return {cl_src_rng.f, beg, beg + (cl_src_rng.end - cl_src_rng.beg)};
 }
 
 clang_source_range_t clang_source_range(const SourceRange &SR) {
-  SourceManager &SM = *gl_SM;
+  SourceManager &SM = *TU->SM;
 
   FileID FID;
   int beg, end;
@@ -720,17 +1216,10 @@ clang_source_range_t clang_source_range(const SourceRange &SR) {
     end = static_cast<int>(endInfo.second) + 1;
   }
 
-  MultipliersForFileIDs &Mults =
-      FileMultMap[SM.getFileEntryForID(FID)->getUniqueID()];
+  int MN = fileIDInfo(FID).Offset;
 
-  if (Mults.FIDMap.find(FID) == Mults.FIDMap.end())
-    Mults.FIDMap[FID] = Mults.Curr++;
-
-  int M = Mults.FIDMap[FID];
-  int N = static_cast<int>(SM.getBufferData(FID).size());
-
-  beg += M * N;
-  end += M * N;
+  beg += MN;
+  end += MN;
 
   return {FID, beg, end};
 }
@@ -744,18 +1233,23 @@ size_t hash_of_clang_source_file(const clang_source_file_t &f) {
 }
 
 fs::path path_of_clang_source_file(const clang_source_file_t &f) {
-  SourceManager &SM = *gl_SM;
+  SourceManager &SM = *TU->SM;
 
   const FileEntry *FE = SM.getFileEntryForID(f);
   if (!FE)
     return fs::path();
 
-  fs::path p(FE->getName().str());
-  return fs::canonical(p);
+  auto it = TU->CanonicalPaths.find(FE->getUniqueID());
+  if (it == TU->CanonicalPaths.end())
+    it = TU->CanonicalPaths
+             .emplace(FE->getUniqueID(), fs::canonical(FE->getName().str()))
+             .first;
+
+  return (*it).second;
 }
 
 bool clang_is_system_source_file(const clang_source_file_t &f) {
-  SourceManager &SM = *gl_SM;
+  SourceManager &SM = *TU->SM;
 
   bool Invalid = false;
   const SrcMgr::SLocEntry &SEntry = SM.getSLocEntry(f, &Invalid);
@@ -765,78 +1259,68 @@ bool clang_is_system_source_file(const clang_source_file_t &f) {
 
 unsigned
 get_backwards_offset_to_new_line(const clang_source_range_t &cl_src_rng) {
-  SourceManager &SM = *gl_SM;
+  FileIDInfo &Info = fileIDInfo(cl_src_rng.f);
 
-  int beg =
-      cl_src_rng.beg % static_cast<int>(SM.getBufferData(cl_src_rng.f).size());
+  int beg = cl_src_rng.beg % Info.Size;
 
-  char ch;
-  int pos = beg;
-
-  while (pos > 0 &&
-         character_at_clang_file_offset(cl_src_rng.f, static_cast<clang_source_location_t>(pos - 1)) != '\r' &&
-         character_at_clang_file_offset(cl_src_rng.f, static_cast<clang_source_location_t>(pos - 1)) != '\n') {
-    --pos;
-  }
-
-  assert(beg >= pos);
-
-  return static_cast<unsigned>(beg - pos);
+  return lineBreaksOf(Info).offset_from_line_start(static_cast<uint32_t>(beg));
 }
 
 unsigned
 get_forwards_offset_to_new_line(const clang_source_range_t &cl_src_rng) {
-  SourceManager &SM = *gl_SM;
+  FileIDInfo &Info = fileIDInfo(cl_src_rng.f);
 
   int len = cl_src_rng.end - cl_src_rng.beg;
-  int beg =
-      cl_src_rng.beg % static_cast<int>(SM.getBufferData(cl_src_rng.f).size());
+  int beg = cl_src_rng.beg % Info.Size;
   int end = beg + len;
 
-  char ch;
-  int pos = end;
-  do {
-    ch = character_at_clang_file_offset(
-        cl_src_rng.f, static_cast<clang_source_location_t>(pos++));
-  } while (ch != '\r' && ch != '\n' && ch != '\0');
-
-  return static_cast<unsigned>(pos - end - 1);
+  return lineBreaksOf(Info).offset_to_line_end(static_cast<uint32_t>(end));
 }
 
 unsigned char_count_until_semicolon(const clang_source_range_t &cl_src_rng) {
-  SourceManager &SM = *gl_SM;
-
-  StringRef MB = SM.getBufferData(cl_src_rng.f);
+  const FileIDInfo &Info = fileIDInfo(cl_src_rng.f);
 
   int len = cl_src_rng.end - cl_src_rng.beg;
-  int beg = cl_src_rng.beg % static_cast<int>(MB.size());
+  int beg = cl_src_rng.beg % Info.Size;
   int end = beg + len;
 
-  char ch;
-  unsigned cnt = 0;
-  clang_source_location_t pos = static_cast<clang_source_location_t>(end);
-  do {
-    if (pos == static_cast<clang_source_location_t>(MB.size()))
-      return 0;
+  if (end >= Info.Size)
+    return 0;
 
-    ++cnt;
-    ch = character_at_clang_file_offset(cl_src_rng.f, pos++);
-  } while (ch != ';');
+  // (memchr is vectorized by the C library)
+  const void *semi = memchr(Info.Buf + end, ';',
+                            static_cast<size_t>(Info.Size - end));
+  if (!semi)
+    return 0;
 
-  return cnt;
+  return static_cast<unsigned>(static_cast<const char *>(semi) -
+                               (Info.Buf + end)) +
+         1;
 }
 
 char character_at_clang_file_offset(const clang_source_file_t &f,
                                     const clang_source_location_t &off) {
   assert(off >= 0);
 
-  SourceManager &SM = *gl_SM;
+  return fileIDInfo(f).Buf[static_cast<unsigned>(off)];
+}
 
-  return SM.getBufferData(f)[static_cast<unsigned>(off)];
+StringRef buffer_of_clang_source_file(const clang_source_file_t &f) {
+  const FileIDInfo &Info = fileIDInfo(f);
+  return StringRef(Info.Buf, static_cast<size_t>(Info.Size));
+}
+
+clang_source_location_t
+offset_of_clang_source_file(const clang_source_file_t &f) {
+  return fileIDInfo(f).Offset;
 }
 
 clang_source_file_t top_level_system_header(const clang_source_file_t &f) {
-  SourceManager &SM = *gl_SM;
+  auto it = TU->TopLevelSystemHeaders.find(f);
+  if (it != TU->TopLevelSystemHeaders.end())
+    return (*it).second;
+
+  SourceManager &SM = *TU->SM;
 
   bool invalid = false;
   const SrcMgr::SLocEntry &sloc = SM.getSLocEntry(f, &invalid);
@@ -851,15 +1335,18 @@ clang_source_file_t top_level_system_header(const clang_source_file_t &f) {
   const SrcMgr::SLocEntry &incSloc = SM.getSLocEntry(incFid, &invalid);
   assert(!invalid && incSloc.isFile());
 
-  if (incSloc.getFile().getFileCharacteristic() == SrcMgr::C_User)
-    return f;
-
+  FileID TopLvl = f;
+  if (incSloc.getFile().getFileCharacteristic() != SrcMgr::C_User) {
 #if 0
-  llvm::errs() << "  "
-               << path_of_clang_source_file(clang_source_file(incFid)).string()
-               << "  $$$\n";
+    llvm::errs() << "  "
+                 << path_of_clang_source_file(clang_source_file(incFid)).string()
+                 << "  $$$\n";
 #endif
-  return top_level_system_header(clang_source_file(incFid));
+    TopLvl = top_level_system_header(clang_source_file(incFid));
+  }
+
+  TU->TopLevelSystemHeaders.emplace(f, TopLvl);
+  return TopLvl;
 }
 
 #if 0
@@ -870,18 +1357,18 @@ llvm::raw_ostream &operator<<(llvm::raw_ostream &os,
   if (clang_is_system_source_file(f))
     return os << srcfp.string();
   else
-    return os << fs::relative(srcfp, root_src_dir).string();
+    return os << fs::relative(srcfp, TU->root_src_dir).string();
 }
 #endif
 
 llvm::raw_ostream &operator<<(llvm::raw_ostream &os,
                               const clang_source_range_t &cl_src_rng) {
-  SourceManager &SM = *gl_SM;
+  SourceManager &SM = *TU->SM;
 
   int beg = cl_src_rng.beg;
   int end = cl_src_rng.end;
 
-  int N = static_cast<int>(SM.getBufferData(cl_src_rng.f).size());
+  int N = fileIDInfo(cl_src_rng.f).Size;
 
   bool normalized = false;
   if (beg > N) {
@@ -899,7 +1386,7 @@ llvm::raw_ostream &operator<<(llvm::raw_ostream &os,
   if (clang_is_system_source_file(cl_src_rng.f)) {
     os << FE->getName();
   } else {
-    os << fs::relative(FE->getName().str(), root_src_dir).string();
+    os << fs::relative(FE->getName().str(), TU->root_src_dir).string();
   }
 
   os << ' ';
@@ -914,7 +1401,7 @@ llvm::raw_ostream &operator<<(llvm::raw_ostream &os,
 }
 
 static bool _isSourceRangeSensible(const SourceRange &SR) {
-  SourceManager &SM = *gl_SM;
+  SourceManager &SM = *TU->SM;
 
   pair<FileID, unsigned> beg = SM.getDecomposedExpansionLoc(SR.getBegin());
   pair<FileID, unsigned> end = SM.getDecomposedExpansionLoc(SR.getEnd());
@@ -938,7 +1425,7 @@ static void needsDecl(const clang_source_range_t &user, const Decl *D) {
     llvm::errs() << usee << '\n';
   }
 
-  c.use(user, usee);
+  TU->c.use(user, usee);
 }
 
 static void needsPointerType(const clang_source_range_t &user,
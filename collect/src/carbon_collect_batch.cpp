@@ -0,0 +1,190 @@
+#include "carbon_collect.h"
+#include "stale.h"
+#include <atomic>
+#include <iostream>
+#include <boost/program_options.hpp>
+#include <clang/Frontend/FrontendAction.h>
+#include <clang/Tooling/ArgumentsAdjusters.h>
+#include <clang/Tooling/CompilationDatabase.h>
+#include <clang/Tooling/Tooling.h>
+#include <llvm/Support/ThreadPool.h>
+#include <llvm/Support/Threading.h>
+
+using namespace std;
+using namespace clang;
+using namespace clang::tooling;
+namespace fs = boost::filesystem;
+namespace po = boost::program_options;
+
+namespace carbon {
+
+class collect_action_factory_t : public FrontendActionFactory {
+  const collect_options_t &opts;
+
+public:
+  collect_action_factory_t(const collect_options_t &opts) : opts(opts) {}
+
+  unique_ptr<FrontendAction> create() override {
+    return new_collect_action(opts);
+  }
+};
+
+//
+// the compilation database may well come from a build which ran the plugin. if
+// so, drop its arguments (each of which comes as -Xclang -arg -Xclang value)
+// since we run the collector ourselves.
+//
+static CommandLineArguments
+strip_plugin_arguments(const CommandLineArguments &args, StringRef) {
+  CommandLineArguments res;
+
+  for (size_t i = 0; i < args.size(); ++i) {
+    if (args[i] == "-Xclang" && i + 1 < args.size()) {
+      StringRef arg(args[i + 1]);
+      if (arg == "-load" || arg == "-add-plugin" ||
+          arg.startswith("-plugin-arg-")) {
+        i += 1;
+        if (i + 2 < args.size() && args[i + 1] == "-Xclang")
+          i += 2;
+        continue;
+      }
+    }
+
+    res.push_back(args[i]);
+  }
+
+  return res;
+}
+
+}
+
+using namespace carbon;
+
+int main(int argc, char **argv) {
+  collect_options_t opts;
+  fs::path db_dir;
+  string resource_dir;
+  unsigned jobs;
+  vector<string> files;
+
+  try {
+    po::options_description desc("Allowed options");
+    desc.add_options()
+      ("help,h", "produce help message")
+
+      ("src", po::value<fs::path>(&opts.root_src_dir)->default_value(fs::current_path()),
+       "specify root source directory where code exists")
+
+      ("bin", po::value<fs::path>(&opts.root_bin_dir)->default_value(fs::current_path()),
+       "specify root build directory where carbon files are to be written")
+
+      ("build-path,p", po::value<fs::path>(&db_dir),
+       "specify directory containing compile_commands.json (defaults to the "
+       "root build directory)")
+
+      ("jobs,j", po::value<unsigned>(&jobs)->default_value(0),
+       "specify number of translation units to collect at once (defaults to "
+       "the number of hardware threads)")
+
+      ("resource-dir", po::value<string>(&resource_dir),
+       "specify clang's resource directory, if it cannot be found relative "
+       "to this program")
+
+      ("sys-code,s", "collect the insides of code from system header files "
+       "(see carbon-extract --sys-code)")
+
+      ("no-sys-cache", "keep the code from system headers in every .carbon "
+       "file, rather than sharing it between them")
+
+      ("journal", "append the output to the build's journal, rather than "
+       "writing a .carbon file for each translation unit")
+
+      ("stale", "only list the source files whose translation units are out "
+       "of date (they, or a file which they include, changed since they were "
+       "collected)")
+
+      ("file", po::value< vector<string> >(&files),
+       "specify source file to collect (defaults to all of them)")
+    ;
+
+    po::positional_options_description p;
+    p.add("file", -1);
+
+    po::variables_map vm;
+    po::store(
+        po::command_line_parser(argc, argv).options(desc).positional(p).run(),
+        vm);
+    po::notify(vm);
+
+    if (vm.count("help")) {
+      cout << "Usage: carbon-collect-batch [options] [file...]\n";
+      cout << desc;
+      return 0;
+    }
+
+    opts.syst_code = vm.count("sys-code") != 0;
+    opts.syst_cache = vm.count("no-sys-cache") == 0;
+    opts.journal = vm.count("journal") != 0;
+
+    if (vm.count("stale")) {
+      for (const fs::path &p : stale_translation_units(
+               fs::canonical(opts.root_src_dir), opts.root_bin_dir))
+        cout << p.string() << '\n';
+      return 0;
+    }
+  } catch (exception &e) {
+    cerr << e.what() << endl;
+    return 1;
+  }
+
+  if (db_dir.empty())
+    db_dir = opts.root_bin_dir;
+
+  string err;
+  unique_ptr<CompilationDatabase> db(
+      CompilationDatabase::loadFromDirectory(db_dir.string(), err));
+  if (!db) {
+    cerr << "carbon-collect-batch: " << err << endl;
+    return 1;
+  }
+
+  if (files.empty())
+    files = db->getAllFiles();
+
+  //
+  // every translation unit gets a ClangTool of its own, so that they share
+  // nothing (not even their file managers) and can be collected in parallel
+  //
+  collect_action_factory_t factory(opts);
+  atomic<unsigned> num_failed(0);
+
+  {
+    llvm::ThreadPool pool(llvm::hardware_concurrency(jobs));
+
+    for (const string &file : files) {
+      pool.async([&, file](void) -> void {
+        ClangTool tool(*db, {file});
+
+        // (on top of the defaults, which make it -fsyntax-only)
+        tool.appendArgumentsAdjuster(strip_plugin_arguments);
+        if (!resource_dir.empty())
+          tool.appendArgumentsAdjuster(getInsertArgumentAdjuster(
+              ("-resource-dir=" + resource_dir).c_str(),
+              ArgumentInsertPosition::END));
+
+        if (tool.run(&factory) != 0)
+          ++num_failed;
+      });
+    }
+
+    pool.wait();
+  }
+
+  if (num_failed) {
+    cerr << "carbon-collect-batch: failed to collect " << num_failed << " of "
+         << files.size() << " translation units" << endl;
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,50 @@
+#include "stale.h"
+#include <iostream>
+#include <boost/program_options.hpp>
+
+using namespace std;
+using namespace carbon;
+namespace fs = boost::filesystem;
+namespace po = boost::program_options;
+
+//
+// lists the source files whose translation units are out of date, one per
+// line, so that only those need collecting again. (this needs nothing of
+// clang's, unlike carbon-collect-batch --stale, which does the same.)
+//
+int main(int argc, char **argv) {
+  fs::path root_src_dir;
+  fs::path root_bin_dir;
+
+  try {
+    po::options_description desc("Allowed options");
+    desc.add_options()
+      ("help,h", "produce help message")
+
+      ("src", po::value<fs::path>(&root_src_dir)->default_value(fs::current_path()),
+       "specify root source directory where code exists")
+
+      ("bin", po::value<fs::path>(&root_bin_dir)->default_value(fs::current_path()),
+       "specify root build directory where carbon files exist")
+    ;
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+
+    if (vm.count("help")) {
+      cout << "Usage: carbon-stale [options]\n";
+      cout << desc;
+      return 0;
+    }
+
+    for (const fs::path &p :
+         stale_translation_units(fs::canonical(root_src_dir), root_bin_dir))
+      cout << p.string() << '\n';
+  } catch (exception &e) {
+    cerr << e.what() << endl;
+    return 1;
+  }
+
+  return 0;
+}
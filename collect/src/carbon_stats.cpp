@@ -0,0 +1,164 @@
+#include "collect_impl.h"
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+
+using namespace std;
+using namespace carbon;
+namespace fs = boost::filesystem;
+namespace po = boost::program_options;
+
+//
+// the stats of a translation unit, as the collector last wrote them to
+// .carbon/.stats (see collect_stats_t), plus total_ns: the sum of the times
+//
+typedef map<string, uint64_t> tu_stats_t;
+
+static void read_stats(const fs::path &p, map<string, tu_stats_t> &out,
+                       vector<string> &keys) {
+  ifstream ifs(p.string());
+
+  string ln;
+  while (getline(ifs, ln)) {
+    string::size_type tab = ln.find('\t');
+    if (tab == string::npos)
+      continue;
+
+    tu_stats_t st;
+    uint64_t total_ns = 0;
+
+    string::size_type beg = tab + 1;
+    while (beg < ln.size()) {
+      string::size_type end = ln.find('\t', beg);
+      if (end == string::npos)
+        end = ln.size();
+
+      string field(ln.substr(beg, end - beg));
+      string::size_type eq = field.find('=');
+      if (eq != string::npos) {
+        string key(field.substr(0, eq));
+        uint64_t val = strtoull(field.c_str() + eq + 1, nullptr, 10);
+
+        st[key] = val;
+        if (find(keys.begin(), keys.end(), key) == keys.end())
+          keys.push_back(key);
+        if (key.size() > 3 && key.compare(key.size() - 3, 3, "_ns") == 0)
+          total_ns += val;
+      }
+
+      beg = end + 1;
+    }
+
+    st["total_ns"] = total_ns;
+
+    // (a translation unit collected more than once counts as of the last time)
+    out[ln.substr(0, tab)] = st;
+  }
+
+  keys.push_back("total_ns");
+}
+
+// times are shown in milliseconds
+static string format_stat(const string &key, uint64_t val) {
+  ostringstream oss;
+  if (key.size() > 3 && key.compare(key.size() - 3, 3, "_ns") == 0)
+    oss << fixed << setprecision(1) << val / 1e6 << " ms";
+  else
+    oss << val;
+  return oss.str();
+}
+
+int main(int argc, char **argv) {
+  fs::path root_bin_dir;
+  string sort_key;
+  unsigned top;
+
+  try {
+    po::options_description desc("Allowed options");
+    desc.add_options()
+      ("help,h", "produce help message")
+
+      ("bin", po::value<fs::path>(&root_bin_dir)->default_value(fs::current_path()),
+       "specify root build directory where carbon files exist")
+
+      ("sort,s", po::value<string>(&sort_key)->default_value("total_ns"),
+       "specify stat by which to rank translation units (e.g. ast_ns, "
+       "serialize_ns, bytes; total_ns is the sum of the times)")
+
+      ("top,n", po::value<unsigned>(&top)->default_value(10),
+       "specify number of worst translation units to list")
+    ;
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+
+    if (vm.count("help")) {
+      cout << "Usage: carbon-stats [options]\n";
+      cout << desc;
+      return 0;
+    }
+  } catch (exception &e) {
+    cerr << e.what() << endl;
+    return 1;
+  }
+
+  fs::path stats_fp(root_bin_dir / ".carbon" / stats_file_name);
+  if (!fs::is_regular_file(stats_fp)) {
+    cerr << "no stats found in " << root_bin_dir << endl;
+    return 1;
+  }
+
+  map<string, tu_stats_t> stats;
+  vector<string> keys;
+  read_stats(stats_fp, stats, keys);
+
+  if (find(keys.begin(), keys.end(), sort_key) == keys.end()) {
+    cerr << "unknown stat '" << sort_key << "'" << endl;
+    return 1;
+  }
+
+  //
+  // totals over the build
+  //
+  cout << stats.size() << " translation units" << endl << endl;
+
+  for (const string &key : keys) {
+    uint64_t sum = 0;
+    for (auto &tu : stats)
+      sum += tu.second[key];
+
+    cout << "  " << left << setw(24) << key << right << setw(16)
+         << format_stat(key, sum) << endl;
+  }
+
+  //
+  // the worst translation units
+  //
+  vector<pair<uint64_t, const string *>> ranked;
+  ranked.reserve(stats.size());
+  for (auto &tu : stats)
+    ranked.push_back(make_pair(tu.second[sort_key], &tu.first));
+
+  sort(ranked.begin(), ranked.end(),
+       [](const pair<uint64_t, const string *> &lhs,
+          const pair<uint64_t, const string *> &rhs) {
+         return lhs.first > rhs.first;
+       });
+  if (ranked.size() > top)
+    ranked.resize(top);
+
+  cout << endl << "worst by " << sort_key << ':' << endl << endl;
+  for (auto &r : ranked)
+    cout << "  " << setw(16) << format_stat(sort_key, r.first) << "  "
+         << *r.second << endl;
+
+  return 0;
+}
@@ -1,21 +1,34 @@
 #include "collect.h"
 #include "collect_impl.h"
+#include "depends_builder.h"
+#include "depends_codec.h"
 #include <set>
+#include <map>
+#include <tuple>
+#include <algorithm>
+#include <functional>
 #include <iostream>
+#include <limits>
 #include <fstream>
 #include <boost/graph/adj_list_serialize.hpp>
 #include <boost/serialization/vector.hpp>
 #include <boost/serialization/list.hpp>
 #include <boost/serialization/unordered_map.hpp>
 #include <boost/serialization/set.hpp>
-#include <boost/icl/interval_map.hpp>
+#include "source_range_index.h"
 #define CARBON_BINARY
 #ifdef CARBON_BINARY
-#include <boost/archive/binary_oarchive.hpp>
+#include <boost/archive/binary_iarchive.hpp>
 #else
-#include <boost/archive/text_oarchive.hpp>
+#include <boost/archive/text_iarchive.hpp>
 #endif
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/MD5.h>
+#include <llvm/Support/MemoryBuffer.h>
 #include <llvm/Support/raw_ostream.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
 
 using namespace std;
 namespace fs = boost::filesystem;
@@ -24,10 +37,6 @@ namespace carbon {
 
 static const bool debugMode = false;
 
-static llvm::raw_ostream &
-operator<<(llvm::raw_ostream &os,
-           const boost::icl::discrete_interval<source_location_t> &intervl);
-
 struct clang_source_file_hasher_t {
   size_t operator()(const clang_source_file_t &k) const {
     return hash_of_clang_source_file(k);
@@ -40,27 +49,194 @@ struct source_file_hasher_t {
   }
 };
 
-static boost::icl::discrete_interval<source_location_t>
-interval_of_source_range(source_range_t src_rng) {
-  return boost::icl::discrete_interval<source_location_t>::right_open(
-      src_rng.beg, src_rng.end);
+static string string_of_interval(source_location_t beg, source_location_t end) {
+  return "[" + to_string(beg) + "," + to_string(end) + ")";
 }
 
-typedef set<depends_vertex_t> depends_vertex_set_t;
-
-typedef boost::icl::interval_map<source_location_t, depends_vertex_set_t>
+typedef source_range_index<source_location_t, dense_vertex_t>
     source_ranges_to_vertex_map_t;
 
+//
+// bumped whenever what goes into a summary of system headers changes, so that
+// summaries left over from an older collector aren't picked up
+//
+static const char *const syst_summary_format = "carbon system summary 3";
+
+static string digest_of(llvm::MD5 &h) {
+  llvm::MD5::MD5Result res;
+  h.final(res);
+  return res.digest().str().str();
+}
+
+static string depends_archive_bytes(const depends_archive_t &g,
+                                   const defined_symbols_t *defs = nullptr) {
+  string res;
+  write_depends(res, g, defs);
+  return res;
+}
+
+static void write_depends_file(const fs::path &p, const depends_archive_t &g,
+                               const defined_symbols_t *defs = nullptr) {
+  ofstream ofs(p.string(), ios::binary);
+  ofs << depends_archive_bytes(g, defs);
+}
+
+// (a summary or blob may have been written by an older collector, as a boost
+// archive)
+static void read_depends_file(const fs::path &p, depends_archive_t &g) {
+  ifstream ifs(p.string(), ios::binary);
+  if (is_depends_encoding(ifs)) {
+    read_depends(ifs, g);
+    return;
+  }
+
+#ifdef CARBON_BINARY
+  boost::archive::binary_iarchive ia(ifs);
+#else
+  boost::archive::text_iarchive ia(ifs);
+#endif
+  ia >> g;
+}
+
+//
+// append to a file which other translation units may be appending to at the
+// same time. what is given goes out in a single write, and under an exclusive
+// lock for when that doesn't make it atomic.
+//
+static void append_shared_file(const fs::path &p, const string &data) {
+  auto fail = [&](void) -> void {
+    throw fs::filesystem_error(
+        "failed to append", p,
+        boost::system::error_code(errno, boost::system::system_category()));
+  };
+
+  int fd = open(p.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0666);
+  if (fd < 0)
+    fail();
+
+  if (flock(fd, LOCK_EX) < 0) {
+    close(fd);
+    fail();
+  }
+
+  for (size_t off = 0; off < data.size();) {
+    ssize_t n = write(fd, data.data() + off, data.size() - off);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      close(fd);
+      fail();
+    }
+    off += n;
+  }
+
+  // (closing it drops the lock)
+  close(fd);
+}
+
+static void append_journal_record(const fs::path &p, const string &path,
+                                  const string &data) {
+  journal_record_header_t hdr;
+  hdr.magic = journal_record_magic;
+  hdr.path_len = static_cast<uint32_t>(path.size());
+  hdr.data_len = data.size();
+
+  string rec;
+  rec.reserve(sizeof(hdr) + path.size() + data.size());
+  rec.append(reinterpret_cast<const char *>(&hdr), sizeof(hdr));
+  rec.append(path);
+  rec.append(data);
+
+  append_shared_file(p, rec);
+}
+
+//
+// the block of .carbon/.symbols for a translation unit (see symbols_file_name)
+//
+static string symbols_block(const string &path, const defined_symbols_t &defs) {
+  string res("@\t" + path + '\n');
+  for (const string &s : defs.glbl_defs)
+    res += "g\t" + s + '\n';
+  for (const string &s : defs.static_defs)
+    res += "s\t" + s + '\n';
+  return res;
+}
+
+//
+// the line of .carbon/.stats for a translation unit: its source file, then a
+// name=value for each of its stats, separated by tabs
+//
+static string stats_line(const string &path, const collect_stats_t &st) {
+  static const pair<const char *, uint64_t collect_stats_t::*> fields[] = {
+      {"top_level_decls", &collect_stats_t::top_level_decls},
+      {"opaque_decls", &collect_stats_t::opaque_decls},
+      {"uses", &collect_stats_t::uses},
+      {"code_merges", &collect_stats_t::code_merges},
+      {"inverse_edges_removed", &collect_stats_t::inverse_edges_removed},
+      {"follow_edges", &collect_stats_t::follow_edges},
+      {"vertices", &collect_stats_t::vertices},
+      {"edges", &collect_stats_t::edges},
+      {"bytes", &collect_stats_t::bytes},
+      {"ast_ns", &collect_stats_t::ast_ns},
+      {"pp_ns", &collect_stats_t::pp_ns},
+      {"finish_ns", &collect_stats_t::finish_ns},
+      {"fixup_ns", &collect_stats_t::fixup_ns},
+      {"shrink_ns", &collect_stats_t::shrink_ns},
+      {"serialize_ns", &collect_stats_t::serialize_ns}};
+
+  string ln(path);
+  for (auto &f : fields) {
+    ln += '\t';
+    ln += f.first;
+    ln += '=';
+    ln += to_string(st.*(f.second));
+  }
+  ln += '\n';
+  return ln;
+}
+
+//
+// write a file which other translation units may be writing at the same time,
+// unless it exists already, and return whether it was us who wrote it. (it is
+// written elsewhere and linked into place, which fails if someone else beat us
+// to it, as opposed to renaming it over theirs.)
+//
+static bool
+write_shared_file(const fs::path &p,
+                  const function<void(const fs::path &)> &write_to) {
+  if (fs::exists(p))
+    return false;
+
+  fs::path tmp_path =
+      p.parent_path() / fs::unique_path("%%%%-%%%%-%%%%-%%%%.tmp");
+  write_to(tmp_path);
+
+  boost::system::error_code ec;
+  fs::create_hard_link(tmp_path, p, ec);
+  fs::remove(tmp_path);
+
+  if (ec && !fs::exists(p))
+    throw fs::filesystem_error("failed to link", tmp_path, p, ec);
+
+  return !ec;
+}
+
+// the symbol tables of a graph, other than glbl_defs
+static array<unordered_map<string, set<full_source_location_t>> *, 3>
+location_set_tables_of(depends_context_t &depctx) {
+  return {{&depctx.glbl_decls, &depctx.static_defs, &depctx.static_decls}};
+}
+
 struct collector_priv {
   //
-  // to-be-serialized
+  // to-be-serialized (the graph is converted to a depends_t when written)
   //
-  depends_t res;
+  depends_builder_t res;
+  depends_context_t depctx;
 
   //
   // intermediaries
   //
-  depends_context_t &depctx;
 
   // map between clang source files and source files
   unordered_map<clang_source_file_t, source_file_t, clang_source_file_hasher_t>
@@ -72,13 +248,76 @@ struct collector_priv {
 
   // most important intermediary. maps from source ranges to vertices in the
   // depends graph so we can add edges upon uses
-  vector<unique_ptr<source_ranges_to_vertex_map_t>> f_usr_src_rng_vert_map;
-  vector<unique_ptr<source_ranges_to_vertex_map_t>> f_sys_src_rng_vert_map;
+  vector<source_ranges_to_vertex_map_t> f_usr_src_rng_vert_map;
+  vector<source_ranges_to_vertex_map_t> f_sys_src_rng_vert_map;
 
   unordered_map<clang_source_file_t, unsigned, clang_source_file_hasher_t>
       top_lvl_syst_src_idx_map;
 
-  collector_priv() : depctx(res[boost::graph_bundle]) {}
+  // the top-level system header each system source file was brought in by
+  // (parallel to depctx.syst_src_f_paths)
+  vector<clang_source_file_t> toplvl_syst_src_cl_fs;
+
+  // the key of the summary of each top-level system header which is to be
+  // summarized (see summary_key()), and a digest of the contents of each system
+  // source file, along with the offset its ranges are shifted by (see
+  // offset_of_clang_source_file()). (the digest is empty for the files which
+  // are not to be summarized.)
+  unordered_map<clang_source_file_t, string, clang_source_file_hasher_t>
+      syst_env_map;
+  vector<string> syst_src_f_digests;
+  vector<source_location_t> syst_src_f_offsets;
+
+  //
+  // a file of a summary, as its key lists them (see summarize_system_code()).
+  // the same file may be in it more than once, each time at another offset.
+  //
+  struct summary_file_t {
+    string path;
+    string digest;
+    source_location_t offset;
+  };
+
+  //
+  // the top-level system headers whose code is left to a summary which an
+  // earlier translation unit wrote (see adopt_system_summary()): its
+  // fingerprint and its files, and the index in it of each file (by path and
+  // offset) which the header brought into this translation unit. it is stale
+  // if the header brought in other files than the summary has (see
+  // check_adopted_summaries()).
+  //
+  struct adopted_summary_t {
+    string fp;
+    vector<summary_file_t> files;
+    map<pair<string, source_location_t>, unsigned> local_of;
+    bool stale = false;
+  };
+  map<clang_source_file_t, adopted_summary_t> syst_adopted;
+
+  // the digests of the contents of files as they are on disk now, by path
+  map<string, string> disk_digests;
+
+  // whether the code of each system source file went into a summary (parallel
+  // to depctx.syst_src_f_paths, until prune_system_code())
+  vector<bool> syst_src_f_summarized;
+
+  // the files the compiler entered, in order (each possibly more than once)
+  vector<clang_source_file_t> included_cl_fs;
+
+  collect_stats_t stats;
+
+  //
+  // uses are only logged as they are reported, and resolved to edges in one
+  // batch (see resolve_uses()) before anything looks at the edges of the graph
+  //
+  struct logged_use_t {
+    source_range_t user;
+    source_range_t usee;
+    uint32_t seq;
+  };
+  vector<logged_use_t> use_log;
+
+  collector_priv() {}
 
   void clang_source_file(const clang_source_file_t &);
 
@@ -100,10 +339,13 @@ struct collector_priv {
   string path_of_source_file(const source_file_t &);
 
   void code(const clang_source_range_t &cl_src_range);
+  void code(const source_range_t &src_rng);
 
   void use(const clang_source_range_t &user_cl_src_rng,
            const clang_source_range_t &usee_cl_src_rng);
 
+  void resolve_uses();
+
   void use_if_user_exists(const clang_source_range_t &user,
                           const clang_source_range_t &usee);
 
@@ -111,6 +353,55 @@ struct collector_priv {
                        const clang_source_range_t &);
 
   void fixup_static_functions();
+
+  void digest_system_source_files();
+  void digest_included_files();
+
+  // the key of the summary of the code which the given top-level system
+  // header brings in, given the macro environment it was included in
+  string summary_key(const clang_source_file_t &, const string &env);
+
+  // if there is a summary under the key of the given top-level system header,
+  // and the files it was made of are the same on disk, leave its code to it,
+  // and return true
+  bool adopt_system_summary(const fs::path &summaries_dir,
+                            const clang_source_file_t &);
+
+  // check that the headers left to summaries brought in the files their
+  // summaries have. (a file changing while the translation unit was compiled
+  // leaves the code of its header out of the graph; this complains of it.)
+  void check_adopted_summaries(const fs::path &summaries_dir);
+
+  // leave the code of the headers found to be summarized already (see
+  // adopt_system_summary()) to their summaries. (which widens the vertices it
+  // keeps, merging those which get to be the same, so what they reached goes
+  // along)
+  void adopt_system_summaries(const fs::path &summaries_dir,
+                              vector<bool> &reached);
+
+  // (likewise)
+  void summarize_system_code(const fs::path &summaries_dir,
+                             vector<bool> &reached);
+  void adopt_system_code(const fs::path &summaries_dir,
+                         const clang_source_file_t &toplvl,
+                         const adopted_summary_t &,
+                         const vector<unsigned> &files, vector<bool> &reached);
+
+  void share_user_headers(const fs::path &blobs_dir, const string &main_path);
+
+  // the vertex of the code at the given location, or depends_builder_t::nil
+  dense_vertex_t vertex_of_location(const full_source_location_t &);
+
+  // the code which user code depends on, as of now (see prune_system_code())
+  vector<bool> reachable_code();
+
+  // remove the system code which was not found to be reachable. (which must be
+  // found before summarize_system_code() removes code reached through)
+  //
+  // this only makes the output smaller: the code was coded all the same. what
+  // spares the collector the work is leaving the code of headers which are
+  // summarized already uncoded (see collector::system_header_summarized()).
+  void prune_system_code(const vector<bool> &reached);
 };
 
 void collector_priv::clang_source_file(const clang_source_file_t &f) {
@@ -134,8 +425,10 @@ void collector_priv::clang_source_file(const clang_source_file_t &f) {
 #if 0
       llvm::errs() << path_of_clang_source_file(f).string() << "  $$$\n";
 #endif
+      clang_source_file_t toplvl = top_level_system_header(f);
       depctx.toplvl_syst_src_f_paths.push_back(
-          path_of_clang_source_file(top_level_system_header(f)).string());
+          path_of_clang_source_file(toplvl).string());
+      toplvl_syst_src_cl_fs.push_back(toplvl);
     } else {
       _f = static_cast<source_file_t>(depctx.user_src_f_paths.size());
 
@@ -147,22 +440,18 @@ void collector_priv::clang_source_file(const clang_source_file_t &f) {
 
     auto &f_src_rng_vert_map =
         is_sys ? f_sys_src_rng_vert_map : f_usr_src_rng_vert_map;
-    f_src_rng_vert_map.emplace_back(new source_ranges_to_vertex_map_t);
+    f_src_rng_vert_map.emplace_back();
 
     // create a vertex which denotes the entire file
     source_range_t entire_f_src_rng = {_f, location_entire_file_beg,
                                        location_entire_file_end};
-    depends_vertex_set_t entire_f_v_container;
-    depends_vertex_t entire_f_v = boost::add_vertex(res);
-    res[entire_f_v] = entire_f_src_rng;
-    entire_f_v_container.insert(entire_f_v);
+    dense_vertex_t entire_f_v = res.add_vertex(entire_f_src_rng);
 
     source_ranges_to_vertex_map_t &src_rng_to_vert_map =
         source_range_vertex_map_of_source_file(entire_f_src_rng.f);
 
-    auto intervl = interval_of_source_range(entire_f_src_rng);
-
-    src_rng_to_vert_map.add(make_pair(intervl, entire_f_v_container));
+    src_rng_to_vert_map.insert(entire_f_src_rng.beg, entire_f_src_rng.end,
+                               entire_f_v);
   }
 }
 
@@ -190,8 +479,8 @@ collector_priv::map_source_range(const source_range_t &srcrng) {
 source_ranges_to_vertex_map_t &
 collector_priv::source_range_vertex_map_of_source_file(const source_file_t &f) {
   unsigned idx = index_of_source_file(f);
-  return is_system_source_file(f) ? *f_sys_src_rng_vert_map[idx].get()
-                                  : *f_usr_src_rng_vert_map[idx].get();
+  return is_system_source_file(f) ? f_sys_src_rng_vert_map[idx]
+                                  : f_usr_src_rng_vert_map[idx];
 }
 
 string collector_priv::path_of_source_file(const source_file_t &f) {
@@ -203,53 +492,123 @@ string collector_priv::path_of_source_file(const source_file_t &f) {
 
 void collector_priv::use(const clang_source_range_t &user_cl_src_rng,
                          const clang_source_range_t &usee_cl_src_rng) {
-  code(user_cl_src_rng);
-  code(usee_cl_src_rng);
+  logged_use_t u;
+  u.user = map_clang_source_range(user_cl_src_rng);
+  u.usee = map_clang_source_range(usee_cl_src_rng);
+  u.seq = static_cast<uint32_t>(use_log.size());
 
-  source_range_t user_src_rng(map_clang_source_range(user_cl_src_rng));
-  source_range_t usee_src_rng(map_clang_source_range(usee_cl_src_rng));
+  use_log.push_back(u);
+  ++stats.uses;
+}
 
-  source_ranges_to_vertex_map_t &user_src_rng_to_vert_map =
-      source_range_vertex_map_of_source_file(user_src_rng.f);
-  source_ranges_to_vertex_map_t &usee_src_rng_to_vert_map =
-      source_range_vertex_map_of_source_file(usee_src_rng.f);
+void collector_priv::resolve_uses() {
+  if (use_log.empty())
+    return;
+
+  //
+  // the same user typically uses the same usee over and over again. sort the
+  // log so that repeats are adjacent, and keep only the last of each.
+  //
+  auto key = [](const logged_use_t &u) {
+    return make_tuple(u.user.f, u.user.beg, u.user.end, u.usee.f, u.usee.beg,
+                      u.usee.end);
+  };
+  sort(use_log.begin(), use_log.end(),
+       [&](const logged_use_t &lhs, const logged_use_t &rhs) {
+         return make_pair(key(lhs), lhs.seq) < make_pair(key(rhs), rhs.seq);
+       });
+
+  auto it = use_log.begin();
+  for (auto next = it; next != use_log.end(); ++next) {
+    if (next + 1 != use_log.end() && key(*next) == key(*(next + 1)))
+      continue;
 
-  auto user_vert_it = user_src_rng_to_vert_map.find(user_src_rng.beg);
-  auto usee_vert_it = usee_src_rng_to_vert_map.find(usee_src_rng.beg);
+    *it++ = *next;
+  }
+  use_log.erase(it, use_log.end());
 
-  assert(user_vert_it != user_src_rng_to_vert_map.end() &&
-         usee_vert_it != usee_src_rng_to_vert_map.end());
+  //
+  // code all the ranges first, so that every use is resolved against the final
+  // vertices
+  //
+  for (const logged_use_t &u : use_log) {
+    code(u.user);
+    code(u.usee);
+  }
 
-  const depends_vertex_set_t &user_vert_container = (*user_vert_it).second;
-  const depends_vertex_set_t &usee_vert_container = (*usee_vert_it).second;
+  struct resolved_use_t {
+    dense_vertex_t user;
+    dense_vertex_t usee;
+    uint32_t seq;
+  };
+  vector<resolved_use_t> resolved;
+  resolved.reserve(use_log.size());
 
-  assert(user_vert_container.size() == 1);
-  assert(usee_vert_container.size() == 1);
+  for (const logged_use_t &u : use_log) {
+    source_ranges_to_vertex_map_t &user_src_rng_to_vert_map =
+        source_range_vertex_map_of_source_file(u.user.f);
+    source_ranges_to_vertex_map_t &usee_src_rng_to_vert_map =
+        source_range_vertex_map_of_source_file(u.usee.f);
 
-  depends_vertex_t user_vert = *user_vert_container.begin();
-  depends_vertex_t usee_vert = *usee_vert_container.begin();
+    auto user_vert_idx = user_src_rng_to_vert_map.find(u.user.beg);
+    auto usee_vert_idx = usee_src_rng_to_vert_map.find(u.usee.beg);
 
-  //
-  // check for user using itself. when this occurs, do nothing.
-  //
-  if (user_vert == usee_vert)
-    return;
+    assert(user_vert_idx != source_ranges_to_vertex_map_t::npos &&
+           usee_vert_idx != source_ranges_to_vertex_map_t::npos);
+
+    dense_vertex_t user_vert = user_src_rng_to_vert_map.vertex(user_vert_idx);
+    dense_vertex_t usee_vert = usee_src_rng_to_vert_map.vertex(usee_vert_idx);
+
+    //
+    // check for user using itself. when this occurs, do nothing.
+    //
+    if (user_vert == usee_vert)
+      continue;
 
+    resolved.push_back({user_vert, usee_vert, u.seq});
+  }
+
+  use_log.clear();
 
   //
-  // check for inverse edge already existing
+  // a use deletes any preexisting inverse edge, so of all the uses between two
+  // vertices (in either direction) only the last one matters
   //
-  if (boost::edge(usee_vert, user_vert, res).second) {
-    // delete preexisting inverse edge
-    boost::remove_edge(boost::edge(usee_vert, user_vert, res).first, res);
-  }
+  auto pair_key = [](const resolved_use_t &u) {
+    return make_pair(min(u.user, u.usee), max(u.user, u.usee));
+  };
+  sort(resolved.begin(), resolved.end(),
+       [&](const resolved_use_t &lhs, const resolved_use_t &rhs) {
+         return make_pair(pair_key(lhs), lhs.seq) <
+                make_pair(pair_key(rhs), rhs.seq);
+       });
+
+  for (auto it = resolved.begin(); it != resolved.end(); ++it) {
+    if (it + 1 != resolved.end() && pair_key(*it) == pair_key(*(it + 1)))
+      continue;
+
+    dense_vertex_t user_vert = (*it).user;
+    dense_vertex_t usee_vert = (*it).usee;
+
+    //
+    // check for inverse edge already existing
+    //
+    if (res.edge(usee_vert, user_vert)) {
+      // delete preexisting inverse edge
+      res.remove_edge(usee_vert, user_vert);
+      ++stats.inverse_edges_removed;
+    }
 
-  boost::add_edge(user_vert, usee_vert, res);
+    if (!res.edge(user_vert, usee_vert))
+      res.add_edge(user_vert, usee_vert);
+  }
 }
 
 void collector_priv::use_if_user_exists(
     const clang_source_range_t &user_cl_src_rng,
     const clang_source_range_t &usee_cl_src_rng) {
+  resolve_uses();
+
   code(usee_cl_src_rng);
 
   source_range_t user_src_rng(map_clang_source_range(user_cl_src_rng));
@@ -260,22 +619,16 @@ void collector_priv::use_if_user_exists(
   source_ranges_to_vertex_map_t &usee_src_rng_to_vert_map =
       source_range_vertex_map_of_source_file(usee_src_rng.f);
 
-  auto user_vert_it = user_src_rng_to_vert_map.find(user_src_rng.beg);
-  auto usee_vert_it = usee_src_rng_to_vert_map.find(usee_src_rng.beg);
+  auto user_vert_idx = user_src_rng_to_vert_map.find(user_src_rng.beg);
+  auto usee_vert_idx = usee_src_rng_to_vert_map.find(usee_src_rng.beg);
 
-  if (user_vert_it == user_src_rng_to_vert_map.end())
+  if (user_vert_idx == source_ranges_to_vertex_map_t::npos)
     return;
 
-  assert(usee_vert_it != usee_src_rng_to_vert_map.end());
-
-  const depends_vertex_set_t &user_vert_container = (*user_vert_it).second;
-  const depends_vertex_set_t &usee_vert_container = (*usee_vert_it).second;
-
-  assert(user_vert_container.size() == 1);
-  assert(usee_vert_container.size() == 1);
+  assert(usee_vert_idx != source_ranges_to_vertex_map_t::npos);
 
-  depends_vertex_t user_vert = *user_vert_container.begin();
-  depends_vertex_t usee_vert = *usee_vert_container.begin();
+  dense_vertex_t user_vert = user_src_rng_to_vert_map.vertex(user_vert_idx);
+  dense_vertex_t usee_vert = usee_src_rng_to_vert_map.vertex(usee_vert_idx);
 
   //
   // check for user using itself. when this occurs, do nothing.
@@ -286,15 +639,17 @@ void collector_priv::use_if_user_exists(
   //
   // check for inverse edge already existing
   //
-  if (boost::edge(usee_vert, user_vert, res).second)
+  if (res.edge(usee_vert, user_vert))
     return;
 
-  boost::add_edge(user_vert, usee_vert, res);
+  res.add_edge(user_vert, usee_vert);
 }
 
 void collector_priv::follow_users_of(
     const clang_source_range_t &usee_cl_src_rng,
     const clang_source_range_t &user_cl_src_rng) {
+  resolve_uses();
+
   code(user_cl_src_rng);
   code(usee_cl_src_rng);
 
@@ -306,20 +661,14 @@ void collector_priv::follow_users_of(
   source_ranges_to_vertex_map_t &usee_src_rng_to_vert_map =
       source_range_vertex_map_of_source_file(usee_src_rng.f);
 
-  auto user_vert_it = user_src_rng_to_vert_map.find(user_src_rng.beg);
-  auto usee_vert_it = usee_src_rng_to_vert_map.find(usee_src_rng.beg);
-
-  assert(user_vert_it != user_src_rng_to_vert_map.end() &&
-         usee_vert_it != usee_src_rng_to_vert_map.end());
+  auto user_vert_idx = user_src_rng_to_vert_map.find(user_src_rng.beg);
+  auto usee_vert_idx = usee_src_rng_to_vert_map.find(usee_src_rng.beg);
 
-  const depends_vertex_set_t &user_vert_container = (*user_vert_it).second;
-  const depends_vertex_set_t &usee_vert_container = (*usee_vert_it).second;
+  assert(user_vert_idx != source_ranges_to_vertex_map_t::npos &&
+         usee_vert_idx != source_ranges_to_vertex_map_t::npos);
 
-  assert(user_vert_container.size() == 1);
-  assert(usee_vert_container.size() == 1);
-
-  depends_vertex_t user_vert = *user_vert_container.begin();
-  depends_vertex_t usee_vert = *usee_vert_container.begin();
+  dense_vertex_t user_vert = user_src_rng_to_vert_map.vertex(user_vert_idx);
+  dense_vertex_t usee_vert = usee_src_rng_to_vert_map.vertex(usee_vert_idx);
 
   //
   // check for user using itself. when this occurs, do nothing.
@@ -330,297 +679,1181 @@ void collector_priv::follow_users_of(
   //
   // make the edges
   //
-  depends_t::in_edge_iterator e_it, e_it_end;
-  for (tie(e_it, e_it_end) = boost::in_edges(usee_vert, res); e_it != e_it_end;
-       ++e_it) {
-    depends_vertex_t to_v = boost::source(*e_it, res);
+  vector<depends_builder_t::adjacent_t> in_verts;
+  res.in_edges(usee_vert, in_verts);
+  for (const depends_builder_t::adjacent_t &in_v_pair : in_verts) {
+    dense_vertex_t to_v = in_v_pair.first;
 
-    if (boost::edge(to_v, user_vert, res).second)
+    if (res.edge(to_v, user_vert))
       continue;
 
-    res[boost::add_edge(user_vert, to_v, res).first].t = DEPENDS_FOLLOWS_EDGE;
+    res.add_edge(user_vert, to_v, DEPENDS_FOLLOWS_EDGE);
+    ++stats.follow_edges;
   }
 }
 
 void collector_priv::code(const clang_source_range_t &cl_src_range) {
-  source_range_t src_rng(map_clang_source_range(cl_src_range));
-  auto intervl = interval_of_source_range(src_rng);
+  code(map_clang_source_range(cl_src_range));
+}
 
+void collector_priv::code(const source_range_t &src_rng) {
   source_ranges_to_vertex_map_t &src_rng_to_vert_map =
       source_range_vertex_map_of_source_file(src_rng.f);
 
   //
   // check for a pre-existing source ranges which overlap
   //
-  auto preexist_it = src_rng_to_vert_map.find(intervl);
-  if (preexist_it == src_rng_to_vert_map.end()) {
+  source_ranges_to_vertex_map_t::size_type preexist_beg, preexist_end;
+  tie(preexist_beg, preexist_end) =
+      src_rng_to_vert_map.overlapping(src_rng.beg, src_rng.end);
+  if (preexist_beg == preexist_end) {
     // no overlapping source range
 
-    depends_vertex_t v = boost::add_vertex(res);
-    res[v] = src_rng;
-    depends_vertex_set_t v_container;
-    v_container.insert(v);
+    dense_vertex_t v = res.add_vertex(src_rng);
 
-    src_rng_to_vert_map.add(make_pair(intervl, v_container));
+    src_rng_to_vert_map.assign(preexist_beg, preexist_end, src_rng.beg,
+                               src_rng.end, v);
     return;
   }
 
   //
   // if an existing mapping contains this one, then we have nothing to do
   //
-  if (boost::icl::contains((*preexist_it).first, intervl)) {
+  if (src_rng_to_vert_map.beg(preexist_beg) <= src_rng.beg &&
+      src_rng.end <= src_rng_to_vert_map.end(preexist_beg)) {
     if (debugMode)
       llvm::errs() << path_of_source_file(src_rng.f) << ' '
-                   << (*preexist_it).first << " ⊇ " << intervl << '\n';
+                   << string_of_interval(src_rng_to_vert_map.beg(preexist_beg),
+                                         src_rng_to_vert_map.end(preexist_beg))
+                   << " ⊇ " << string_of_interval(src_rng.beg, src_rng.end)
+                   << '\n';
     return;
   }
 
-  // delete existing mapping(s), and insert new one
-  list<pair<depends_vertex_t, DEPENDS_EDGE_TYPE>> in_verts;
-  list<pair<depends_vertex_t, DEPENDS_EDGE_TYPE>> out_verts;
-
   //
-  // we need to assemble a set of the vertices we'll be merging, because if
-  // there are edges between them we must not add them.
+  // merge the preexisting vertices into the first of them, which comes to
+  // represent the lot; the edges to and from them are only rewritten when the
+  // graph is finally written. the preexisting ranges never overlap each other,
+  // so the hull of the new range and all of them is the merged range.
   //
-  unordered_set<depends_vertex_t> preexist_verts;
-
-  do {
-    if (!boost::icl::contains(intervl, (*preexist_it).first)) {
-      if (debugMode) {
-        ostringstream oss;
-        oss << path_of_source_file(src_rng.f) << ' ' << intervl;
-        string s(oss.str());
+  source_location_t beg = min(src_rng.beg, src_rng_to_vert_map.beg(preexist_beg));
+  source_location_t end =
+      max(src_rng.end, src_rng_to_vert_map.end(preexist_end - 1));
+
+  dense_vertex_t v = src_rng_to_vert_map.vertex(preexist_beg);
+
+  for (auto i = preexist_beg; i != preexist_end; ++i) {
+    if (debugMode) {
+      string preexist_s(string_of_interval(src_rng_to_vert_map.beg(i),
+                                           src_rng_to_vert_map.end(i)));
+      if (src_rng.beg > src_rng_to_vert_map.beg(i) ||
+          src_rng.end < src_rng_to_vert_map.end(i)) {
+        string s(path_of_source_file(src_rng.f) + ' ' +
+                 string_of_interval(src_rng.beg, src_rng.end));
         string sp(s.size(), ' ');
 
-        llvm::errs() << s << " ⊊\n" << sp << " ⊋ " << (*preexist_it).first
+        llvm::errs() << s << " ⊊\n" << sp << " ⊋ " << preexist_s << '\n';
+      } else {
+        llvm::errs() << path_of_source_file(src_rng.f) << ' ' << preexist_s
+                     << " ⊆ " << string_of_interval(src_rng.beg, src_rng.end)
                      << '\n';
       }
+    }
+
+    if (i != preexist_beg) {
+      res.merge(v, src_rng_to_vert_map.vertex(i));
+      ++stats.code_merges;
+    }
+  }
+
+  res[v] = {src_rng.f, beg, end};
+
+  //
+  // store the merged vertex in place of the preexisting ones
+  //
+  src_rng_to_vert_map.assign(preexist_beg, preexist_end, beg, end, v);
 
-      intervl = boost::icl::hull(intervl, (*preexist_it).first);
+  if (debugMode)
+    llvm::errs() << "  " << string_of_interval(beg, end) << '\n';
+}
+
+void collector_priv::fixup_static_functions() {
+  //
+  // for all code which depends on a static function declaration, search for a
+  // corresponding definition and add a forward declaration edge to it.
+  //
+  for (auto &entry : depctx.static_decls) {
+    full_source_location_t def_sr;
+
+    // does a corresponding definition exist?
+    auto sdefs_it = depctx.static_defs.find(entry.first);
+    if (sdefs_it == depctx.static_defs.end()) {
+      // try looking at non-static global definitions
+      auto gdefs_it = depctx.glbl_defs.find(entry.first);
+      if (gdefs_it == depctx.glbl_defs.end()) {
+	llvm::errs()
+	    << "warning: no definition found for static function declaration "
+	    << entry.first << '\n';
+	continue;
+      }
+
+      def_sr = (*gdefs_it).second;
     } else {
-      if (debugMode) {
-        llvm::errs() << path_of_source_file(src_rng.f) << ' '
-                     << (*preexist_it).first << " ⊆ " << intervl << '\n';
+      auto def_it = (*sdefs_it).second.begin();
+      assert(def_it != (*sdefs_it).second.end());
+
+      def_sr = *def_it++;
+
+      if (def_it != (*sdefs_it).second.end())
+	llvm::errs() << "warning: multiple definitions found for static function "
+		     << entry.first << '\n';
+    }
+
+    // get definition vertex
+    auto &def_sr_map = source_range_vertex_map_of_source_file(def_sr.f);
+    auto def_vert_idx = def_sr_map.find(def_sr.beg);
+    if (def_vert_idx == source_ranges_to_vertex_map_t::npos) {
+      llvm::errs()
+          << "warning (bug): static function definition not found in source "
+             "ranges map [symbol: "
+          << entry.first << " offset: " << def_sr.beg << " file: "
+          << path_of_source_file(def_sr.f)
+          << '\n';
+      continue;
+    }
+    auto def_vert = def_sr_map.vertex(def_vert_idx);
+
+    for (auto &dcl_sr : entry.second) {
+      // get declaration vertex
+      auto &dcl_sr_map = source_range_vertex_map_of_source_file(dcl_sr.f);
+      auto dcl_vert_idx = dcl_sr_map.find(dcl_sr.beg);
+      if (dcl_vert_idx == source_ranges_to_vertex_map_t::npos) {
+        llvm::errs()
+            << "warning (bug): static function declaration not found in source "
+               "ranges map [symbol: "
+            << entry.first << " offset: " << dcl_sr.beg << " file: "
+            << path_of_source_file(dcl_sr.f)
+            << '\n';
+        continue;
       }
+      auto dcl_vert = dcl_sr_map.vertex(dcl_vert_idx);
+
+      res.add_edge(dcl_vert, def_vert, DEPENDS_FWD_DECL_EDGE);
     }
+  }
+}
 
-    assert((*preexist_it).second.size() == 1);
-    auto preexist_v = *(*preexist_it).second.begin();
-    preexist_verts.insert(preexist_v);
+dense_vertex_t
+collector_priv::vertex_of_location(const full_source_location_t &loc) {
+  auto &sr_map = source_range_vertex_map_of_source_file(loc.f);
+  auto idx = sr_map.find(loc.beg);
+  return idx == source_ranges_to_vertex_map_t::npos ? depends_builder_t::nil
+                                                    : sr_map.vertex(idx);
+}
 
-    {
-      depends_t::in_edge_iterator e_it, e_it_end;
-      for (tie(e_it, e_it_end) = boost::in_edges(preexist_v, res);
-           e_it != e_it_end; ++e_it)
-        in_verts.push_back(make_pair(boost::source(*e_it, res), res[*e_it].t));
+// a digest of the contents of a file
+static string digest_of_file_contents(const clang_source_file_t &f) {
+  llvm::MD5 h;
+  h.update(buffer_of_clang_source_file(f));
+  return digest_of(h);
+}
+
+string collector_priv::summary_key(const clang_source_file_t &f,
+                                   const string &env) {
+  llvm::MD5 h;
+  auto update = [&](const string &s) -> void {
+    h.update(s);
+    h.update(llvm::StringRef("", 1));
+  };
+
+  update(syst_summary_format);
+  update(env);
+  for (const string &dir : depctx.include.dirs)
+    update(dir);
+  update(path_of_clang_source_file(f).string());
+  update(digest_of_file_contents(f));
+
+  return digest_of(h);
+}
+
+void collector_priv::digest_system_source_files() {
+  syst_src_f_digests.assign(depctx.syst_src_f_paths.size(), string());
+  syst_src_f_offsets.assign(depctx.syst_src_f_paths.size(), 0);
+
+  for (unsigned i = 0; i < depctx.syst_src_f_paths.size(); ++i) {
+    if (syst_env_map.find(toplvl_syst_src_cl_fs[i]) == syst_env_map.end())
+      continue;
+
+    clang_source_file_t f = map_source_file(syst_index_of_index(i));
+    syst_src_f_digests[i] = digest_of_file_contents(f);
+    syst_src_f_offsets[i] = offset_of_clang_source_file(f);
+  }
+}
+
+void collector_priv::check_adopted_summaries(const fs::path &summaries_dir) {
+  if (syst_adopted.empty())
+    return;
+
+  //
+  // the files which the headers left to their summaries brought in, whether or
+  // not any of their code was used
+  //
+  map<clang_source_file_t, vector<summary_file_t>> ours;
+
+  set<clang_source_file_t> seen;
+  for (const clang_source_file_t &f : included_cl_fs) {
+    if (!seen.insert(f).second || !clang_is_system_source_file(f))
+      continue;
+
+    clang_source_file_t toplvl = top_level_system_header(f);
+    if (syst_adopted.find(toplvl) == syst_adopted.end())
+      continue;
+
+    ours[toplvl].push_back({path_of_clang_source_file(f).string(),
+                            digest_of_file_contents(f),
+                            offset_of_clang_source_file(f)});
+  }
+
+  //
+  // they are the summary's files if they are the same, by path and contents.
+  // (a file brought in more than once is at other offsets in the summary than
+  // here, so they are matched in the order of their offsets)
+  //
+  auto by_file = [](const summary_file_t &lhs, const summary_file_t &rhs) {
+    return make_tuple(lhs.path, lhs.digest, lhs.offset) <
+           make_tuple(rhs.path, rhs.digest, rhs.offset);
+  };
+
+  for (auto &entry : syst_adopted) {
+    adopted_summary_t &adopted = entry.second;
+
+    vector<summary_file_t> &our_files = ours[entry.first];
+    sort(our_files.begin(), our_files.end(), by_file);
+
+    vector<unsigned> their_files(adopted.files.size());
+    for (unsigned j = 0; j < their_files.size(); ++j)
+      their_files[j] = j;
+    sort(their_files.begin(), their_files.end(),
+         [&](unsigned lhs, unsigned rhs) -> bool {
+           return by_file(adopted.files[lhs], adopted.files[rhs]);
+         });
+
+    adopted.stale = our_files.size() != their_files.size();
+    for (unsigned k = 0; !adopted.stale && k < our_files.size(); ++k) {
+      const summary_file_t &theirs = adopted.files[their_files[k]];
+      adopted.stale = our_files[k].path != theirs.path ||
+                      our_files[k].digest != theirs.digest;
+      adopted.local_of[make_pair(our_files[k].path, our_files[k].offset)] =
+          their_files[k];
     }
 
-    {
-      depends_t::out_edge_iterator e_it, e_it_end;
-      for (tie(e_it, e_it_end) = boost::out_edges(preexist_v, res);
-           e_it != e_it_end; ++e_it)
-        out_verts.push_back(make_pair(boost::target(*e_it, res), res[*e_it].t));
+    if (!adopted.stale)
+      continue;
+
+    llvm::errs() << "collect : summary " << adopted.fp << " of "
+                 << path_of_clang_source_file(entry.first).string()
+                 << " is out of date, as a file it brought in changed while "
+                    "compiling; the code of the header is missing from the "
+                    "translation unit's collection, which needs collecting "
+                    "again\n";
+
+    boost::system::error_code ec;
+    fs::remove(summaries_dir / (syst_env_map[entry.first] + ".key"), ec);
+  }
+}
+
+void collector_priv::digest_included_files() {
+  map<string, string> digests;
+
+  for (const clang_source_file_t &f : included_cl_fs) {
+    string path(path_of_clang_source_file(f).string());
+    if (path.empty() || digests.find(path) != digests.end())
+      continue;
+
+    llvm::MD5 h;
+    h.update(buffer_of_clang_source_file(f));
+    digests[path] = digest_of(h);
+  }
+
+  depctx.included_paths.clear();
+  depctx.included_digests.clear();
+  for (auto &d : digests) {
+    depctx.included_paths.push_back(d.first);
+    depctx.included_digests.push_back(d.second);
+  }
+
+  included_cl_fs.clear();
+}
+
+bool collector_priv::adopt_system_summary(const fs::path &summaries_dir,
+                                          const clang_source_file_t &f) {
+  auto it = syst_env_map.find(f);
+  if (it == syst_env_map.end())
+    return false;
+
+  //
+  // the key has the name of the summary, then a line for each of its files:
+  // path, digest and offset, separated by tabs
+  //
+  adopted_summary_t adopted;
+  {
+    ifstream ifs((summaries_dir / ((*it).second + ".key")).string());
+    if (!getline(ifs, adopted.fp) || adopted.fp.empty())
+      return false;
+
+    string ln;
+    while (getline(ifs, ln)) {
+      string::size_type off_tab = ln.rfind('\t');
+      string::size_type digest_tab =
+          off_tab == string::npos || off_tab == 0 ? string::npos
+                                                  : ln.rfind('\t', off_tab - 1);
+      if (digest_tab == string::npos)
+        return false;
+
+      adopted.files.push_back(
+          {ln.substr(0, digest_tab),
+           ln.substr(digest_tab + 1, off_tab - digest_tab - 1),
+           static_cast<source_location_t>(atol(ln.c_str() + off_tab + 1))});
+    }
+  }
+
+  boost::system::error_code ec;
+  if (adopted.files.empty() ||
+      !fs::exists(summaries_dir / (adopted.fp + ".carbon"), ec))
+    return false;
+
+  //
+  // whatever the summary was made of must be the same on disk, or the header
+  // is coded as usual (and summarized anew)
+  //
+  for (const summary_file_t &file : adopted.files) {
+    auto digest_it = disk_digests.find(file.path);
+    if (digest_it == disk_digests.end()) {
+      string digest;
+      auto buf = llvm::MemoryBuffer::getFile(file.path, /*IsText=*/false,
+                                             /*RequiresNullTerminator=*/false);
+      if (buf) {
+        llvm::MD5 h;
+        h.update((*buf)->getBuffer());
+        digest = digest_of(h);
+      }
+      digest_it = disk_digests.insert(make_pair(file.path, digest)).first;
+    }
+
+    if ((*digest_it).second != file.digest)
+      return false;
+  }
+
+  syst_adopted[f] = move(adopted);
+  return true;
+}
+
+void collector_priv::adopt_system_summaries(const fs::path &summaries_dir,
+                                            vector<bool> &reached) {
+  syst_src_f_summarized.assign(depctx.syst_src_f_paths.size(), false);
+
+  map<clang_source_file_t, vector<unsigned>> groups;
+  for (unsigned i = 0; i < depctx.syst_src_f_paths.size(); ++i)
+    if (!syst_src_f_digests[i].empty())
+      groups[toplvl_syst_src_cl_fs[i]].push_back(i);
+
+  for (auto &entry : syst_adopted)
+    adopt_system_code(summaries_dir, entry.first, entry.second,
+                      groups[entry.first], reached);
+}
+
+void collector_priv::summarize_system_code(const fs::path &summaries_dir,
+                                           vector<bool> &reached) {
+  if (syst_env_map.empty())
+    return;
+
+  //
+  // the system files brought in by the same top-level system header make up a
+  // summary. it is named by the digest of its contents, and found through a
+  // key: a digest of everything its code depends on (the contents of the
+  // header, the macros defined where it was included, and the include
+  // directories), under which the first translation unit to write it leaves
+  // its name. the translation units which come across the key later leave the
+  // code of the header to the summary without coding it (see
+  // collector::system_header_summarized()).
+  //
+  map<clang_source_file_t, vector<unsigned>> groups;
+  for (unsigned i = 0; i < depctx.syst_src_f_paths.size(); ++i)
+    if (!syst_src_f_digests[i].empty())
+      groups[toplvl_syst_src_cl_fs[i]].push_back(i);
+
+  try {
+    fs::create_directories(summaries_dir);
+  } catch (const exception &e) {
+    llvm::errs() << "collect : failed to summarize system code (" << e.what()
+                 << ")\n";
+    return;
+  }
+
+  // the index of each system file within its summary, or -1
+  vector<int> local_idx(depctx.syst_src_f_paths.size(), -1);
+
+  vector<depends_builder_t::adjacent_t> adj;
+  for (auto &entry : groups) {
+    if (syst_adopted.find(entry.first) != syst_adopted.end())
+      continue;
+
+    //
+    // lay the summary out in an order which only depends on its contents, so
+    // that the same code is always written the same way (the files are in
+    // the order the translation unit came across them)
+    //
+    vector<unsigned> files(entry.second);
+    sort(files.begin(), files.end(), [&](unsigned lhs, unsigned rhs) -> bool {
+      return make_tuple(depctx.syst_src_f_paths[lhs], syst_src_f_digests[lhs],
+                        syst_src_f_offsets[lhs]) <
+             make_tuple(depctx.syst_src_f_paths[rhs], syst_src_f_digests[rhs],
+                        syst_src_f_offsets[rhs]);
+    });
+
+    for (unsigned j = 0; j < files.size(); ++j)
+      local_idx[files[j]] = static_cast<int>(j);
+
+    auto local_of = [&](source_file_t f) -> int {
+      return is_system_source_file(f) ? local_idx[index_of_source_file(f)]
+                                      : -1;
+    };
+
+    auto in_group = [&](dense_vertex_t v) -> bool {
+      return local_of(res[v].f) >= 0;
+    };
+
+    auto by_range = [&](dense_vertex_t lhs, dense_vertex_t rhs) -> bool {
+      return make_tuple(local_of(res[lhs].f), res[lhs].beg, res[lhs].end) <
+             make_tuple(local_of(res[rhs].f), res[rhs].beg, res[rhs].end);
+    };
+
+    //
+    // build the summary out of the code in the group (which, as it is written
+    // in place of a .carbon file, numbers the files from zero)
+    //
+    depends_archive_t sum;
+    depends_context_t &sumctx = sum[boost::graph_bundle];
+    for (unsigned i : files) {
+      sumctx.syst_src_f_paths.push_back(depctx.syst_src_f_paths[i]);
+      sumctx.toplvl_syst_src_f_paths.push_back(
+          depctx.toplvl_syst_src_f_paths[i]);
+
+      // (by which a translation unit leaving the header to the summary checks
+      // that it brought in the same files)
+      sumctx.included_paths.push_back(depctx.syst_src_f_paths[i]);
+      sumctx.included_digests.push_back(syst_src_f_digests[i]);
+    }
+
+    vector<dense_vertex_t> verts;
+    for (dense_vertex_t v = 0; v < res.vertices_end(); ++v)
+      if (res.live(v) && in_group(v))
+        verts.push_back(v);
+
+    sort(verts.begin(), verts.end(), by_range);
+
+    unordered_map<dense_vertex_t, depends_archive_t::vertex_descriptor>
+        sum_vert_map;
+    for (dense_vertex_t v : verts) {
+      source_range_t rng = res[v];
+      rng.f = syst_index_of_index(static_cast<unsigned>(local_of(rng.f)));
+      sum_vert_map[v] = boost::add_vertex(rng, sum);
+    }
+
+    //
+    // code which is connected to anything outside of the group is on its
+    // boundary, and stays in the translation unit's graph
+    //
+    vector<bool> boundary(verts.size(), false);
+    vector<tuple<depends_archive_t::vertex_descriptor,
+                 depends_archive_t::vertex_descriptor, DEPENDS_EDGE_TYPE>>
+        edges;
+
+    for (unsigned k = 0; k < verts.size(); ++k) {
+      dense_vertex_t v = verts[k];
+
+      res.out_edges(v, adj);
+      for (const depends_builder_t::adjacent_t &a : adj) {
+        if (in_group(a.first))
+          edges.push_back(
+              make_tuple(sum_vert_map[v], sum_vert_map[a.first], a.second));
+        else
+          boundary[k] = true;
+      }
+
+      res.in_edges(v, adj);
+      for (const depends_builder_t::adjacent_t &a : adj)
+        if (!in_group(a.first))
+          boundary[k] = true;
+    }
+
+    sort(edges.begin(), edges.end());
+    for (const auto &e : edges) {
+      depends_edge_type_t t;
+      t.t = get<2>(e);
+      boost::add_edge(get<0>(e), get<1>(e), t, sum);
+    }
+
+    //
+    // (symbols are inserted in order too, which decides the order of the hash
+    // tables they are in)
+    //
+    auto sum_loc = [&](full_source_location_t loc) -> full_source_location_t {
+      loc.f = syst_index_of_index(static_cast<unsigned>(local_of(loc.f)));
+      return loc;
+    };
+
+    map<string, full_source_location_t> glbl_defs;
+    for (auto &sym : depctx.glbl_defs)
+      if (local_of(sym.second.f) >= 0)
+        glbl_defs[sym.first] = sum_loc(sym.second);
+    for (auto &sym : glbl_defs)
+      sumctx.glbl_defs.insert(sym);
+
+    auto tables = location_set_tables_of(depctx);
+    auto sum_tables = location_set_tables_of(sumctx);
+    for (unsigned t = 0; t < tables.size(); ++t) {
+      map<string, set<full_source_location_t>> syms;
+      for (auto &sym : *tables[t])
+        for (const full_source_location_t &loc : sym.second)
+          if (local_of(loc.f) >= 0)
+            syms[sym.first].insert(sum_loc(loc));
+      for (auto &sym : syms)
+        (*sum_tables[t]).insert(sym);
+    }
+
+    //
+    // write it (unless it exists already, having the same contents), and
+    // leave its name under the key for those who come across it later, along
+    // with the files it is made of (see adopt_system_summary())
+    //
+    string fp;
+    try {
+      string contents(depends_archive_bytes(sum));
+
+      llvm::MD5 h;
+      h.update(contents);
+      fp = digest_of(h);
+
+      write_shared_file(summaries_dir / (fp + ".carbon"),
+                        [&](const fs::path &tmp_path) -> void {
+                          ofstream ofs(tmp_path.string(), ios::binary);
+                          ofs << contents;
+                        });
+
+      write_shared_file(summaries_dir / (syst_env_map[entry.first] + ".key"),
+                        [&](const fs::path &tmp_path) -> void {
+                          ofstream ofs(tmp_path.string());
+                          ofs << fp << '\n';
+                          for (unsigned i : files)
+                            ofs << depctx.syst_src_f_paths[i] << '\t'
+                                << syst_src_f_digests[i] << '\t'
+                                << syst_src_f_offsets[i] << '\n';
+                        });
+    } catch (const exception &e) {
+      llvm::errs() << "collect : failed to summarize system code of "
+                   << depctx.toplvl_syst_src_f_paths[files.front()] << " ("
+                   << e.what() << ")\n";
+
+      for (unsigned i : files)
+        local_idx[i] = -1;
+      continue;
     }
 
     //
-    // remove the preexisting interval from the interval map
+    // leave out all but what connects the group to the rest (the symbols stay,
+    // so that the translation unit is still known to define or declare them)
     //
-    src_rng_to_vert_map.erase(*preexist_it);
+    for (unsigned k = 0; k < verts.size(); ++k)
+      if (!boundary[k])
+        res.remove_vertex(verts[k]);
 
-    preexist_it = src_rng_to_vert_map.find(intervl);
-  } while (preexist_it != src_rng_to_vert_map.end());
+    depctx.syst_summaries.push_back(fp);
 
+    for (unsigned i : files) {
+      syst_src_f_summarized[i] = true;
+      local_idx[i] = -1;
+    }
+  }
+}
+
+void collector_priv::adopt_system_code(const fs::path &summaries_dir,
+                                       const clang_source_file_t &toplvl,
+                                       const adopted_summary_t &adopted,
+                                       const vector<unsigned> &files,
+                                       vector<bool> &reached) {
   //
-  // filter-out the edges which go between the preexisting vertices
+  // the header's code was left to the summary, so all the translation unit has
+  // of it is what its own code used. that is the summary's code, as long as
+  // the header brought in the same files as it did for whoever wrote it (see
+  // check_adopted_summaries()).
   //
-  {
-    auto it = in_verts.begin();
-    while (it != in_verts.end()) {
-      if (preexist_verts.find((*it).first) != preexist_verts.end())
-        it = in_verts.erase(it);
-      else
-        ++it;
-    }
+  if (adopted.stale)
+    return;
+
+  depends_archive_t sum;
+  try {
+    read_depends_file(summaries_dir / (adopted.fp + ".carbon"), sum);
+  } catch (const exception &e) {
+    llvm::errs() << "collect : failed to read summary " << adopted.fp << " ("
+                 << e.what() << ")\n";
+    return;
   }
 
-  {
-    auto it = out_verts.begin();
-    while (it != out_verts.end()) {
-      if (preexist_verts.find((*it).first) != preexist_verts.end())
-        it = out_verts.erase(it);
-      else
-        ++it;
+  depends_context_t &sumctx = sum[boost::graph_bundle];
+
+  //
+  // the translation unit's files in the summary, and the rest of the
+  // summary's files in the translation unit (for its symbols)
+  //
+  vector<source_file_t> f_of_local(sumctx.syst_src_f_paths.size(), 0);
+  vector<int> local_idx(depctx.syst_src_f_paths.size(), -1);
+  vector<source_location_t> delta(depctx.syst_src_f_paths.size(), 0);
+
+  bool malformed = sumctx.syst_src_f_paths.size() != adopted.files.size();
+  for (unsigned i : files) {
+    auto it = adopted.local_of.find(
+        make_pair(depctx.syst_src_f_paths[i], syst_src_f_offsets[i]));
+    if (malformed || it == adopted.local_of.end()) {
+      malformed = true;
+      break;
     }
+
+    unsigned j = (*it).second;
+    local_idx[i] = static_cast<int>(j);
+    f_of_local[j] = syst_index_of_index(i);
+
+    // (the ranges of the file are shifted by another offset in the summary)
+    delta[i] = adopted.files[j].offset - syst_src_f_offsets[i];
+  }
+
+  if (malformed) {
+    llvm::errs() << "collect : summary " << adopted.fp << " of "
+                 << depctx.toplvl_syst_src_f_paths[files.front()]
+                 << " does not match its key\n";
+
+    boost::system::error_code ec;
+    fs::remove(summaries_dir / (syst_env_map[toplvl] + ".key"), ec);
+    return;
+  }
+
+  for (unsigned j = 0; j < f_of_local.size(); ++j) {
+    if (f_of_local[j] != 0)
+      continue;
+
+    unsigned i = static_cast<unsigned>(depctx.syst_src_f_paths.size());
+    f_of_local[j] = syst_index_of_index(i);
+
+    depctx.syst_src_f_paths.push_back(sumctx.syst_src_f_paths[j]);
+    depctx.toplvl_syst_src_f_paths.push_back(sumctx.toplvl_syst_src_f_paths[j]);
+    toplvl_syst_src_cl_fs.push_back(toplvl);
+    syst_src_f_digests.push_back(adopted.files[j].digest);
+    syst_src_f_offsets.push_back(adopted.files[j].offset);
+    syst_src_f_summarized.push_back(false);
+    f_sys_src_rng_vert_map.emplace_back();
   }
 
   //
-  // now it's safe to remove the preexisting vertices from the graph
+  // bring what the translation unit has of the header's files to the offsets
+  // they have in the summary
   //
-  for (auto preexist_v : preexist_verts) {
-    boost::clear_vertex(preexist_v, res);
-    boost::remove_vertex(preexist_v, res);
+  auto shift = [&](source_file_t f, source_location_t &loc) -> void {
+    if (is_system_source_file(f) && index_of_source_file(f) < delta.size())
+      loc += delta[index_of_source_file(f)];
+  };
+
+  for (dense_vertex_t v = 0; v < res.vertices_end(); ++v) {
+    if (!res.live(v))
+      continue;
+
+    shift(res[v].f, res[v].beg);
+    shift(res[v].f, res[v].end);
   }
 
+  auto shift_locs = [&](set<full_source_location_t> &locs) -> void {
+    set<full_source_location_t> shifted;
+    for (full_source_location_t loc : locs) {
+      shift(loc.f, loc.beg);
+      shifted.insert(loc);
+    }
+    locs.swap(shifted);
+  };
+
+  for (auto &sym : depctx.glbl_defs)
+    shift(sym.second.f, sym.second.beg);
+  for (auto *table : location_set_tables_of(depctx))
+    for (auto &sym : *table)
+      shift_locs(sym.second);
+
   //
-  // create new vertex in graph
+  // what the translation unit's code used of the header was coded from the
+  // uses, which only cover part of a declaration (or of a macro definition).
+  // widen each of them to the code of the summary which it is in, so that they
+  // are the same vertices.
   //
-  depends_vertex_t v = boost::add_vertex(res);
-  res[v] = src_rng;
-  res[v].beg = intervl.lower();
-  res[v].end = intervl.upper();
+  vector<vector<pair<source_location_t, source_location_t>>> ranges(
+      sumctx.syst_src_f_paths.size());
+  {
+    depends_archive_t::vertex_iterator vi, vi_end;
+    for (tie(vi, vi_end) = boost::vertices(sum); vi != vi_end; ++vi) {
+      const source_range_t &rng = sum[*vi];
+      ranges[index_of_source_file(rng.f)].push_back(
+          make_pair(rng.beg, rng.end));
+    }
+
+    for (auto &rngs : ranges)
+      sort(rngs.begin(), rngs.end());
+  }
+
+  map<tuple<int, source_location_t>, dense_vertex_t> widened;
+  for (dense_vertex_t v = 0; v < res.vertices_end(); ++v) {
+    if (!res.live(v) || !is_system_source_file(res[v].f))
+      continue;
+
+    int j = local_idx[index_of_source_file(res[v].f)];
+    if (j < 0)
+      continue;
+
+    const auto &rngs = ranges[j];
+    auto it = upper_bound(
+        rngs.begin(), rngs.end(),
+        make_pair(res[v].beg, numeric_limits<source_location_t>::max()));
+    if (it == rngs.begin() || (*(it - 1)).second < res[v].end)
+      continue;
+    --it;
+
+    auto widened_it = widened.find(make_tuple(j, (*it).first));
+    if (widened_it == widened.end()) {
+      res[v].beg = (*it).first;
+      res[v].end = (*it).second;
+      widened.insert({make_tuple(j, (*it).first), v});
+      continue;
+    }
+
+    dense_vertex_t u = (*widened_it).second;
+    res.merge(u, v);
+    reached[u] = reached[u] || reached[v];
+    ++stats.code_merges;
+  }
 
   //
-  // add edges from old preexisting vertices to new vertex
+  // the summary's symbols are the header's, which the translation unit has
+  // (see summarize_system_code())
   //
-  for (auto in_v_pair : in_verts)
-    res[boost::add_edge(in_v_pair.first, v, res).first].t = in_v_pair.second;
-  for (auto out_v_pair : out_verts)
-    res[boost::add_edge(v, out_v_pair.first, res).first].t = out_v_pair.second;
+  auto our_loc = [&](full_source_location_t loc) -> full_source_location_t {
+    loc.f = f_of_local[index_of_source_file(loc.f)];
+    return loc;
+  };
+
+  for (auto &sym : sumctx.glbl_defs)
+    depctx.glbl_defs.insert(make_pair(sym.first, our_loc(sym.second)));
+
+  auto tables = location_set_tables_of(depctx);
+  auto sum_tables = location_set_tables_of(sumctx);
+  for (unsigned t = 0; t < tables.size(); ++t)
+    for (auto &sym : *sum_tables[t])
+      for (const full_source_location_t &loc : sym.second)
+        (*tables[t])[sym.first].insert(our_loc(loc));
+
+  depctx.syst_summaries.push_back(adopted.fp);
+
+  for (source_file_t f : f_of_local)
+    syst_src_f_summarized[index_of_source_file(f)] = true;
+}
 
+vector<bool> collector_priv::reachable_code() {
   //
-  // store new vertex in interval map
+  // system code is only of interest insofar as user code depends on it. so,
+  // starting from all user code (and the definitions of globals in system
+  // headers, which other translation units may link against), keep whatever
+  // is reachable and remove the rest.
   //
-  depends_vertex_set_t v_container;
-  v_container.insert(v);
-  src_rng_to_vert_map.add(make_pair(intervl, v_container));
+  vector<bool> reached(res.vertices_end(), false);
+  vector<dense_vertex_t> worklist;
 
-  if (debugMode)
-    llvm::errs() << "  " << intervl << '\n';
+  auto reach = [&](dense_vertex_t v) -> void {
+    if (v == depends_builder_t::nil || reached[v])
+      return;
+
+    reached[v] = true;
+    worklist.push_back(v);
+  };
+
+  for (dense_vertex_t v = 0; v < res.vertices_end(); ++v)
+    if (res.live(v) && !is_system_source_file(res[v].f))
+      reach(v);
+
+  for (auto &entry : depctx.glbl_defs)
+    if (is_system_source_file(entry.second.f))
+      reach(vertex_of_location(entry.second));
+
+  vector<depends_builder_t::adjacent_t> adj;
+  while (!worklist.empty()) {
+    dense_vertex_t v = worklist.back();
+    worklist.pop_back();
+
+    res.out_edges(v, adj);
+    for (const depends_builder_t::adjacent_t &a : adj)
+      reach(a.first);
+  }
+
+  return reached;
 }
 
-static void vertex_interval_maps_of_graph(
-    vector<boost::icl::interval_map<source_location_t, set<depends_vertex_t>>>
-        &user_sl_vert_map,
-    vector<boost::icl::interval_map<source_location_t, set<depends_vertex_t>>>
-        &syst_sl_vert_map,
-    depends_t &g) {
+void collector_priv::prune_system_code(const vector<bool> &reached) {
   //
-  // resize vectors
+  // (the symbols of summarized code are all kept, like those of user code, as
+  // they are the same in every translation unit which has the summary)
   //
-  user_sl_vert_map.resize(g[boost::graph_bundle].user_src_f_paths.size());
-  syst_sl_vert_map.resize(g[boost::graph_bundle].syst_src_f_paths.size());
+  auto is_pruned = [&](const full_source_location_t &loc) -> bool {
+    if (!is_system_source_file(loc.f) ||
+        syst_src_f_summarized[index_of_source_file(loc.f)])
+      return false;
+
+    dense_vertex_t v = vertex_of_location(loc);
+    return v == depends_builder_t::nil || !res.live(v) || !reached[v];
+  };
+
+  //
+  // remove the unreached system code, and note which system files are left
+  //
+  vector<bool> syst_f_used(depctx.syst_src_f_paths.size(), false);
+
+  for (dense_vertex_t v = 0; v < res.vertices_end(); ++v) {
+    if (!res.live(v) || !is_system_source_file(res[v].f))
+      continue;
+
+    if (reached[v])
+      syst_f_used[index_of_source_file(res[v].f)] = true;
+    else
+      res.remove_vertex(v);
+  }
+
+  auto note_used = [&](const full_source_location_t &loc) -> void {
+    if (is_system_source_file(loc.f) &&
+        syst_src_f_summarized[index_of_source_file(loc.f)])
+      syst_f_used[index_of_source_file(loc.f)] = true;
+  };
+
+  for (auto &sym : depctx.glbl_defs)
+    note_used(sym.second);
+  for (auto *table : location_set_tables_of(depctx))
+    for (auto &sym : *table)
+      for (const full_source_location_t &loc : sym.second)
+        note_used(loc);
 
   //
-  // for every vertex, make an interval for it, add it to the map
+  // renumber the system files which are left
   //
-  depends_t::vertex_iterator vi, vi_end;
-  for (tie(vi, vi_end) = boost::vertices(g); vi != vi_end; ++vi) {
-    depends_vertex_t v = *vi;
-    source_range_t &src_rng = g[v];
+  vector<source_file_t> syst_f_map(depctx.syst_src_f_paths.size());
+  vector<string> syst_src_f_paths;
+  vector<string> toplvl_syst_src_f_paths;
 
-    if (src_rng.beg == location_entire_file_beg &&
-        src_rng.end == location_entire_file_end)
-      continue; // 'entire file' vertex
+  for (unsigned i = 0; i < depctx.syst_src_f_paths.size(); ++i) {
+    if (!syst_f_used[i])
+      continue;
 
-    if (src_rng.beg == location_dummy_beg && src_rng.end == location_dummy_end)
-      continue; // dummy vertex
+    syst_f_map[i] = syst_index_of_index(
+        static_cast<unsigned>(syst_src_f_paths.size()));
 
-    unsigned f_idx = index_of_source_file(src_rng.f);
+    syst_src_f_paths.push_back(move(depctx.syst_src_f_paths[i]));
+    toplvl_syst_src_f_paths.push_back(
+        move(depctx.toplvl_syst_src_f_paths[i]));
+  }
 
-    boost::icl::interval_map<source_location_t, set<depends_vertex_t>>
-        &sl_vert_map =
-            is_system_source_file(src_rng.f) ? syst_sl_vert_map[f_idx]
-                                             : user_sl_vert_map[f_idx];
+  auto map_f = [&](source_file_t f) -> source_file_t {
+    return is_system_source_file(f) ? syst_f_map[index_of_source_file(f)] : f;
+  };
 
-    boost::icl::discrete_interval<source_location_t> intervl =
-        boost::icl::discrete_interval<source_location_t>::right_open(
-            src_rng.beg, src_rng.end);
+  //
+  // drop the symbols of the removed code, and renumber the rest
+  //
+  for (auto it = depctx.glbl_defs.begin(); it != depctx.glbl_defs.end();) {
+    if (is_pruned((*it).second)) {
+      it = depctx.glbl_defs.erase(it);
+      continue;
+    }
 
-    set<depends_vertex_t> v_container;
-    v_container.insert(v);
-    sl_vert_map.add(make_pair(intervl, v_container));
+    (*it).second.f = map_f((*it).second.f);
+    ++it;
   }
+
+  auto prune_locations =
+      [&](unordered_map<string, set<full_source_location_t>> &syms) -> void {
+    for (auto it = syms.begin(); it != syms.end();) {
+      set<full_source_location_t> locs;
+      for (full_source_location_t loc : (*it).second) {
+        if (is_pruned(loc))
+          continue;
+
+        loc.f = map_f(loc.f);
+        locs.insert(loc);
+      }
+
+      if (locs.empty()) {
+        it = syms.erase(it);
+        continue;
+      }
+
+      (*it).second = move(locs);
+      ++it;
+    }
+  };
+
+  prune_locations(depctx.glbl_decls);
+  prune_locations(depctx.static_defs);
+  prune_locations(depctx.static_decls);
+
+  for (dense_vertex_t v = 0; v < res.vertices_end(); ++v)
+    if (res.live(v))
+      res[v].f = map_f(res[v].f);
+
+  depctx.syst_src_f_paths = move(syst_src_f_paths);
+  depctx.toplvl_syst_src_f_paths = move(toplvl_syst_src_f_paths);
+
+  //
+  // the maps from source files (and their ranges) are now stale
+  //
+  src_f_map.clear();
+  cl_src_f_map.clear();
+  f_sys_src_rng_vert_map.clear();
+  toplvl_syst_src_cl_fs.clear();
+  syst_src_f_digests.clear();
+  syst_src_f_offsets.clear();
+  syst_src_f_summarized.clear();
 }
 
-void collector_priv::fixup_static_functions() {
-  vector<boost::icl::interval_map<source_location_t, set<depends_vertex_t>>>
-      user_sl_vert_map;
-  vector<boost::icl::interval_map<source_location_t, set<depends_vertex_t>>>
-      syst_sl_vert_map;
-  vertex_interval_maps_of_graph(user_sl_vert_map, syst_sl_vert_map, res);
+void collector_priv::share_user_headers(const fs::path &blobs_dir,
+                                        const string &main_path) {
+  //
+  // a header included by many translation units mostly comes out the same in
+  // all of them. so the graph of each user header (its code, the edges leaving
+  // it, and its symbols) is written once, to a file named by the digest of its
+  // contents, and the translation units producing that very graph refer to it
+  // instead.
+  //
+  auto is_hdr = [&](source_file_t f) -> bool {
+    return !is_system_source_file(f) &&
+           depctx.user_src_f_paths[index_of_source_file(f)] != main_path;
+  };
+
+  vector<vector<dense_vertex_t>> hdr_verts(depctx.user_src_f_paths.size());
+  for (dense_vertex_t v = 0; v < res.vertices_end(); ++v)
+    if (res.live(v) && is_hdr(res[v].f))
+      hdr_verts[index_of_source_file(res[v].f)].push_back(v);
+
+  if (all_of(hdr_verts.begin(), hdr_verts.end(),
+             [](const vector<dense_vertex_t> &verts) -> bool {
+               return verts.empty();
+             }))
+    return;
+
+  try {
+    fs::create_directories(blobs_dir);
+  } catch (const exception &e) {
+    llvm::errs() << "collect : failed to share user headers (" << e.what()
+                 << ")\n";
+    return;
+  }
 
   //
-  // for all code which depends on a static function declaration, search for a
-  // corresponding definition and add a forward declaration edge to it.
+  // the edges which stay with the translation unit are those leaving the rest
+  // of its code, and those going into the main file. the code of headers which
+  // they connect to is kept.
   //
-  for (auto &entry : res[boost::graph_bundle].static_decls) {
-    full_source_location_t def_sr;
+  vector<bool> needed(res.vertices_end(), false);
+  vector<depends_builder_t::adjacent_t> adj;
 
-    // does a corresponding definition exist?
-    auto sdefs_it = res[boost::graph_bundle].static_defs.find(entry.first);
-    if (sdefs_it == res[boost::graph_bundle].static_defs.end()) {
-      // try looking at non-static global definitions
-      auto gdefs_it = res[boost::graph_bundle].glbl_defs.find(entry.first);
-      if (gdefs_it == res[boost::graph_bundle].glbl_defs.end()) {
-	llvm::errs()
-	    << "warning: no definition found for static function declaration "
-	    << entry.first << '\n';
-	continue;
+  for (dense_vertex_t v = 0; v < res.vertices_end(); ++v) {
+    if (!res.live(v))
+      continue;
+
+    res.out_edges(v, adj);
+    for (const depends_builder_t::adjacent_t &a : adj) {
+      if (!is_hdr(res[v].f) && is_hdr(res[a.first].f))
+        needed[a.first] = true;
+      if (is_hdr(res[v].f) && !is_system_source_file(res[a.first].f) &&
+          !is_hdr(res[a.first].f))
+        needed[v] = true;
+    }
+  }
+
+  auto in_blob = [&](dense_vertex_t v) -> bool {
+    return is_system_source_file(res[v].f) || is_hdr(res[v].f);
+  };
+
+  // the headers which were written out. (the code of the others is kept, and
+  // everything is only left out once all of them have been written)
+  vector<bool> shared(hdr_verts.size(), false);
+
+  for (unsigned i = 0; i < hdr_verts.size(); ++i) {
+    vector<dense_vertex_t> &verts = hdr_verts[i];
+    if (verts.empty())
+      continue;
+
+    source_file_t f = static_cast<source_file_t>(i);
+
+    //
+    // lay the graph out in an order which only depends on its contents, so
+    // that the same graph is always written the same way
+    //
+    auto by_range = [&](dense_vertex_t lhs, dense_vertex_t rhs) -> bool {
+      return make_tuple(is_system_source_file(res[lhs].f),
+                        path_of_source_file(res[lhs].f), res[lhs].beg,
+                        res[lhs].end) <
+             make_tuple(is_system_source_file(res[rhs].f),
+                        path_of_source_file(res[rhs].f), res[rhs].beg,
+                        res[rhs].end);
+    };
+
+    sort(verts.begin(), verts.end(), by_range);
+
+    vector<tuple<dense_vertex_t, dense_vertex_t, DEPENDS_EDGE_TYPE>> edges;
+    vector<dense_vertex_t> stubs;
+
+    for (dense_vertex_t v : verts) {
+      res.out_edges(v, adj);
+      for (const depends_builder_t::adjacent_t &a : adj) {
+        if (!in_blob(a.first))
+          continue;
+
+        edges.push_back(make_tuple(v, a.first, a.second));
+        if (res[a.first].f != f)
+          stubs.push_back(a.first);
       }
+    }
 
-      def_sr = (*gdefs_it).second;
-    } else {
-      auto def_it = (*sdefs_it).second.begin();
-      assert(def_it != (*sdefs_it).second.end());
+    sort(stubs.begin(), stubs.end(), by_range);
+    stubs.erase(unique(stubs.begin(), stubs.end()), stubs.end());
+
+    depends_archive_t blob;
+    depends_context_t &blobctx = blob[boost::graph_bundle];
+    unordered_map<source_file_t, source_file_t> f_map;
+    unordered_map<dense_vertex_t, depends_archive_t::vertex_descriptor>
+        vert_map;
+
+    blobctx.user_src_f_paths.push_back(depctx.user_src_f_paths[i]);
+    f_map[f] = 0;
+
+    auto add_vertex = [&](dense_vertex_t v) -> void {
+      source_range_t rng = res[v];
+
+      auto it = f_map.find(rng.f);
+      if (it == f_map.end()) {
+        if (is_system_source_file(rng.f)) {
+          unsigned idx = index_of_source_file(rng.f);
+          it = f_map
+                   .insert({rng.f, syst_index_of_index(static_cast<unsigned>(
+                                       blobctx.syst_src_f_paths.size()))})
+                   .first;
+          blobctx.syst_src_f_paths.push_back(depctx.syst_src_f_paths[idx]);
+          blobctx.toplvl_syst_src_f_paths.push_back(
+              depctx.toplvl_syst_src_f_paths[idx]);
+        } else {
+          it = f_map
+                   .insert({rng.f, static_cast<source_file_t>(
+                                       blobctx.user_src_f_paths.size())})
+                   .first;
+          blobctx.user_src_f_paths.push_back(path_of_source_file(rng.f));
+        }
+      }
 
-      def_sr = *def_it++;
+      rng.f = (*it).second;
+      vert_map[v] = boost::add_vertex(rng, blob);
+    };
+
+    for (dense_vertex_t v : verts)
+      add_vertex(v);
+    for (dense_vertex_t v : stubs)
+      add_vertex(v);
+
+    sort(edges.begin(), edges.end(),
+         [&](const tuple<dense_vertex_t, dense_vertex_t, DEPENDS_EDGE_TYPE> &lhs,
+             const tuple<dense_vertex_t, dense_vertex_t, DEPENDS_EDGE_TYPE> &rhs)
+             -> bool {
+           return make_pair(vert_map[get<0>(lhs)], vert_map[get<1>(lhs)]) <
+                  make_pair(vert_map[get<0>(rhs)], vert_map[get<1>(rhs)]);
+         });
+
+    for (const auto &e : edges) {
+      depends_edge_type_t t;
+      t.t = get<2>(e);
+      boost::add_edge(vert_map[get<0>(e)], vert_map[get<1>(e)], t, blob);
+    }
 
-      if (def_it != (*sdefs_it).second.end())
-	llvm::errs() << "warning: multiple definitions found for static function "
-		     << entry.first << '\n';
+    //
+    // (symbols are inserted in order too, which decides the order of the hash
+    // tables they are in)
+    //
+    map<string, full_source_location_t> glbl_defs;
+    for (auto &sym : depctx.glbl_defs)
+      if (sym.second.f == f)
+        glbl_defs[sym.first] = {0, sym.second.beg};
+    for (auto &sym : glbl_defs)
+      blobctx.glbl_defs.insert(sym);
+
+    auto tables = location_set_tables_of(depctx);
+    auto blob_tables = location_set_tables_of(blobctx);
+    for (unsigned t = 0; t < tables.size(); ++t) {
+      map<string, set<full_source_location_t>> syms;
+      for (auto &sym : *tables[t])
+        for (const full_source_location_t &loc : sym.second)
+          if (loc.f == f)
+            syms[sym.first].insert({0, loc.beg});
+      for (auto &sym : syms)
+        (*blob_tables[t]).insert(sym);
     }
 
-    // get definition vertex
-    auto &def_sr_map = is_system_source_file(def_sr.f)
-                           ? syst_sl_vert_map[index_of_source_file(def_sr.f)]
-                           : user_sl_vert_map[index_of_source_file(def_sr.f)];
-    auto def_vert_it = def_sr_map.find(def_sr.beg);
-    if (def_vert_it == def_sr_map.end()) {
-      llvm::errs()
-          << "warning (bug): static function definition not found in source "
-             "ranges map [symbol: "
-          << entry.first << " offset: " << def_sr.beg << " file: "
-          << (is_system_source_file(def_sr.f)
-                  ? res[boost::graph_bundle]
-                        .syst_src_f_paths[index_of_source_file(def_sr.f)]
-                  : res[boost::graph_bundle]
-                        .user_src_f_paths[index_of_source_file(def_sr.f)])
-          << '\n';
+    string digest;
+    try {
+      string contents(depends_archive_bytes(blob));
+
+      llvm::MD5 h;
+      h.update(contents);
+      digest = digest_of(h);
+
+      write_shared_file(blobs_dir / (digest + ".carbon"),
+                        [&](const fs::path &tmp_path) -> void {
+                          ofstream ofs(tmp_path.string(), ios::binary);
+                          ofs << contents;
+                        });
+    } catch (const exception &e) {
+      llvm::errs() << "collect : failed to share user header "
+                   << depctx.user_src_f_paths[i] << " (" << e.what() << ")\n";
       continue;
     }
-    auto def_vert = *(*def_vert_it).second.begin();
 
-    for (auto &dcl_sr : entry.second) {
-      // get declaration vertex
-      auto &dcl_sr_map = is_system_source_file(dcl_sr.f)
-                             ? syst_sl_vert_map[index_of_source_file(dcl_sr.f)]
-                             : user_sl_vert_map[index_of_source_file(dcl_sr.f)];
-      auto dcl_vert_it = dcl_sr_map.find(dcl_sr.beg);
-      if (dcl_vert_it == dcl_sr_map.end()) {
-        llvm::errs()
-            << "warning (bug): static function declaration not found in source "
-               "ranges map [symbol: "
-            << entry.first << " offset: " << dcl_sr.beg << " file: "
-            << (is_system_source_file(dcl_sr.f)
-                    ? res[boost::graph_bundle]
-                          .syst_src_f_paths[index_of_source_file(dcl_sr.f)]
-                    : res[boost::graph_bundle]
-                          .user_src_f_paths[index_of_source_file(dcl_sr.f)])
-            << '\n';
+    shared[i] = true;
+    depctx.user_hdr_blobs.push_back(digest);
+  }
+
+  //
+  // leave out the code which is in the blobs. (its symbols stay, so that the
+  // translation unit is still known to define them without the blobs being
+  // read; linking one with its blobs then has the same symbol twice, which is
+  // the same as once.)
+  //
+  for (unsigned i = 0; i < hdr_verts.size(); ++i) {
+    if (!shared[i])
+      continue;
+
+    for (dense_vertex_t v : hdr_verts[i]) {
+      if (!needed[v]) {
+        res.remove_vertex(v);
         continue;
       }
-      auto dcl_vert = *(*dcl_vert_it).second.begin();
 
-      res[boost::add_edge(dcl_vert, def_vert, res).first].t =
-          DEPENDS_FWD_DECL_EDGE;
+      res.out_edges(v, adj);
+      for (const depends_builder_t::adjacent_t &a : adj)
+        if (in_blob(a.first))
+          res.remove_edge(v, a.first);
     }
   }
 }
 
-collector::collector() : priv(new collector_priv()) {}
+collector::collector() : journal(false), priv(new collector_priv()) {}
 
-collector::~collector() {}
+collector::~collector() { wait_for_carbon_output(); }
 
 void collector::set_args(const fs::path &_srcfp, const fs::path &_root_src_dir,
                          const fs::path &_root_bin_dir) {
@@ -629,6 +1862,8 @@ void collector::set_args(const fs::path &_srcfp, const fs::path &_root_src_dir,
   root_bin_dir = _root_bin_dir;
 }
 
+void collector::set_journal(bool _journal) { journal = _journal; }
+
 void collector::set_invocation_macros(
     const std::vector<std::pair<std::string, bool /*isUndef*/>> &Macros) {
   for (const std::pair<std::string, bool /* IsUndef */>& mac : Macros) {
@@ -648,6 +1883,20 @@ void collector::clang_source_file(const clang_source_file_t &f) {
   priv->clang_source_file(f);
 }
 
+void collector::included_file(const clang_source_file_t &f) {
+  priv->included_cl_fs.push_back(f);
+}
+
+void collector::system_header_environment(const clang_source_file_t &f,
+                                          const std::string &digest) {
+  priv->syst_env_map[f] = priv->summary_key(f, digest);
+}
+
+bool collector::system_header_summarized(const clang_source_file_t &f) {
+  return priv->adopt_system_summary(
+      root_bin_dir / ".carbon" / syst_summaries_dir_name, f);
+}
+
 void collector::code(const clang_source_range_t &cl_src_range) {
   priv->code(cl_src_range);
 }
@@ -743,36 +1992,114 @@ void collector::follow_users_of(const clang_source_range_t &prior,
   priv->follow_users_of(prior, following);
 }
 
+void collector::resolve_uses() {
+  priv->resolve_uses();
+}
+
+collect_stats_t &collector::stats() { return priv->stats; }
+
 void collector::write_carbon_output() {
-  priv->fixup_static_functions();
+  {
+    stats_timer_t timer(priv->stats.finish_ns);
 
-  fs::path rel(fs::relative(srcfp, root_src_dir));
-  if (rel.string().find("/..") != string::npos) {
-    llvm::errs() << "collect : failed to compute relative path\n";
-    return;
+    // mapping source files (and so coding ranges) asks the compiler about them
+    priv->resolve_uses();
+
+    // (the same goes for the contents of the system headers, and of every file
+    // included)
+    priv->digest_system_source_files();
+    priv->check_adopted_summaries(root_bin_dir / ".carbon" /
+                                  syst_summaries_dir_name);
+    priv->digest_included_files();
   }
 
-  fs::path carbon_dir = root_bin_dir / ".carbon";
-  fs::path carbon_src = carbon_dir / rel;
+  wait_for_carbon_output();
+  writer = std::thread([this](void) -> void {
+    collect_stats_t &st = priv->stats;
 
-  fs::create_directories(carbon_src.parent_path());
+    {
+      stats_timer_t timer(st.fixup_ns);
+      priv->fixup_static_functions();
+    }
 
-  ofstream ofs(carbon_src.string() + ".carbon");
-  {
-#ifdef CARBON_BINARY
-    boost::archive::binary_oarchive oa(ofs);
-#else
-    boost::archive::text_oarchive oa(ofs);
-#endif
-    oa << priv->res;
-  }
+    //
+    // what the translation unit defines, as of before any of it is pruned or
+    // left to summaries and blobs (it is what extraction looks it up by)
+    //
+    defined_symbols_t defined;
+
+    {
+      stats_timer_t timer(st.shrink_ns);
+
+      vector<bool> reached(priv->reachable_code());
+      priv->adopt_system_summaries(
+          root_bin_dir / ".carbon" / syst_summaries_dir_name, reached);
+      defined = defined_symbols_t(priv->depctx);
+
+      priv->summarize_system_code(
+          root_bin_dir / ".carbon" / syst_summaries_dir_name, reached);
+      priv->prune_system_code(reached);
+      priv->share_user_headers(
+          root_bin_dir / ".carbon" / user_hdr_blobs_dir_name, srcfp.string());
+    }
+
+    try {
+      fs::path rel(fs::relative(srcfp, root_src_dir));
+      if (rel.string().find("/..") != string::npos) {
+        llvm::errs() << "collect : failed to compute relative path\n";
+        return;
+      }
+
+      fs::path carbon_dir = root_bin_dir / ".carbon";
+
+      {
+        stats_timer_t timer(st.serialize_ns);
+
+        depends_archive_t g;
+        priv->res.to_depends(g);
+        g[boost::graph_bundle] = priv->depctx;
+
+        st.vertices = boost::num_vertices(g);
+        st.edges = boost::num_edges(g);
+
+        if (journal) {
+          fs::create_directories(carbon_dir);
+
+          string data(depends_archive_bytes(g, &defined));
+          st.bytes = data.size();
+
+          append_journal_record(carbon_dir / journal_file_name, rel.string(),
+                                data);
+        } else {
+          fs::path carbon_src = carbon_dir / rel;
+          fs::create_directories(carbon_src.parent_path());
+
+          fs::path carbon_fp(carbon_src.string() + ".carbon");
+          write_depends_file(carbon_fp, g, &defined);
+          st.bytes = fs::file_size(carbon_fp);
+
+          // (the file supersedes whatever records of it the journal has)
+          if (fs::exists(carbon_dir / journal_file_name))
+            append_journal_record(carbon_dir / journal_file_name,
+                                  rel.string(), string());
+        }
+      }
+
+      // (even with nothing defined, to supersede what it defined before)
+      append_shared_file(carbon_dir / symbols_file_name,
+                         symbols_block(rel.string(), defined));
+      append_shared_file(carbon_dir / stats_file_name,
+                         stats_line(rel.string(), st));
+    } catch (const exception &e) {
+      llvm::errs() << "collect : failed to write output for "
+                   << srcfp.string() << " (" << e.what() << ")\n";
+    }
+  });
 }
 
-llvm::raw_ostream &
-operator<<(llvm::raw_ostream &os,
-           const boost::icl::discrete_interval<source_location_t> &intervl) {
-  ostringstream oss;
-  oss << intervl;
-  return os << oss.str();
+void collector::wait_for_carbon_output() {
+  if (writer.joinable())
+    writer.join();
 }
+
 }
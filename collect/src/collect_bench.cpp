@@ -0,0 +1,232 @@
+#include "collect.h"
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <new>
+#include <random>
+#include <sys/resource.h>
+#include <boost/program_options.hpp>
+#include <clang/Basic/SourceManager.h>
+#include <llvm/Support/MemoryBuffer.h>
+
+using namespace std;
+using namespace carbon;
+namespace fs = boost::filesystem;
+namespace po = boost::program_options;
+
+//
+// every allocation is counted, which is most of what the collector's graph
+// costs
+//
+static size_t num_allocs = 0, num_bytes_allocated = 0;
+
+void *operator new(size_t n) {
+  ++num_allocs;
+  num_bytes_allocated += n;
+
+  void *p = malloc(n ? n : 1);
+  if (!p)
+    throw bad_alloc();
+  return p;
+}
+
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+//
+// the source files of the made-up translation unit: the main file, and headers
+// of which the last few are system headers. clang hands the collector file IDs
+// of its source manager, so these are made by one too.
+//
+static const unsigned num_files = 60;
+static const unsigned num_syst_files = 11;
+static const unsigned file_size = 1 << 20;
+
+static map<clang_source_file_t, unsigned> index_of_file;
+static fs::path src_dir;
+static string contents(file_size, ' ');
+
+namespace carbon {
+
+size_t hash_of_clang_source_file(const clang_source_file_t &f) {
+  return f.getHashValue();
+}
+
+fs::path path_of_clang_source_file(const clang_source_file_t &f) {
+  unsigned i = index_of_file[f];
+  return i == 0 ? src_dir / "main.c" : src_dir / ("f" + to_string(i) + ".h");
+}
+
+bool clang_is_system_source_file(const clang_source_file_t &f) {
+  return index_of_file[f] >= num_files - num_syst_files;
+}
+
+clang_source_file_t top_level_system_header(const clang_source_file_t &f) {
+  return f;
+}
+
+char character_at_clang_file_offset(const clang_source_file_t &,
+                                    const clang_source_location_t &) {
+  return ' ';
+}
+
+llvm::StringRef buffer_of_clang_source_file(const clang_source_file_t &) {
+  return contents;
+}
+
+clang_source_location_t
+offset_of_clang_source_file(const clang_source_file_t &) {
+  return 0;
+}
+}
+
+static double seconds_since(chrono::steady_clock::time_point t0) {
+  return chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+}
+
+//
+// runs the collector over a made-up translation unit of the given number of
+// top-level declarations, spread over the source files. every declaration uses
+// eight others, either random ones or the same few over and over (--repeated).
+// one in seven is overlapped by a macro-like range, which is coded either
+// before any use or after (--late-overlaps), when it has edges to merge.
+//
+int main(int argc, char **argv) {
+  unsigned num_decls;
+  fs::path dir;
+  bool repeated, late_overlaps;
+
+  try {
+    po::options_description desc("Allowed options");
+    desc.add_options()
+      ("help,h", "produce help message")
+
+      ("decls,n", po::value<unsigned>(&num_decls)->default_value(50000),
+       "number of top-level declarations")
+
+      ("dir,d", po::value<fs::path>(&dir),
+       "specify directory to write the collection under (by default, a new "
+       "one in the temporary directory)")
+
+      ("repeated", "have every declaration use the same few others over and "
+       "over")
+
+      ("late-overlaps", "code the overlapping ranges after the uses")
+    ;
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+
+    if (vm.count("help")) {
+      cout << "Usage: collect_bench [options]\n";
+      cout << desc;
+      return 0;
+    }
+
+    repeated = vm.count("repeated") != 0;
+    late_overlaps = vm.count("late-overlaps") != 0;
+  } catch (exception &e) {
+    cerr << e.what() << endl;
+    return 1;
+  }
+
+  if (dir.empty())
+    dir = fs::temp_directory_path() / fs::unique_path();
+  src_dir = dir / "src";
+  fs::create_directories(src_dir);
+  fs::create_directories(dir / "bin");
+
+  clang::SourceManagerForFile smf("main.c", "");
+  clang::SourceManager &sm = smf.get();
+
+  vector<clang_source_file_t> files;
+  for (unsigned i = 0; i < num_files; ++i) {
+    clang_source_file_t f =
+        i == 0 ? sm.getMainFileID()
+               : sm.createFileID(llvm::MemoryBuffer::getMemBuffer(
+                     "", "f" + to_string(i) + ".h"));
+    index_of_file[f] = i;
+    files.push_back(f);
+  }
+
+  size_t allocs_before = num_allocs, bytes_before = num_bytes_allocated;
+  mt19937 rng(42);
+  chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+
+  {
+    collector c;
+    c.set_args(src_dir / "main.c", src_dir, dir / "bin");
+
+    vector<clang_source_range_t> decls;
+    vector<clang_source_range_t> overlaps;
+    for (unsigned i = 0; i < num_decls; ++i) {
+      clang_source_location_t beg =
+          static_cast<clang_source_location_t>(i / num_files) * 100;
+      clang_source_range_t r{files[i % num_files], beg, beg + 90};
+      c.code(r);
+      decls.push_back(r);
+
+      if (i % 7 == 0) {
+        clang_source_location_t end = beg + 120;
+        if (late_overlaps)
+          end += static_cast<clang_source_location_t>(i % 3) * 100;
+
+        clang_source_range_t o{r.f, beg + 80, end};
+        if (late_overlaps)
+          overlaps.push_back(o);
+        else
+          c.code(o);
+      }
+    }
+
+    for (unsigned i = 0; i < num_decls; ++i) {
+      const clang_source_range_t &u = decls[i];
+      for (unsigned k = 0; k < 8; ++k) {
+        if (repeated) {
+          c.use(u, decls[(i * 31 + (k % 3) * 977) % decls.size()]);
+          continue;
+        }
+
+        clang_source_range_t ur{u.f, u.beg + 5 + static_cast<int>(k),
+                                u.beg + 10 + static_cast<int>(k)};
+        // (code coded late is mostly used from close by)
+        size_t e = rng() % decls.size();
+        if (late_overlaps && rng() % 100 != 0)
+          e = (rng() % (decls.size() / num_files)) * num_files + rng() % 49;
+        c.use(ur, decls[e]);
+      }
+
+      if (late_overlaps && i % 7 == 0)
+        c.code(overlaps[i / 7]);
+
+      if (i % 13 == 0)
+        c.follow_users_of(decls[rng() % decls.size()], u);
+      if (i % 5 == 0)
+        c.use_if_user_exists(u, decls[rng() % decls.size()]);
+      if (i % 11 == 0)
+        c.global_code(u, "g" + to_string(i), true);
+      if (i % 17 == 0)
+        c.static_code(u, "s" + to_string(i % 100), i % 2);
+    }
+
+    double collect_time = seconds_since(t0);
+    cout << "collected in " << collect_time << " s, "
+         << num_allocs - allocs_before << " allocations, "
+         << ((num_bytes_allocated - bytes_before) >> 20) << " MB allocated"
+         << endl;
+
+    c.write_carbon_output();
+    c.wait_for_carbon_output();
+  }
+
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  cout << "total " << seconds_since(t0) << " s, peak RSS "
+       << (ru.ru_maxrss >> 10) << " MB" << endl;
+  cout << "collection written under " << (dir / "bin" / ".carbon").string()
+       << endl;
+
+  return 0;
+}
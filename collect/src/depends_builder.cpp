@@ -0,0 +1,250 @@
+#include "depends_builder.h"
+#include <algorithm>
+#include <cassert>
+
+using namespace std;
+
+namespace carbon {
+
+const uint32_t depends_builder_t::nil;
+
+dense_vertex_t depends_builder_t::add_vertex(const source_range_t &rng) {
+  vertex_t vert;
+  vert.rng = rng;
+  vert.out_head = vert.out_tail = nil;
+  vert.in_head = vert.in_tail = nil;
+  vert.out_deg = vert.in_deg = 0;
+  vert.dead = false;
+
+  dense_vertex_t v = static_cast<dense_vertex_t>(verts.size());
+
+  verts.push_back(vert);
+  parent.push_back(v);
+  ++num_live_verts;
+
+  return v;
+}
+
+void depends_builder_t::remove_vertex(dense_vertex_t v) {
+  assert(live(v));
+
+  for (uint32_t e = verts[v].out_head; e != nil; e = edges[e].next_out)
+    kill_edge(e);
+  for (uint32_t e = verts[v].in_head; e != nil; e = edges[e].next_in)
+    kill_edge(e);
+
+  verts[v].dead = true;
+  --num_live_verts;
+}
+
+void depends_builder_t::merge(dense_vertex_t u, dense_vertex_t v) {
+  assert(live(u) && live(v) && u != v);
+
+  vertex_t &dst = verts[u];
+  vertex_t &src = verts[v];
+
+  //
+  // splice v's edge lists onto the ends of u's
+  //
+  if (src.out_head != nil) {
+    if (dst.out_tail == nil)
+      dst.out_head = src.out_head;
+    else
+      edges[dst.out_tail].next_out = src.out_head;
+    dst.out_tail = src.out_tail;
+  }
+  if (src.in_head != nil) {
+    if (dst.in_tail == nil)
+      dst.in_head = src.in_head;
+    else
+      edges[dst.in_tail].next_in = src.in_head;
+    dst.in_tail = src.in_tail;
+  }
+
+  dst.out_deg += src.out_deg;
+  dst.in_deg += src.in_deg;
+
+  src.out_head = src.out_tail = nil;
+  src.in_head = src.in_tail = nil;
+  src.out_deg = src.in_deg = 0;
+
+  parent[v] = u;
+  --num_live_verts;
+}
+
+void depends_builder_t::append_edge(dense_vertex_t u, dense_vertex_t v,
+                                    DEPENDS_EDGE_TYPE t, uint8_t flags) {
+  assert(live(u) && live(v));
+
+  uint32_t e = static_cast<uint32_t>(edges.size());
+
+  edge_t rec;
+  rec.src = u;
+  rec.dst = v;
+  rec.next_out = nil;
+  rec.next_in = nil;
+  rec.t = static_cast<uint8_t>(t);
+  rec.flags = flags;
+  edges.push_back(rec);
+
+  vertex_t &src = verts[u];
+  if (src.out_tail == nil)
+    src.out_head = e;
+  else
+    edges[src.out_tail].next_out = e;
+  src.out_tail = e;
+  ++src.out_deg;
+
+  vertex_t &dst = verts[v];
+  if (dst.in_tail == nil)
+    dst.in_head = e;
+  else
+    edges[dst.in_tail].next_in = e;
+  dst.in_tail = e;
+  ++dst.in_deg;
+}
+
+void depends_builder_t::kill_edge(uint32_t e) {
+  edge_t &rec = edges[e];
+  if (rec.flags & EDGE_DEAD)
+    return;
+
+  rec.flags |= EDGE_DEAD;
+  --verts[find(rec.src)].out_deg;
+  --verts[find(rec.dst)].in_deg;
+}
+
+void depends_builder_t::add_edge(dense_vertex_t u, dense_vertex_t v) {
+  append_edge(u, v, DEPENDS_NORMAL_EDGE, 0);
+}
+
+void depends_builder_t::add_edge(dense_vertex_t u, dense_vertex_t v,
+                                 DEPENDS_EDGE_TYPE t) {
+  append_edge(u, v, t, EDGE_ASSIGNS);
+}
+
+//
+// an edge which was added between two different vertices that were merged
+// since. (an edge explicitly added from a vertex to itself is kept.)
+//
+template <typename Edge>
+static bool merged_loop(const Edge &rec, dense_vertex_t w, dense_vertex_t v) {
+  return w == v && rec.src != rec.dst;
+}
+
+bool depends_builder_t::edge(dense_vertex_t u, dense_vertex_t v) const {
+  //
+  // walk whichever of the two lists is shorter
+  //
+  if (verts[u].out_deg <= verts[v].in_deg) {
+    for (uint32_t e = verts[u].out_head; e != nil; e = edges[e].next_out)
+      if (!(edges[e].flags & EDGE_DEAD) && find(edges[e].dst) == v &&
+          !merged_loop(edges[e], v, u))
+        return true;
+  } else {
+    for (uint32_t e = verts[v].in_head; e != nil; e = edges[e].next_in)
+      if (!(edges[e].flags & EDGE_DEAD) && find(edges[e].src) == u &&
+          !merged_loop(edges[e], u, v))
+        return true;
+  }
+
+  return false;
+}
+
+void depends_builder_t::remove_edge(dense_vertex_t u, dense_vertex_t v) {
+  for (uint32_t e = verts[u].out_head; e != nil; e = edges[e].next_out)
+    if (find(edges[e].dst) == v)
+      kill_edge(e);
+}
+
+void depends_builder_t::edge_records(dense_vertex_t v, bool out,
+                                     vector<edge_rec_t> &recs) const {
+  recs.clear();
+
+  if (out) {
+    recs.reserve(verts[v].out_deg);
+    for (uint32_t e = verts[v].out_head; e != nil; e = edges[e].next_out) {
+      dense_vertex_t w = find(edges[e].dst);
+      if (!(edges[e].flags & EDGE_DEAD) && !merged_loop(edges[e], w, v))
+        recs.push_back(make_pair(w, &edges[e]));
+    }
+  } else {
+    recs.reserve(verts[v].in_deg);
+    for (uint32_t e = verts[v].in_head; e != nil; e = edges[e].next_in) {
+      dense_vertex_t w = find(edges[e].src);
+      if (!(edges[e].flags & EDGE_DEAD) && !merged_loop(edges[e], w, v))
+        recs.push_back(make_pair(w, &edges[e]));
+    }
+  }
+}
+
+//
+// given the live edge records of a list in the order they were added, as
+// (adjacent vertex, record) pairs, compute the effective type of the edge to
+// each adjacent vertex. the first record of an edge gives its type, and any
+// later one only changes it if its type was given explicitly.
+//
+template <typename Edge>
+static void fold_parallel_edges(
+    vector<pair<dense_vertex_t, const Edge *>> &recs,
+    vector<depends_builder_t::adjacent_t> &out, uint8_t assigns_flag) {
+  stable_sort(recs.begin(), recs.end(),
+              [](const pair<dense_vertex_t, const Edge *> &lhs,
+                 const pair<dense_vertex_t, const Edge *> &rhs) {
+                return lhs.first < rhs.first;
+              });
+
+  out.clear();
+  for (auto it = recs.begin(); it != recs.end(); ++it) {
+    if (it == recs.begin() || (*it).first != (*(it - 1)).first) {
+      out.push_back(make_pair(
+          (*it).first, static_cast<DEPENDS_EDGE_TYPE>((*it).second->t)));
+      continue;
+    }
+
+    if ((*it).second->flags & assigns_flag)
+      out.back().second = static_cast<DEPENDS_EDGE_TYPE>((*it).second->t);
+  }
+}
+
+void depends_builder_t::out_edges(dense_vertex_t v,
+                                  vector<adjacent_t> &out) const {
+  vector<edge_rec_t> recs;
+  edge_records(v, true, recs);
+  fold_parallel_edges(recs, out, EDGE_ASSIGNS);
+}
+
+void depends_builder_t::in_edges(dense_vertex_t v,
+                                 vector<adjacent_t> &out) const {
+  vector<edge_rec_t> recs;
+  edge_records(v, false, recs);
+  fold_parallel_edges(recs, out, EDGE_ASSIGNS);
+}
+
+void depends_builder_t::to_depends(depends_archive_t &out) const {
+  vector<depends_archive_t::vertex_descriptor> vert_map(verts.size());
+
+  for (dense_vertex_t v = 0; v < verts.size(); ++v) {
+    if (!live(v))
+      continue;
+
+    vert_map[v] = boost::add_vertex(verts[v].rng, out);
+  }
+
+  vector<edge_rec_t> recs;
+  vector<adjacent_t> adj;
+  for (dense_vertex_t v = 0; v < verts.size(); ++v) {
+    if (!live(v))
+      continue;
+
+    edge_records(v, true, recs);
+    fold_parallel_edges(recs, adj, EDGE_ASSIGNS);
+    for (const adjacent_t &a : adj) {
+      depends_edge_type_t t;
+      t.t = a.second;
+      boost::add_edge(vert_map[v], vert_map[a.first], t, out);
+    }
+  }
+}
+
+}
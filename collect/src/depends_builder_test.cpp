@@ -0,0 +1,280 @@
+#include "check.h"
+#include "depends_builder.h"
+#include <random>
+#include <set>
+#include <tuple>
+#include <vector>
+
+using namespace std;
+using namespace carbon;
+
+typedef vector<depends_builder_t::adjacent_t> adjacency_t;
+
+static source_range_t range_of(unsigned i) {
+  return {0, static_cast<source_location_t>(i * 10),
+          static_cast<source_location_t>(i * 10 + 5)};
+}
+
+//
+// what merging does to edges, as the collector relies on it (see
+// collector_priv::code())
+//
+static void check_merges() {
+  depends_builder_t g;
+  dense_vertex_t a = g.add_vertex(range_of(0));
+  dense_vertex_t b = g.add_vertex(range_of(1));
+  dense_vertex_t c = g.add_vertex(range_of(2));
+  dense_vertex_t d = g.add_vertex(range_of(3));
+  dense_vertex_t e = g.add_vertex(range_of(4));
+
+  g.add_edge(a, c, DEPENDS_FWD_DECL_EDGE);
+  g.add_edge(b, c);
+  g.add_edge(a, b);
+  g.add_edge(b, b, DEPENDS_FOLLOWS_EDGE);
+  g.add_edge(d, b);
+  g.add_edge(e, d, DEPENDS_NORMAL_EDGE);
+
+  g.merge(a, b);
+  CHECK(g.find(b) == a);
+  CHECK(g.live(a) && !g.live(b));
+  CHECK(g.num_vertices() == 4);
+
+  // (the edge between the merged vertices is gone, a self-loop isn't, and a
+  // parallel edge without a type of its own leaves the type as it was)
+  adjacency_t adj;
+  g.out_edges(a, adj);
+  CHECK(adj == adjacency_t({{a, DEPENDS_FOLLOWS_EDGE},
+                            {c, DEPENDS_FWD_DECL_EDGE}}));
+
+  g.in_edges(a, adj);
+  CHECK(adj == adjacency_t({{a, DEPENDS_FOLLOWS_EDGE},
+                            {d, DEPENDS_NORMAL_EDGE}}));
+
+  CHECK(g.edge(d, a));
+  CHECK(!g.edge(a, d));
+
+  // (one with a type of its own overwrites it)
+  g.add_edge(d, c, DEPENDS_FOLLOWS_EDGE);
+  g.merge(d, e);
+  g.merge(a, d);
+  g.out_edges(a, adj);
+  CHECK(adj == adjacency_t({{a, DEPENDS_FOLLOWS_EDGE},
+                            {c, DEPENDS_FOLLOWS_EDGE}}));
+  g.in_edges(c, adj);
+  CHECK(adj == adjacency_t({{a, DEPENDS_FOLLOWS_EDGE}}));
+
+  g.remove_edge(a, c);
+  CHECK(!g.edge(a, c));
+  g.in_edges(c, adj);
+  CHECK(adj.empty());
+
+  g.remove_vertex(a);
+  CHECK(!g.live(a));
+  CHECK(g.num_vertices() == 1);
+  g.in_edges(c, adj);
+  CHECK(adj.empty());
+}
+
+//
+// the builder against a plain model of it: edge lists as vectors of records,
+// which merging appends to one another, and representatives found by walking
+// up without path compression
+//
+struct model_t {
+  struct record_t {
+    unsigned src, dst;
+    DEPENDS_EDGE_TYPE t;
+    bool assigns;
+    bool dead;
+  };
+
+  vector<record_t> recs;
+  vector<vector<unsigned>> outs, ins;
+  vector<unsigned> parent;
+  vector<bool> dead;
+
+  unsigned add_vertex() {
+    outs.emplace_back();
+    ins.emplace_back();
+    parent.push_back(static_cast<unsigned>(parent.size()));
+    dead.push_back(false);
+    return parent.back();
+  }
+
+  unsigned find(unsigned v) const {
+    while (parent[v] != v)
+      v = parent[v];
+    return v;
+  }
+
+  bool live(unsigned v) const { return parent[v] == v && !dead[v]; }
+
+  unsigned num_live() const {
+    unsigned n = 0;
+    for (unsigned v = 0; v < parent.size(); ++v)
+      n += live(v);
+    return n;
+  }
+
+  void add_edge(unsigned u, unsigned v, DEPENDS_EDGE_TYPE t, bool assigns) {
+    outs[u].push_back(static_cast<unsigned>(recs.size()));
+    ins[v].push_back(static_cast<unsigned>(recs.size()));
+    recs.push_back({u, v, t, assigns, false});
+  }
+
+  void merge(unsigned u, unsigned v) {
+    outs[u].insert(outs[u].end(), outs[v].begin(), outs[v].end());
+    ins[u].insert(ins[u].end(), ins[v].begin(), ins[v].end());
+    outs[v].clear();
+    ins[v].clear();
+    parent[v] = u;
+  }
+
+  void remove_edge(unsigned u, unsigned v) {
+    for (unsigned r : outs[u])
+      if (find(recs[r].dst) == v)
+        recs[r].dead = true;
+  }
+
+  void remove_vertex(unsigned v) {
+    for (unsigned r : outs[v])
+      recs[r].dead = true;
+    for (unsigned r : ins[v])
+      recs[r].dead = true;
+    dead[v] = true;
+  }
+
+  adjacency_t adjacent(unsigned v, bool out) const {
+    adjacency_t res;
+    for (unsigned r : out ? outs[v] : ins[v]) {
+      const record_t &rec = recs[r];
+      unsigned w = find(out ? rec.dst : rec.src);
+      if (rec.dead || (w == v && rec.src != rec.dst))
+        continue;
+
+      auto it = find_if(res.begin(), res.end(),
+                        [&](const depends_builder_t::adjacent_t &a) {
+                          return a.first == w;
+                        });
+      if (it == res.end())
+        res.push_back(make_pair(w, rec.t));
+      else if (rec.assigns)
+        (*it).second = rec.t;
+    }
+
+    sort(res.begin(), res.end());
+    return res;
+  }
+};
+
+static void check_against_model() {
+  mt19937 rng(1);
+
+  for (unsigned t = 0; t < 100; ++t) {
+    depends_builder_t g;
+    model_t model;
+
+    for (unsigned i = 0; i < 20; ++i) {
+      g.add_vertex(range_of(i));
+      model.add_vertex();
+    }
+
+    auto live_vertex = [&](void) -> unsigned {
+      unsigned v;
+      do
+        v = rng() % model.parent.size();
+      while (!model.live(v));
+      return v;
+    };
+
+    for (unsigned op = 0; op < 300; ++op) {
+      unsigned r = rng() % 100;
+      if (r < 5) {
+        g.add_vertex(range_of(static_cast<unsigned>(model.parent.size())));
+        model.add_vertex();
+      } else if (r < 65) {
+        unsigned u = live_vertex(), v = live_vertex();
+        if (rng() % 2) {
+          g.add_edge(u, v);
+          model.add_edge(u, v, DEPENDS_NORMAL_EDGE, false);
+        } else {
+          DEPENDS_EDGE_TYPE et = static_cast<DEPENDS_EDGE_TYPE>(rng() % 3);
+          g.add_edge(u, v, et);
+          model.add_edge(u, v, et, true);
+        }
+      } else if (r < 85 && model.num_live() > 2) {
+        unsigned u = live_vertex(), v = live_vertex();
+        if (u != v) {
+          g.merge(u, v);
+          model.merge(u, v);
+        }
+      } else if (r < 95) {
+        unsigned u = live_vertex(), v = live_vertex();
+        g.remove_edge(u, v);
+        model.remove_edge(u, v);
+      } else if (model.num_live() > 2) {
+        unsigned v = live_vertex();
+        g.remove_vertex(v);
+        model.remove_vertex(v);
+      }
+    }
+
+    unsigned num_live = 0;
+    adjacency_t adj;
+    for (unsigned v = 0; v < model.parent.size(); ++v) {
+      CHECK(g.find(v) == model.find(v));
+      CHECK(g.live(v) == model.live(v));
+      if (!model.live(v))
+        continue;
+      ++num_live;
+
+      g.out_edges(v, adj);
+      CHECK(adj == model.adjacent(v, true));
+      g.in_edges(v, adj);
+      CHECK(adj == model.adjacent(v, false));
+
+      adjacency_t out = model.adjacent(v, true);
+      for (unsigned w = 0; w < model.parent.size(); ++w)
+        if (model.live(w))
+          CHECK(g.edge(v, w) ==
+                any_of(out.begin(), out.end(),
+                       [&](const depends_builder_t::adjacent_t &a) {
+                         return a.first == w;
+                       }));
+    }
+    CHECK(g.num_vertices() == num_live);
+
+    //
+    // what is written is the live vertices, in order, and their edges
+    //
+    depends_archive_t out;
+    g.to_depends(out);
+    CHECK(boost::num_vertices(out) == num_live);
+
+    vector<unsigned> live_verts;
+    for (unsigned v = 0; v < model.parent.size(); ++v)
+      if (model.live(v))
+        live_verts.push_back(v);
+
+    set<tuple<unsigned, unsigned, DEPENDS_EDGE_TYPE>> written, expected;
+    for (unsigned v = 0; v < boost::num_vertices(out); ++v) {
+      depends_archive_t::out_edge_iterator ei, ei_end;
+      for (boost::tie(ei, ei_end) = boost::out_edges(v, out); ei != ei_end;
+           ++ei)
+        written.insert(make_tuple(live_verts[v],
+                                  live_verts[boost::target(*ei, out)],
+                                  out[*ei].t));
+    }
+    for (unsigned v : live_verts)
+      for (const auto &a : model.adjacent(v, true))
+        expected.insert(make_tuple(v, a.first, a.second));
+    CHECK(written == expected);
+    CHECK(boost::num_edges(out) == expected.size());
+  }
+}
+
+int main() {
+  check_merges();
+  check_against_model();
+  return check::result();
+}
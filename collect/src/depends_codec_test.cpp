@@ -0,0 +1,204 @@
+#include "check.h"
+#include "depends_builder.h"
+#include "depends_codec.h"
+#include <limits>
+#include <sstream>
+#include <tuple>
+
+using namespace std;
+using namespace carbon;
+
+//
+// the encoding of a graph (see depends_codec.h) reads back as the graph which
+// was written: every kind of range, in user and system files, every kind of
+// edge, and the context
+//
+
+static void check_zigzag() {
+  using namespace depends_codec;
+
+  for (int64_t x : {int64_t(0), int64_t(1), int64_t(-1), int64_t(63),
+                    int64_t(-64), int64_t(INT32_MIN), int64_t(INT32_MAX),
+                    numeric_limits<int64_t>::min(),
+                    numeric_limits<int64_t>::max()})
+    CHECK(unzigzag(zigzag(x)) == x);
+
+  // (small magnitudes, of either sign, make small varints)
+  CHECK(zigzag(0) == 0);
+  CHECK(zigzag(-1) == 1);
+  CHECK(zigzag(1) == 2);
+
+  string out;
+  put_varint(out, 127);
+  CHECK(out.size() == 1);
+  out.clear();
+  put_varint(out, 128);
+  CHECK(out.size() == 2);
+  out.clear();
+  put_varint(out, numeric_limits<uint64_t>::max());
+  CHECK(out.size() == 10);
+}
+
+static void check_round_trip() {
+  depends_archive_t g;
+  depends_context_t &depctx = g[boost::graph_bundle];
+
+  depctx.user_src_f_paths = {"/src/a.c", "/src/a.h"};
+  depctx.syst_src_f_paths = {"/usr/include/stdio.h", "/usr/include/bits.h",
+                             "/usr/include/stddef.h"};
+  depctx.toplvl_syst_src_f_paths = {"/usr/include/stdio.h",
+                                    "/usr/include/stdio.h",
+                                    "/usr/include/stddef.h"};
+  depctx.macros.def = {"NDEBUG", "X=1"};
+  depctx.macros.und = {"Y"};
+  depctx.include.dirs = {"/src/include"};
+  depctx.syst_summaries = {"0123456789abcdef0123456789abcdef"};
+  depctx.user_hdr_blobs = {"fedcba9876543210fedcba9876543210"};
+  depctx.included_paths = {"/src/a.c", "/src/a.h"};
+  depctx.included_digests = {"00", "11"};
+
+  depctx.glbl_defs["main"] = {0, 100};
+  depctx.glbl_defs["printf"] = {syst_index_of_index(0), 2000};
+  depctx.glbl_decls["printf"] = {{syst_index_of_index(0), 2000}};
+  depctx.static_defs["helper"] = {{0, 10}, {1, 20}};
+  depctx.static_decls["helper"] = {{1, 5}};
+
+  //
+  // every kind of range, in every kind of file, and beginnings both after and
+  // before those of the vertices before them in the same file
+  //
+  vector<source_range_t> rngs = {
+      {0, 100, 200},
+      {0, 10, 90},
+      {0, location_entire_file_beg, location_entire_file_end},
+      {1, 0, 0},
+      {syst_index_of_index(0), 2000, 2100},
+      {syst_index_of_index(1), 50, 40},
+      {syst_index_of_index(2), location_dummy_beg, location_dummy_end},
+      {syst_index_of_index(0), 1000, 1001},
+      {1, INT32_MAX - 10, INT32_MAX - 2},
+      {syst_index_of_index(1), 0, INT32_MAX - 2},
+  };
+  for (const source_range_t &rng : rngs)
+    boost::add_vertex(rng, g);
+
+  vector<tuple<unsigned, unsigned, DEPENDS_EDGE_TYPE>> edges = {
+      make_tuple(0, 1, DEPENDS_NORMAL_EDGE),
+      make_tuple(0, 4, DEPENDS_FWD_DECL_EDGE),
+      make_tuple(0, 9, DEPENDS_FOLLOWS_EDGE),
+      make_tuple(1, 0, DEPENDS_NORMAL_EDGE),
+      make_tuple(3, 3, DEPENDS_NORMAL_EDGE),
+      make_tuple(5, 2, DEPENDS_FOLLOWS_EDGE),
+      make_tuple(9, 0, DEPENDS_FWD_DECL_EDGE),
+      make_tuple(9, 8, DEPENDS_NORMAL_EDGE),
+  };
+  for (const auto &e : edges) {
+    depends_edge_type_t t;
+    t.t = get<2>(e);
+    boost::add_edge(get<0>(e), get<1>(e), t, g);
+  }
+
+  string bytes;
+  write_depends(bytes, g);
+
+  depends_archive_t h;
+  {
+    istringstream is(bytes);
+    CHECK(is_depends_encoding(is));
+    read_depends(is, h);
+  }
+
+  CHECK(boost::num_vertices(h) == rngs.size());
+  for (unsigned v = 0; v < rngs.size() && v < boost::num_vertices(h); ++v) {
+    CHECK(h[v].f == rngs[v].f);
+    CHECK(h[v].beg == rngs[v].beg);
+    CHECK(h[v].end == rngs[v].end);
+  }
+
+  vector<tuple<unsigned, unsigned, DEPENDS_EDGE_TYPE>> read_edges;
+  depends_archive_t::edge_iterator ei, ei_end;
+  for (boost::tie(ei, ei_end) = boost::edges(h); ei != ei_end; ++ei)
+    read_edges.push_back(make_tuple(static_cast<unsigned>(boost::source(*ei, h)),
+                                    static_cast<unsigned>(boost::target(*ei, h)),
+                                    h[*ei].t));
+  sort(read_edges.begin(), read_edges.end());
+  CHECK(read_edges == edges);
+
+  const depends_context_t &readctx = h[boost::graph_bundle];
+  CHECK(readctx.user_src_f_paths == depctx.user_src_f_paths);
+  CHECK(readctx.syst_src_f_paths == depctx.syst_src_f_paths);
+  CHECK(readctx.toplvl_syst_src_f_paths == depctx.toplvl_syst_src_f_paths);
+  CHECK(readctx.macros.def == depctx.macros.def);
+  CHECK(readctx.macros.und == depctx.macros.und);
+  CHECK(readctx.include.dirs == depctx.include.dirs);
+  CHECK(readctx.syst_summaries == depctx.syst_summaries);
+  CHECK(readctx.user_hdr_blobs == depctx.user_hdr_blobs);
+  CHECK(readctx.included_paths == depctx.included_paths);
+  CHECK(readctx.included_digests == depctx.included_digests);
+
+  auto same_location = [](const full_source_location_t &lhs,
+                          const full_source_location_t &rhs) -> bool {
+    return lhs.f == rhs.f && lhs.beg == rhs.beg;
+  };
+
+  auto same_locations = [&](const set<full_source_location_t> &lhs,
+                            const set<full_source_location_t> &rhs) -> bool {
+    return lhs.size() == rhs.size() &&
+           equal(lhs.begin(), lhs.end(), rhs.begin(), same_location);
+  };
+
+  CHECK(readctx.glbl_defs.size() == depctx.glbl_defs.size());
+  for (const auto &sym : depctx.glbl_defs) {
+    auto it = readctx.glbl_defs.find(sym.first);
+    CHECK(it != readctx.glbl_defs.end() &&
+          same_location((*it).second, sym.second));
+  }
+
+  for (auto tbls : {make_pair(&depctx.glbl_decls, &readctx.glbl_decls),
+                    make_pair(&depctx.static_defs, &readctx.static_defs),
+                    make_pair(&depctx.static_decls, &readctx.static_decls)}) {
+    CHECK(tbls.first->size() == tbls.second->size());
+    for (const auto &sym : *tbls.first) {
+      auto it = tbls.second->find(sym.first);
+      CHECK(it != tbls.second->end() &&
+            same_locations((*it).second, sym.second));
+    }
+  }
+
+  //
+  // the header counts what the graph has, and its filter has its definitions
+  //
+  depends_header_t hdr;
+  {
+    istringstream is(bytes);
+    CHECK(read_depends_header(is, hdr));
+  }
+  CHECK(hdr.num_verts == rngs.size());
+  CHECK(hdr.num_edges == edges.size());
+  CHECK(hdr.num_glbl_defs == 2);
+  CHECK(hdr.num_static_defs == 1);
+  CHECK(hdr.may_define("main"));
+  CHECK(hdr.may_define("printf"));
+  CHECK(hdr.may_define("helper"));
+
+  //
+  // and a graph which is cut short doesn't read
+  //
+  for (size_t len : {bytes.size() / 2, bytes.size() - 1}) {
+    istringstream is(bytes.substr(0, len));
+    depends_archive_t cut;
+    bool threw = false;
+    try {
+      read_depends(is, cut);
+    } catch (const exception &) {
+      threw = true;
+    }
+    CHECK(threw);
+  }
+}
+
+int main() {
+  check_zigzag();
+  check_round_trip();
+  return check::result();
+}
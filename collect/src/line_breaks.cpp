@@ -0,0 +1,67 @@
+#include "line_breaks.h"
+#include <algorithm>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+namespace carbon {
+
+line_breaks_t::line_breaks_t(const char *buf, uint32_t size) : size(size) {
+  uint32_t i = 0;
+
+#ifdef __SSE2__
+  const __m128i nl = _mm_set1_epi8('\n');
+  const __m128i cr = _mm_set1_epi8('\r');
+  const __m128i nul = _mm_setzero_si128();
+
+  for (; i + 16 <= size; i += 16) {
+    __m128i chunk =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf + i));
+
+    unsigned brk_mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_or_si128(
+        _mm_cmpeq_epi8(chunk, nl), _mm_cmpeq_epi8(chunk, cr))));
+    unsigned nul_mask =
+        static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, nul)));
+
+    for (; brk_mask; brk_mask &= brk_mask - 1)
+      brks.push_back(i + static_cast<uint32_t>(__builtin_ctz(brk_mask)));
+    for (; nul_mask; nul_mask &= nul_mask - 1)
+      nuls.push_back(i + static_cast<uint32_t>(__builtin_ctz(nul_mask)));
+  }
+#endif
+
+  for (; i < size; ++i) {
+    if (buf[i] == '\n' || buf[i] == '\r')
+      brks.push_back(i);
+    else if (buf[i] == '\0')
+      nuls.push_back(i);
+  }
+}
+
+uint32_t line_breaks_t::offset_from_line_start(uint32_t off) const {
+  auto it = lower_bound(brks.begin(), brks.end(), off);
+  if (it == brks.begin())
+    return off;
+
+  return off - (*(it - 1) + 1);
+}
+
+uint32_t line_breaks_t::offset_to_line_end(uint32_t off) const {
+  uint32_t eol = size;
+
+  auto it = lower_bound(brks.begin(), brks.end(), off);
+  if (it != brks.end())
+    eol = *it;
+
+  if (!nuls.empty()) {
+    auto nul_it = lower_bound(nuls.begin(), nuls.end(), off);
+    if (nul_it != nuls.end())
+      eol = min(eol, *nul_it);
+  }
+
+  return off < eol ? eol - off : 0;
+}
+
+}
@@ -0,0 +1,42 @@
+#include "check.h"
+#include "line_breaks.h"
+#include <random>
+#include <string>
+
+using namespace std;
+using namespace carbon;
+
+//
+// the line breaks index answers what walking the buffer from the given offset
+// would, backwards to the previous line break, and forwards to the next line
+// break or NUL character (of which the buffer, like clang's, has one past its
+// end)
+//
+int main() {
+  mt19937 rng(1);
+  const char alphabet[] = "ab \t;\n\r\0x";
+
+  for (unsigned t = 0; t < 3000; ++t) {
+    uint32_t n = rng() % 200;
+    string buf(n + 1, '\0');
+    for (uint32_t i = 0; i < n; ++i)
+      buf[i] = alphabet[rng() % (sizeof(alphabet) - 1)];
+
+    line_breaks_t lb(buf.data(), n);
+
+    for (uint32_t off = 0; off <= n; ++off) {
+      uint32_t pos = off;
+      while (pos > 0 && buf[pos - 1] != '\r' && buf[pos - 1] != '\n')
+        --pos;
+      if (off < n)
+        CHECK(lb.offset_from_line_start(off) == off - pos);
+
+      for (pos = off; buf[pos] != '\r' && buf[pos] != '\n' && buf[pos] != '\0';
+           ++pos)
+        ;
+      CHECK(lb.offset_to_line_end(off) == pos - off);
+    }
+  }
+
+  return check::result();
+}
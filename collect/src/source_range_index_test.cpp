@@ -0,0 +1,135 @@
+#include "check.h"
+#include "source_range_index.h"
+#include <random>
+#include <tuple>
+#include <vector>
+
+using namespace std;
+using namespace carbon;
+
+typedef source_range_index<int, unsigned> index_t;
+
+//
+// the index against a plain list of its ranges, as the collector uses it: a
+// range which overlaps others replaces them with the hull of them all (see
+// collector_priv::code())
+//
+struct model_t {
+  vector<tuple<int, int, unsigned>> rngs;
+
+  void code(int beg, int end, unsigned v) {
+    if (!(beg < end))
+      return;
+
+    vector<tuple<int, int, unsigned>> rest;
+    for (const auto &rng : rngs) {
+      if (get<0>(rng) < end && beg < get<1>(rng)) {
+        beg = min(beg, get<0>(rng));
+        end = max(end, get<1>(rng));
+      } else {
+        rest.push_back(rng);
+      }
+    }
+
+    rest.push_back(make_tuple(beg, end, v));
+    sort(rest.begin(), rest.end());
+    rngs.swap(rest);
+  }
+
+  unsigned at(int l) const {
+    for (const auto &rng : rngs)
+      if (get<0>(rng) <= l && l < get<1>(rng))
+        return get<2>(rng);
+    return UINT32_MAX;
+  }
+};
+
+static void code(index_t &idx, int beg, int end, unsigned v) {
+  pair<index_t::size_type, index_t::size_type> ovlp = idx.overlapping(beg, end);
+  if (ovlp.first != ovlp.second) {
+    beg = min(beg, idx.beg(ovlp.first));
+    end = max(end, idx.end(ovlp.second - 1));
+  }
+  idx.assign(ovlp.first, ovlp.second, beg, end, v);
+}
+
+static void check_against_model() {
+  mt19937 rng(1);
+
+  for (unsigned t = 0; t < 200; ++t) {
+    index_t idx;
+    model_t model;
+
+    for (unsigned v = 0; v < 100; ++v) {
+      int beg = static_cast<int>(rng() % 1000);
+      int end = beg + static_cast<int>(rng() % (v % 10 == 0 ? 100 : 10));
+      code(idx, beg, end, v);
+      model.code(beg, end, v);
+    }
+
+    CHECK(idx.size() == model.rngs.size());
+    for (index_t::size_type i = 1; i < idx.size(); ++i)
+      CHECK(idx.end(i - 1) <= idx.beg(i));
+
+    for (int l = -1; l < 1200; ++l) {
+      index_t::size_type i = idx.find(l);
+      unsigned v = model.at(l);
+      CHECK((i == index_t::npos) == (v == UINT32_MAX));
+      if (i != index_t::npos)
+        CHECK(idx.vertex(i) == v);
+    }
+
+    for (unsigned q = 0; q < 100; ++q) {
+      int beg = static_cast<int>(rng() % 1100) - 50;
+      int end = beg + static_cast<int>(rng() % 50);
+
+      pair<index_t::size_type, index_t::size_type> ovlp =
+          idx.overlapping(beg, end);
+
+      // (an empty range overlaps nothing)
+      unsigned n = 0;
+      for (const auto &r : model.rngs)
+        n += beg < end && get<0>(r) < end && beg < get<1>(r);
+      CHECK(ovlp.second - ovlp.first == n);
+      CHECK((idx.find(beg, end) == index_t::npos) == (n == 0));
+
+      for (index_t::size_type i = ovlp.first; i < ovlp.second; ++i)
+        CHECK(idx.beg(i) < end && beg < idx.end(i));
+    }
+  }
+}
+
+static void check_edges() {
+  index_t idx;
+  CHECK(idx.empty());
+  CHECK(idx.find(0) == index_t::npos);
+
+  idx.insert(10, 20, 1);
+  idx.insert(30, 40, 2);
+  idx.insert(20, 30, 3);
+  CHECK(idx.size() == 3);
+
+  // (right-open: the end of one range is the beginning of the next)
+  CHECK(idx.vertex(idx.find(19)) == 1);
+  CHECK(idx.vertex(idx.find(20)) == 3);
+  CHECK(idx.find(40) == index_t::npos);
+  CHECK(idx.find(9) == index_t::npos);
+
+  // (an empty range overlaps nothing, and isn't stored)
+  CHECK(idx.find(15, 15) == index_t::npos);
+  idx.insert(50, 50, 4);
+  CHECK(idx.size() == 3);
+
+  idx.assign(0, 3, 10, 40, 5);
+  CHECK(idx.size() == 1);
+  CHECK(idx.beg(0) == 10 && idx.end(0) == 40 && idx.vertex(0) == 5);
+
+  idx.erase(0, 1);
+  CHECK(idx.empty());
+}
+
+int main() {
+  check_edges();
+  check_against_model();
+  return check::result();
+}
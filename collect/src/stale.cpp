@@ -0,0 +1,174 @@
+#include "stale.h"
+#include "depends_builder.h"
+#include "depends_codec.h"
+#include "journal.h"
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <fstream>
+#include <boost/graph/adj_list_serialize.hpp>
+#include <boost/serialization/vector.hpp>
+#include <boost/serialization/unordered_map.hpp>
+#include <boost/serialization/set.hpp>
+#define CARBON_BINARY
+#ifdef CARBON_BINARY
+#include <boost/archive/binary_iarchive.hpp>
+#else
+#include <boost/archive/text_iarchive.hpp>
+#endif
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/MD5.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+
+using namespace std;
+namespace fs = boost::filesystem;
+
+namespace carbon {
+
+//
+// only the context of a graph is needed (of which the rest goes unread, unless
+// it was written by an older collector, as a boost archive)
+//
+static void read_depends_context(istream &is, depends_context_t &depctx) {
+  if (is_depends_encoding(is)) {
+    depends_reader_t(is).read_context(depctx);
+    return;
+  }
+
+  depends_archive_t g;
+#ifdef CARBON_BINARY
+  boost::archive::binary_iarchive ia(is);
+#else
+  boost::archive::text_iarchive ia(is);
+#endif
+  ia >> g;
+  depctx = g[boost::graph_bundle];
+}
+
+vector<fs::path> stale_translation_units(const fs::path &root_src_dir,
+                                         const fs::path &root_bin_dir) {
+  fs::path carbon_dir(root_bin_dir / ".carbon");
+  fs::path journal_path(carbon_dir / journal_file_name);
+
+  //
+  // the collection of each translation unit (by its source file, relative to
+  // the root source directory) is either a .carbon file or its latest record
+  // in the journal, whichever was written last. (see carbon-extract.)
+  //
+  map<string, pair<uint64_t, uint64_t>> records;
+  map<string, fs::path> files;
+
+  uint64_t skipped = 0;
+  if (fs::exists(journal_path))
+    records = latest_journal_records(journal_path.string(), skipped);
+
+  if (fs::is_directory(carbon_dir)) {
+    fs::recursive_directory_iterator end_iter;
+    for (fs::recursive_directory_iterator dir_itr(carbon_dir);
+         dir_itr != end_iter; ++dir_itr) {
+      // (the summaries and blobs are shared, not collections)
+      if (dir_itr->path().filename().string()[0] == '.' &&
+          fs::is_directory(dir_itr->status())) {
+        dir_itr.disable_recursion_pending();
+        continue;
+      }
+
+      if (!fs::is_regular_file(dir_itr->status()) ||
+          dir_itr->path().extension() != ".carbon")
+        continue;
+
+      string rel(dir_itr->path().lexically_relative(carbon_dir).string());
+      rel.resize(rel.size() - strlen(".carbon"));
+
+      if (records.find(rel) == records.end())
+        files[rel] = dir_itr->path();
+    }
+  }
+
+  //
+  // the contents of a file are digested once, however many translation units
+  // included it. a file which is gone has no digest.
+  //
+  map<string, string> digests;
+  auto digest_of_file = [&](const string &p) -> const string & {
+    auto it = digests.find(p);
+    if (it != digests.end())
+      return (*it).second;
+
+    string &res = digests[p];
+
+    auto buf = llvm::MemoryBuffer::getFile(p, /*IsText=*/false,
+                                           /*RequiresNullTerminator=*/false);
+    if (!buf)
+      return res;
+
+    llvm::MD5 h;
+    h.update((*buf)->getBuffer());
+    llvm::MD5::MD5Result r;
+    h.final(r);
+    res = r.digest().str().str();
+    return res;
+  };
+
+  auto is_stale = [&](const depends_context_t &depctx) -> bool {
+    if (depctx.included_paths.empty())
+      return true;
+
+    for (size_t i = 0; i < depctx.included_paths.size(); ++i)
+      if (digest_of_file(depctx.included_paths[i]) !=
+          depctx.included_digests[i])
+        return true;
+
+    return false;
+  };
+
+  vector<fs::path> res;
+
+  auto consider = [&](const string &rel, const depends_context_t &depctx) {
+    if (is_stale(depctx))
+      res.push_back(root_src_dir / rel);
+  };
+
+  if (!records.empty()) {
+    // (in the order they were written, so as to read the journal in order)
+    vector<pair<pair<uint64_t, uint64_t>, string>> recs;
+    for (auto &rec : records)
+      recs.push_back(make_pair(rec.second, rec.first));
+    sort(recs.begin(), recs.end());
+
+    ifstream ifs(journal_path.string(), ios::binary);
+    for (auto &rec : recs) {
+      try {
+        ifs.clear();
+        ifs.seekg(rec.first.first, ios::beg);
+
+        depends_context_t depctx;
+        read_depends_context(ifs, depctx);
+        consider(rec.second, depctx);
+      } catch (const exception &e) {
+        llvm::errs() << "collect : failed to read record of " << rec.second
+                     << " (" << e.what() << ")\n";
+        res.push_back(root_src_dir / rec.second);
+      }
+    }
+  }
+
+  for (auto &f : files) {
+    try {
+      ifstream ifs(f.second.string(), ios::binary);
+      depends_context_t depctx;
+      read_depends_context(ifs, depctx);
+      consider(f.first, depctx);
+    } catch (const exception &e) {
+      llvm::errs() << "collect : failed to read " << f.second.string() << " ("
+                   << e.what() << ")\n";
+      res.push_back(root_src_dir / f.first);
+    }
+  }
+
+  sort(res.begin(), res.end());
+  return res;
+}
+
+}
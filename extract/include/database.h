@@ -0,0 +1,179 @@
+#pragma once
+#include "collection.h"
+#include "reachable.h"
+#include <cstdint>
+#include <unordered_set>
+#include <boost/filesystem.hpp>
+
+namespace carbon {
+
+//
+// a linked dependency graph, laid out flat so that it can be mapped into memory
+// and queried in place. it consists of a database_header_t followed by the
+// sections it lists, each aligned to 8 bytes:
+//
+// - the source range of every vertex, as parallel arrays (DB_VERT_*)
+// - the out-edges and in-edges of every vertex in compressed sparse row form:
+//   offsets per vertex into arrays of neighbors, with a byte per edge for its
+//   DEPENDS_EDGE_TYPE (DB_OUT_*, DB_IN_*)
+// - a table of NUL-terminated strings, which everything else refers to by
+//   offset (DB_STRINGS)
+// - the source file tables of depends_context_t, and the include directories
+// - the global and static definitions, sorted by name (database_symbol_t)
+// - for every source file (user files, then system files), the vertices within
+//   it sorted by where they begin, along with the furthest end of any of them
+//   so far, so that the code at a location is found by binary search
+//
+static const uint32_t database_magic = 0x44425243; // "CRBD"
+static const uint32_t database_version = 2;
+
+// file under .carbon/ which carbon-link writes the database of the whole build
+// to, unless told otherwise
+static const char *const database_file_name = ".db";
+
+enum DATABASE_SECTION {
+  DB_VERT_F,
+  DB_VERT_BEG,
+  DB_VERT_END,
+  DB_OUT_OFFS,
+  DB_OUT_VERTS,
+  DB_OUT_TYPES,
+  DB_IN_OFFS,
+  DB_IN_VERTS,
+  DB_IN_TYPES,
+  DB_STRINGS,
+  DB_USER_PATHS,
+  DB_USER_PATHS_SORTED,
+  DB_SYST_PATHS,
+  DB_TOPLVL_PATHS,
+  DB_INCLUDE_DIRS,
+  DB_GLBL_DEFS,
+  DB_STATIC_DEFS,
+  DB_FILE_RANGES,
+  DB_RANGES,
+  DB_RANGES_MAX_END,
+
+  DB_NUM_SECTIONS
+};
+
+struct database_section_t {
+  uint64_t off;
+  uint64_t len;
+};
+
+struct database_header_t {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t num_verts;
+  uint64_t num_edges;
+
+  // a digest of what it was linked from (see carbon-link), or 0
+  uint64_t inputs;
+
+  database_section_t sections[DB_NUM_SECTIONS];
+};
+
+struct database_symbol_t {
+  uint32_t name; // (offset into DB_STRINGS)
+  source_file_t f;
+  source_location_t beg;
+};
+
+typedef uint32_t database_vertex_t;
+static const database_vertex_t database_nil = UINT32_MAX;
+
+void write_database(const boost::filesystem::path &, const depends_t &,
+                    uint64_t inputs = 0);
+
+// only the header of the given database. false if it is not one (of this
+// version).
+bool read_database_header(database_header_t &, const boost::filesystem::path &);
+
+class database_t {
+  int fd;
+  const char *base;
+  size_t size;
+
+  const database_header_t &header() const {
+    return *reinterpret_cast<const database_header_t *>(base);
+  }
+
+  template <typename T> const T *section(DATABASE_SECTION s) const {
+    return reinterpret_cast<const T *>(base + header().sections[s].off);
+  }
+
+  template <typename T> size_t section_size(DATABASE_SECTION s) const {
+    return header().sections[s].len / sizeof(T);
+  }
+
+public:
+  database_t() : fd(-1), base(nullptr), size(0) {}
+  ~database_t();
+
+  // maps the given database into memory. complains and returns false if it is
+  // not one (of this version).
+  bool open(const boost::filesystem::path &);
+
+  size_t num_vertices() const { return header().num_verts; }
+  size_t num_edges() const { return header().num_edges; }
+
+  source_range_t range(database_vertex_t v) const {
+    return {section<source_file_t>(DB_VERT_F)[v],
+            section<source_location_t>(DB_VERT_BEG)[v],
+            section<source_location_t>(DB_VERT_END)[v]};
+  }
+
+  // [first, last) of the neighbors, and the types of the edges to them
+  std::pair<const database_vertex_t *, const database_vertex_t *>
+  out_edges(database_vertex_t v) const;
+  const uint8_t *out_edge_types(database_vertex_t v) const;
+
+  std::pair<const database_vertex_t *, const database_vertex_t *>
+  in_edges(database_vertex_t v) const;
+  const uint8_t *in_edge_types(database_vertex_t v) const;
+
+  const char *string_at(uint32_t off) const {
+    return section<char>(DB_STRINGS) + off;
+  }
+
+  size_t num_user_files() const {
+    return section_size<uint32_t>(DB_USER_PATHS);
+  }
+  size_t num_syst_files() const {
+    return section_size<uint32_t>(DB_SYST_PATHS);
+  }
+
+  const char *path_of_source_file(source_file_t) const;
+  const char *top_level_system_header(source_file_t) const;
+
+  // the user source file with the given path, or -1
+  source_file_t user_source_file(const std::string &path) const;
+
+  std::pair<const uint32_t *, const uint32_t *> include_dirs() const {
+    const uint32_t *dirs = section<uint32_t>(DB_INCLUDE_DIRS);
+    return std::make_pair(dirs, dirs + section_size<uint32_t>(DB_INCLUDE_DIRS));
+  }
+
+  // the definition(s) of the given symbol
+  std::pair<const database_symbol_t *, const database_symbol_t *>
+  global_definition(const std::string &name) const;
+  std::pair<const database_symbol_t *, const database_symbol_t *>
+  static_definitions(const std::string &name) const;
+
+  // the outermost code which the given location in the given file lies in, or
+  // database_nil
+  database_vertex_t vertex_at(source_file_t, source_location_t) const;
+};
+
+//
+// the counterpart of reachable_code() for a database: out is made to be the
+// subgraph of the code which is needed (along with the code which orders it),
+// and reachable the code which is needed. nothing else of the database is read.
+//
+void reachable_code_of_database(depends_t &out,
+                                std::unordered_set<code_t> &reachable,
+                                const database_t &,
+                                const code_location_list_t &,
+                                const global_symbol_list_t &,
+                                bool only_tys = false);
+}
@@ -1,5 +1,6 @@
 #pragma once
 #include "collection.h"
+#include "read_collection.h"
 #include <boost/filesystem.hpp>
 #include <functional>
 #include <string>
@@ -8,16 +9,24 @@
 
 namespace carbon {
 
-struct boost_filesystem_path_hasher_t {
-   size_t operator() (const boost::filesystem::path &p) const {
-     return std::hash<std::string>()(p.string());
-   }
-};
-
 typedef std::pair<
     boost::filesystem::path,
     std::unordered_set<boost::filesystem::path, boost_filesystem_path_hasher_t>>
     collection_sources_t;
 
-void link(depends_t &out, const collection_sources_t &);
+// the summaries of system headers and the blobs of user headers aren't
+// collections of their own; they are linked along with the collections which
+// refer to them
+bool is_shared_collection_dir(const boost::filesystem::directory_entry &);
+
+// every collection under the .carbon directory of the given sources, those in
+// the journal included. a .carbon file written after the journal was last
+// appended to (because the collector was since run without the journal
+// argument, say) takes the place of its record in the journal.
+void all_collections(collection_sources_t &, journal_index_t &journal);
+
+// the sources which have a record in the given journal are read from there,
+// and the rest from their own files
+void link(depends_t &out, const collection_sources_t &,
+          const journal_index_t &journal = journal_index_t());
 }
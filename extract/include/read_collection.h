@@ -1,9 +1,56 @@
 #pragma once
 #include <string>
 #include "collection.h"
+#include <depends_codec.h>
+#include <cstdint>
+#include <istream>
+#include <unordered_map>
 #include <boost/filesystem.hpp>
 
 namespace carbon {
 
+struct boost_filesystem_path_hasher_t {
+   size_t operator() (const boost::filesystem::path &p) const {
+     return std::hash<std::string>()(p.string());
+   }
+};
+
+// where a graph lies in the journal (see journal_file_name)
+struct journal_record_t {
+  uint64_t off;
+  uint64_t len;
+};
+
+// the latest record of each translation unit in the journal, by the path of
+// the .carbon file which it stands in for (unless that was written after it,
+// see latest_journal_records())
+typedef std::unordered_map<boost::filesystem::path, journal_record_t,
+                           boost_filesystem_path_hasher_t>
+    journal_index_t;
+
 void read_collection_file(depends_t &out, const boost::filesystem::path &);
+
+// only the context of the graph (e.g. its symbols), of which the rest need not
+// be read
+void read_collection_file_context(depends_context_t &out,
+                                  const boost::filesystem::path &);
+
+// only the header of the graph (see depends_header_t). false if it has none,
+// having been written by an older collector.
+bool read_collection_file_header(depends_header_t &out,
+                                 const boost::filesystem::path &);
+
+// reads the records' headers (skipping over their graphs) from beginning to
+// end. does nothing if there is no journal in the given .carbon directory.
+void read_journal_index(journal_index_t &out,
+                        const boost::filesystem::path &carbon_dir);
+
+void read_collection_record(depends_t &out, std::istream &journal,
+                            const journal_record_t &);
+void read_collection_record_context(depends_context_t &out,
+                                    std::istream &journal,
+                                    const journal_record_t &);
+bool read_collection_record_header(depends_header_t &out,
+                                   std::istream &journal,
+                                   const journal_record_t &);
 }
@@ -0,0 +1,48 @@
+#pragma once
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include <boost/filesystem.hpp>
+
+namespace carbon {
+
+// a definition of a global symbol, by the source file of the translation unit
+// which has it (relative to the root source directory)
+struct symbol_definition_t {
+  bool is_static;
+  std::string rel;
+};
+
+//
+// the symbols which the translation units in a .carbon directory define (see
+// symbols_file_name). opening it folds in whatever the collector appended since
+// it was last opened, after which a symbol is looked up by a binary search of
+// the sorted index.
+//
+class symbol_index_t {
+  std::ifstream index;
+  uint64_t size;
+
+  // blocks which could not be folded into the index (the directory not being
+  // ours to write to, say), by source file. they supersede what the index has
+  // of the same source files.
+  std::map<std::string, std::vector<std::pair<char, std::string>>> pending;
+
+  // the offset of the first line beginning at or after the given one
+  uint64_t line_at(uint64_t off);
+
+public:
+  symbol_index_t() : size(0) {}
+
+  // returns false if there is no index, as there isn't for collections of
+  // older collectors
+  bool open(const boost::filesystem::path &carbon_dir);
+
+  // the definitions of the given symbol, globals first
+  void definitions(std::vector<symbol_definition_t> &out,
+                   const std::string &name);
+};
+}
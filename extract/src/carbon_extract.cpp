@@ -5,6 +5,8 @@
 #include "code_reader.h"
 #include "graphviz.h"
 #include "static.h"
+#include "database.h"
+#include "symbol_index.h"
 #include <algorithm>
 #include <tuple>
 #include <iostream>
@@ -21,16 +23,20 @@ namespace po = boost::program_options;
 namespace fs = boost::filesystem;
 typedef boost::format fmt;
 
-static tuple<fs::path, collection_sources_t, code_location_list_t,
-             global_symbol_list_t, vector<fs::path>, int, bool, bool, bool, bool>
+static tuple<fs::path, collection_sources_t, journal_index_t,
+             code_location_list_t, global_symbol_list_t, vector<fs::path>,
+             fs::path, fs::path, int, bool, bool, bool, bool>
 parse_command_line_arguments(int argc, char **argv);
 
 int main(int argc, char **argv) {
   fs::path ofp;
   collection_sources_t clc_files;
+  journal_index_t journal;
   code_location_list_t desired_code_locs;
   global_symbol_list_t desired_glbs;
   vector<fs::path> exclude_dirs;
+  fs::path db_fp;
+  fs::path write_db_fp;
   int verb;
   bool only_tys;
   bool graphviz;
@@ -40,22 +46,41 @@ int main(int argc, char **argv) {
   //
   // parse command line
   //
-  tie(ofp, clc_files, desired_code_locs, desired_glbs, exclude_dirs, verb, only_tys,
-      graphviz, syst_code, debug) = parse_command_line_arguments(argc, argv);
+  tie(ofp, clc_files, journal, desired_code_locs, desired_glbs, exclude_dirs,
+      db_fp, write_db_fp, verb, only_tys, graphviz, syst_code,
+      debug) = parse_command_line_arguments(argc, argv);
 
-  //
-  // take every collection for each source file, and merge (link) them together
-  //
   depends_t g;
-  link(g, clc_files);
-  code_reader c_reader(g, exclude_dirs);
-
-  //
-  // compute a minimal set which contains the requested code
-  //
   unordered_set<code_t> reachable;
-  set<code_t> desired_code =
-      reachable_code(reachable, g, desired_code_locs, desired_glbs, only_tys);
+
+  if (!db_fp.empty()) {
+    //
+    // the graph is already linked. only the code which is needed is taken out
+    // of it.
+    //
+    database_t db;
+    if (!db.open(db_fp))
+      exit(1);
+
+    reachable_code_of_database(g, reachable, db, desired_code_locs,
+                               desired_glbs, only_tys);
+  } else {
+    //
+    // take every collection for each source file, and merge (link) them
+    // together
+    //
+    link(g, clc_files, journal);
+
+    if (!write_db_fp.empty())
+      write_database(write_db_fp, g);
+
+    //
+    // compute a minimal set which contains the requested code
+    //
+    reachable_code(reachable, g, desired_code_locs, desired_glbs, only_tys);
+  }
+
+  code_reader c_reader(g, exclude_dirs);
 
   //
   // output graph visualization if requested
@@ -153,8 +178,9 @@ static int line_number_to_offset(const fs::path& p, int lnno) {
   return (*it).second;
 }
 
-tuple<fs::path, collection_sources_t, code_location_list_t,
-      global_symbol_list_t, vector<fs::path>, int, bool, bool, bool, bool>
+tuple<fs::path, collection_sources_t, journal_index_t, code_location_list_t,
+      global_symbol_list_t, vector<fs::path>, fs::path, fs::path, int, bool,
+      bool, bool, bool>
 parse_command_line_arguments(int argc, char **argv) {
   fs::path root_src_dir;
   fs::path root_bin_dir;
@@ -164,7 +190,10 @@ parse_command_line_arguments(int argc, char **argv) {
   bool from_all;
 
   fs::path ofp;
+  fs::path db_fp;
+  fs::path write_db_fp;
   collection_sources_t cfl;
+  journal_index_t journal;
   code_location_list_t cll;
   global_symbol_list_t gsl;
   int verb;
@@ -211,6 +240,14 @@ parse_command_line_arguments(int argc, char **argv) {
       ("graphviz,g", "output graphviz file")
 
       ("sys-code,s", "inline code from system header files")
+
+      ("db", po::value<fs::path>(&db_fp),
+       "specify dependency database to extract code from, rather than linking "
+       "the collections (see carbon-link, and --write-db)")
+
+      ("write-db", po::value<fs::path>(&write_db_fp),
+       "specify file to write the linked dependency graph to, as a database "
+       "which --db can query in place")
     ;
 
     po::positional_options_description p;
@@ -240,23 +277,89 @@ parse_command_line_arguments(int argc, char **argv) {
 
   root_src_dir = fs::canonical(root_src_dir);
 
+  vector<fs::path> exclude_dirs;
+  for (const fs::path &path : excl_args) {
+    if (!fs::is_directory(path)) {
+      cerr << "provided path is not directory: " << path << '\n';
+      exit(1);
+    }
+
+    exclude_dirs.push_back(fs::canonical(path));
+  }
+
+  if (!db_fp.empty()) {
+    if (!write_db_fp.empty() || from_all || !from_args.empty()) {
+      cerr << "--db is not to be given with --write-db, --from, or --from-all"
+           << endl;
+      exit(1);
+    }
+
+    //
+    // the database has everything linked already; nothing is to be found in
+    // the collections
+    //
+    for (const string &s : code_args) {
+      string::size_type colpos = s.find(':');
+      if (colpos == string::npos) {
+        gsl.push_back(s);
+        continue;
+      }
+
+      if (colpos >= s.size() - 2 ||
+          (s[s.size() - 1] != 'l' && s[s.size() - 1] != 'o')) {
+        cerr << "invalid specification of code '" << s << "' to extract"
+             << endl;
+        exit(1);
+      }
+
+      string relpath = s.substr(0, colpos);
+
+      fs::path abspath(root_src_dir / relpath);
+      if (!fs::is_regular_file(abspath)) {
+        cerr << "code source file '" << relpath << "' does not exist" << endl;
+        exit(1);
+      }
+      abspath = fs::canonical(abspath);
+
+      string rest = s.substr(colpos + 1, s.size() - (colpos + 1) - 1);
+      int off = s[s.size() - 1] == 'l'
+                    ? line_number_to_offset(abspath, stoi(rest))
+                    : stoi(rest);
+
+      cll.push_back(make_pair(abspath.string(), off));
+    }
+
+    return make_tuple(ofp, cfl, journal, cll, gsl, exclude_dirs, db_fp,
+                      write_db_fp, verb, only_tys, graphviz, syst_code, debug);
+  }
+
   fs::path carbon_dir(root_bin_dir / ".carbon");
   if (!fs::is_directory(carbon_dir)) {
     cerr << "carbon data not found in " << root_src_dir << endl;
     exit(1);
   }
 
+  // (everything found under it is then canonical as well)
+  carbon_dir = fs::canonical(carbon_dir);
+
   cfl.first = carbon_dir;
 
-  if (from_all) {
-    fs::recursive_directory_iterator end_iter;
-    for (fs::recursive_directory_iterator dir_itr(carbon_dir);
-         dir_itr != end_iter; ++dir_itr) {
-      if (!fs::is_regular_file(dir_itr->status()))
-        continue;
+  // (a .carbon file written after the latest record of its source file in the
+  // journal is not in it)
+  read_journal_index(journal, carbon_dir);
 
-      cfl.second.insert(fs::canonical(dir_itr->path()));
-    }
+  // the .carbon file of the given source file, be it in the journal or not
+  auto collection_of_source_file = [&](const fs::path &src) -> fs::path {
+    fs::path p(carbon_dir /
+               (fs::relative(fs::canonical(src), root_src_dir).string() +
+                ".carbon"));
+    if (!fs::is_regular_file(p) && journal.find(p) == journal.end())
+      return fs::path();
+    return p;
+  };
+
+  if (from_all) {
+    all_collections(cfl, journal);
   } else {
     for (const string &relpath : from_args) {
       fs::path abspath1(root_src_dir / relpath);
@@ -265,26 +368,19 @@ parse_command_line_arguments(int argc, char **argv) {
         exit(1);
       }
 
-      fs::path abspath2(carbon_dir / (relpath + ".carbon"));
-      if (!fs::is_regular_file(abspath2)) {
+      fs::path abspath2(collection_of_source_file(abspath1));
+      if (abspath2.empty()) {
         cerr << "no carbon collect data for '" << relpath << "'" << endl;
         exit(1);
       }
 
-      cfl.second.insert(fs::canonical(abspath2));
+      cfl.second.insert(abspath2);
     }
   }
 
-
-  vector<fs::path> exclude_dirs;
-  for (const fs::path &path : excl_args) {
-    if (!fs::is_directory(path)) {
-      cerr << "provided path is not directory: " << path << '\n';
-      exit(1);
-    }
-
-    exclude_dirs.push_back(fs::canonical(path));
-  }
+  // (opened upon the first symbol to look up)
+  symbol_index_t symbols;
+  bool symbols_opened = false, have_symbols = false;
 
   for (const string& s : code_args) {
     string::size_type colpos = s.find(':');
@@ -294,20 +390,11 @@ parse_command_line_arguments(int argc, char **argv) {
       gsl.push_back(s);
 
       // find source file where global is defined.
-      fs::recursive_directory_iterator end_iter;
-      for (fs::recursive_directory_iterator dir_itr(carbon_dir);
-           dir_itr != end_iter; ++dir_itr) {
-        if (!fs::is_regular_file(dir_itr->status()))
-          continue;
-
-        fs::path carb_path = fs::canonical(dir_itr->path());
-        depends_t dep;
-        read_collection_file(dep, carb_path);
-
-        bool is_glbl = dep[boost::graph_bundle].glbl_defs.find(s) !=
-                       dep[boost::graph_bundle].glbl_defs.end();
-        bool is_static_glbl = dep[boost::graph_bundle].static_defs.find(s) !=
-                              dep[boost::graph_bundle].static_defs.end();
+      auto defines_global = [&](const depends_context_t &depctx,
+                                const fs::path &carb_path) -> bool {
+        bool is_glbl = depctx.glbl_defs.find(s) != depctx.glbl_defs.end();
+        bool is_static_glbl =
+            depctx.static_defs.find(s) != depctx.static_defs.end();
 
         if (is_glbl || is_static_glbl) {
           assert(is_glbl ^ is_static_glbl);
@@ -315,8 +402,101 @@ parse_command_line_arguments(int argc, char **argv) {
           cerr << "found " << (is_static_glbl ? "static " : "") << "global "
                << s << " in " << carb_path.filename().stem().string() << endl;
           cfl.second.insert(carb_path);
-          break;
+          return true;
+        }
+
+        return false;
+      };
+
+      //
+      // the symbol index has the translation units which define it, as of
+      // when they were last collected. only a collection from before there
+      // was an index can then be missing from it, so if it turns up nothing,
+      // every collection is searched, as without one.
+      //
+      if (!symbols_opened) {
+        have_symbols = symbols.open(carbon_dir);
+        symbols_opened = true;
+      }
+
+      bool found = false;
+
+      if (have_symbols) {
+        vector<symbol_definition_t> defs;
+        symbols.definitions(defs, s);
+
+        for (const symbol_definition_t &def : defs) {
+          fs::path p(carbon_dir / (def.rel + ".carbon"));
+
+          depends_context_t depctx;
+          auto it = journal.find(p);
+          if (it != journal.end()) {
+            ifstream journal_f((carbon_dir / journal_file_name).string(),
+                               ios::binary);
+            read_collection_record_context(depctx, journal_f, (*it).second);
+          } else if (fs::is_regular_file(p)) {
+            read_collection_file_context(depctx, p);
+          } else {
+            continue;
+          }
+
+          if ((found = defines_global(depctx, p)))
+            break;
         }
+
+        if (!found)
+          cerr << "warning: " << s << " is not in the symbol index; "
+               << "searching every collection" << endl;
+      }
+
+      if (!found && !journal.empty()) {
+        vector<pair<fs::path, journal_record_t>> recs(journal.begin(),
+                                                      journal.end());
+        sort(recs.begin(), recs.end(),
+             [](const pair<fs::path, journal_record_t> &lhs,
+                const pair<fs::path, journal_record_t> &rhs) {
+               return lhs.second.off < rhs.second.off;
+             });
+
+        ifstream journal_f((carbon_dir / journal_file_name).string(),
+                           ios::binary);
+        for (const auto &rec : recs) {
+          // (most are ruled out by the header alone)
+          depends_header_t hdr;
+          if (read_collection_record_header(hdr, journal_f, rec.second) &&
+              !hdr.may_define(s))
+            continue;
+
+          depends_context_t depctx;
+          read_collection_record_context(depctx, journal_f, rec.second);
+
+          if ((found = defines_global(depctx, rec.first)))
+            break;
+        }
+      }
+
+      fs::recursive_directory_iterator end_iter;
+      for (fs::recursive_directory_iterator dir_itr(carbon_dir);
+           !found && dir_itr != end_iter; ++dir_itr) {
+        if (is_shared_collection_dir(*dir_itr)) {
+          dir_itr.disable_recursion_pending();
+          continue;
+        }
+
+        if (!fs::is_regular_file(dir_itr->status()) ||
+            dir_itr->path().extension() != ".carbon" ||
+            journal.find(dir_itr->path()) != journal.end())
+          continue;
+
+        depends_header_t hdr;
+        if (read_collection_file_header(hdr, dir_itr->path()) &&
+            !hdr.may_define(s))
+          continue;
+
+        depends_context_t depctx;
+        read_collection_file_context(depctx, dir_itr->path());
+
+        found = defines_global(depctx, dir_itr->path());
       }
 
       continue;
@@ -336,12 +516,12 @@ parse_command_line_arguments(int argc, char **argv) {
       exit(1);
     }
 
-    fs::path abspath2(carbon_dir / (relpath + ".carbon"));
-    if (!fs::is_regular_file(abspath2)) {
+    fs::path abspath2(collection_of_source_file(abspath1));
+    if (abspath2.empty()) {
       cerr << "no carbon collect data for '" << relpath << "'" << endl;
       exit(1);
     }
-    cfl.second.insert(fs::canonical(abspath2));
+    cfl.second.insert(abspath2);
 
     string rest = s.substr(colpos + 1, s.size() - (colpos + 1) - 1);
     int off;
@@ -354,6 +534,6 @@ parse_command_line_arguments(int argc, char **argv) {
     cll.push_back(make_pair(abspath1.string(), off));
   }
 
-  return make_tuple(ofp, cfl, cll, gsl, exclude_dirs, verb, only_tys, graphviz,
-                    syst_code, debug);
+  return make_tuple(ofp, cfl, journal, cll, gsl, exclude_dirs, db_fp,
+                    write_db_fp, verb, only_tys, graphviz, syst_code, debug);
 }
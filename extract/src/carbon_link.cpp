@@ -0,0 +1,152 @@
+#include "collection.h"
+#include "database.h"
+#include "link.h"
+#include "read_collection.h"
+#include <collect_impl.h>
+#include <depends_codec.h>
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <sys/stat.h>
+#include <boost/program_options.hpp>
+
+using namespace std;
+using namespace carbon;
+namespace po = boost::program_options;
+namespace fs = boost::filesystem;
+
+//
+// a digest of everything a link of the given collections reads: the collections
+// (and the journal records among them), and the summaries and blobs which they
+// may refer to, each by its path, size and time of last modification. (to the
+// nanosecond, where the file system keeps it that fine.) any of them changing,
+// or going, or another coming along, changes it.
+//
+static uint64_t digest_of_inputs(const collection_sources_t &cfl,
+                                 const journal_index_t &journal) {
+  vector<string> inputs;
+
+  auto add_file = [&](const fs::path &p) -> void {
+    struct stat st;
+    if (stat(p.c_str(), &st) < 0)
+      return;
+
+    ostringstream ss;
+    ss << p.string() << '\t' << st.st_size << '\t' << st.st_mtim.tv_sec << '.'
+       << st.st_mtim.tv_nsec;
+    inputs.push_back(ss.str());
+  };
+
+  for (const fs::path &p : cfl.second) {
+    auto it = journal.find(p);
+    if (it == journal.end()) {
+      add_file(p);
+      continue;
+    }
+
+    ostringstream ss;
+    ss << p.string() << "\tjournal\t" << (*it).second.off << '\t'
+       << (*it).second.len;
+    inputs.push_back(ss.str());
+  }
+
+  if (!journal.empty())
+    add_file(cfl.first / journal_file_name);
+
+  for (const char *nm : {syst_summaries_dir_name, user_hdr_blobs_dir_name}) {
+    fs::path dir(cfl.first / nm);
+    if (!fs::is_directory(dir))
+      continue;
+
+    for (const fs::directory_entry &ent : fs::directory_iterator(dir))
+      if (fs::is_regular_file(ent.status()))
+        add_file(ent.path());
+  }
+
+  sort(inputs.begin(), inputs.end());
+
+  string all;
+  for (const string &in : inputs)
+    all += in + '\n';
+  return depends_codec::hash_of_symbol(all);
+}
+
+//
+// links every collection of a build once, and writes the linked graph to a
+// database (see database.h), which carbon-extract --db then queries without
+// linking anything. it does nothing if the database was linked from what there
+// is to link now (see digest_of_inputs()).
+//
+int main(int argc, char **argv) {
+  fs::path root_bin_dir;
+  fs::path ofp;
+  bool force;
+
+  try {
+    po::options_description desc("Allowed options");
+    desc.add_options()
+      ("help,h", "produce help message")
+
+      ("bin", po::value<fs::path>(&root_bin_dir)->default_value(fs::current_path()),
+       "specify root build directory where carbon files exist")
+
+      ("out,o", po::value<fs::path>(&ofp),
+       "specify database file path (by default, .carbon/.db under the root "
+       "build directory)")
+
+      ("force,f", "link even if the database is up to date")
+    ;
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+
+    if (vm.count("help")) {
+      cout << "Usage: carbon-link [options]\n";
+      cout << desc;
+      return 0;
+    }
+
+    force = vm.count("force") != 0;
+  } catch (exception &e) {
+    cerr << e.what() << endl;
+    return 1;
+  }
+
+  fs::path carbon_dir(root_bin_dir / ".carbon");
+  if (!fs::is_directory(carbon_dir)) {
+    cerr << "carbon data not found in " << root_bin_dir << endl;
+    return 1;
+  }
+
+  // (everything found under it is then canonical as well)
+  carbon_dir = fs::canonical(carbon_dir);
+
+  if (ofp.empty())
+    ofp = carbon_dir / database_file_name;
+
+  collection_sources_t cfl;
+  journal_index_t journal;
+  cfl.first = carbon_dir;
+  read_journal_index(journal, carbon_dir);
+  all_collections(cfl, journal);
+
+  if (cfl.second.empty()) {
+    cerr << "no collections found in " << carbon_dir << endl;
+    return 1;
+  }
+
+  uint64_t inputs = digest_of_inputs(cfl, journal);
+
+  database_header_t hdr;
+  if (!force && read_database_header(hdr, ofp) && hdr.inputs == inputs) {
+    cerr << ofp.string() << " is up to date." << endl;
+    return 0;
+  }
+
+  depends_t g;
+  link(g, cfl, journal);
+  write_database(ofp, g, inputs);
+
+  return 0;
+}
@@ -0,0 +1,613 @@
+#include "database.h"
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+namespace fs = boost::filesystem;
+
+namespace carbon {
+
+static bool is_whole_file_or_dummy(const source_range_t &src_rng) {
+  return (src_rng.beg == location_entire_file_beg &&
+          src_rng.end == location_entire_file_end) ||
+         (src_rng.beg == location_dummy_beg &&
+          src_rng.end == location_dummy_end);
+}
+
+void write_database(const fs::path &p, const depends_t &g, uint64_t inputs) {
+  const depends_context_t &depctx = g[boost::graph_bundle];
+
+  cerr << "writing dependency database..." << endl;
+
+  //
+  // vertices
+  //
+  unordered_map<depends_vertex_t, database_vertex_t> vert_idx;
+  vector<source_file_t> vert_f;
+  vector<source_location_t> vert_beg;
+  vector<source_location_t> vert_end;
+
+  vert_idx.reserve(boost::num_vertices(g));
+  vert_f.reserve(boost::num_vertices(g));
+  vert_beg.reserve(boost::num_vertices(g));
+  vert_end.reserve(boost::num_vertices(g));
+
+  depends_t::vertex_iterator vi, vi_end;
+  for (tie(vi, vi_end) = boost::vertices(g); vi != vi_end; ++vi) {
+    vert_idx[*vi] = static_cast<database_vertex_t>(vert_f.size());
+    vert_f.push_back(g[*vi].f);
+    vert_beg.push_back(g[*vi].beg);
+    vert_end.push_back(g[*vi].end);
+  }
+
+  //
+  // edges (neighbors sorted, so that they are read in order)
+  //
+  vector<uint64_t> out_offs, in_offs;
+  vector<database_vertex_t> out_verts, in_verts;
+  vector<uint8_t> out_types, in_types;
+
+  out_offs.reserve(vert_f.size() + 1);
+  in_offs.reserve(vert_f.size() + 1);
+  out_verts.reserve(boost::num_edges(g));
+  in_verts.reserve(boost::num_edges(g));
+  out_types.reserve(boost::num_edges(g));
+  in_types.reserve(boost::num_edges(g));
+
+  vector<pair<database_vertex_t, uint8_t>> nbrs;
+  for (tie(vi, vi_end) = boost::vertices(g); vi != vi_end; ++vi) {
+    out_offs.push_back(out_verts.size());
+    in_offs.push_back(in_verts.size());
+
+    nbrs.clear();
+    depends_t::out_edge_iterator oei, oei_end;
+    for (tie(oei, oei_end) = boost::out_edges(*vi, g); oei != oei_end; ++oei)
+      nbrs.push_back(make_pair(vert_idx[boost::target(*oei, g)],
+                               static_cast<uint8_t>(g[*oei].t)));
+    sort(nbrs.begin(), nbrs.end());
+    for (const auto &nbr : nbrs) {
+      out_verts.push_back(nbr.first);
+      out_types.push_back(nbr.second);
+    }
+
+    nbrs.clear();
+    depends_t::in_edge_iterator iei, iei_end;
+    for (tie(iei, iei_end) = boost::in_edges(*vi, g); iei != iei_end; ++iei)
+      nbrs.push_back(make_pair(vert_idx[boost::source(*iei, g)],
+                               static_cast<uint8_t>(g[*iei].t)));
+    sort(nbrs.begin(), nbrs.end());
+    for (const auto &nbr : nbrs) {
+      in_verts.push_back(nbr.first);
+      in_types.push_back(nbr.second);
+    }
+  }
+  out_offs.push_back(out_verts.size());
+  in_offs.push_back(in_verts.size());
+
+  //
+  // strings (each stored once)
+  //
+  vector<char> strings;
+  unordered_map<string, uint32_t> string_offs;
+
+  auto intern = [&](const string &s) -> uint32_t {
+    auto it = string_offs.find(s);
+    if (it != string_offs.end())
+      return (*it).second;
+
+    uint32_t off = static_cast<uint32_t>(strings.size());
+    strings.insert(strings.end(), s.begin(), s.end());
+    strings.push_back('\0');
+    string_offs[s] = off;
+    return off;
+  };
+
+  auto intern_all = [&](vector<uint32_t> &out, const vector<string> &strs) {
+    out.reserve(strs.size());
+    for (const string &s : strs)
+      out.push_back(intern(s));
+  };
+
+  vector<uint32_t> user_paths, syst_paths, toplvl_paths, include_dirs;
+  intern_all(user_paths, depctx.user_src_f_paths);
+  intern_all(syst_paths, depctx.syst_src_f_paths);
+  intern_all(toplvl_paths, depctx.toplvl_syst_src_f_paths);
+  for (const string &dir : depctx.include.dirs)
+    include_dirs.push_back(intern(dir));
+
+  vector<uint32_t> user_paths_sorted(user_paths.size());
+  for (uint32_t i = 0; i < user_paths_sorted.size(); ++i)
+    user_paths_sorted[i] = i;
+  sort(user_paths_sorted.begin(), user_paths_sorted.end(),
+       [&](uint32_t lhs, uint32_t rhs) {
+         return depctx.user_src_f_paths[lhs] < depctx.user_src_f_paths[rhs];
+       });
+
+  //
+  // symbols
+  //
+  auto by_name = [&](const database_symbol_t &lhs,
+                     const database_symbol_t &rhs) {
+    return strcmp(&strings[lhs.name], &strings[rhs.name]) < 0;
+  };
+
+  vector<database_symbol_t> glbl_defs;
+  glbl_defs.reserve(depctx.glbl_defs.size());
+  for (const auto &entry : depctx.glbl_defs)
+    glbl_defs.push_back(
+        {intern(entry.first), entry.second.f, entry.second.beg});
+  sort(glbl_defs.begin(), glbl_defs.end(), by_name);
+
+  vector<database_symbol_t> static_defs;
+  for (const auto &entry : depctx.static_defs) {
+    uint32_t name = intern(entry.first);
+    for (const full_source_location_t &sl : entry.second)
+      static_defs.push_back({name, sl.f, sl.beg});
+  }
+  stable_sort(static_defs.begin(), static_defs.end(), by_name);
+
+  //
+  // the vertices of every source file, by where they begin (and, among those
+  // which begin at the same place, outermost first)
+  //
+  size_t num_files = user_paths.size() + syst_paths.size();
+  auto slot_of_source_file = [&](source_file_t f) -> size_t {
+    return is_system_source_file(f) ? user_paths.size() + index_of_source_file(f)
+                                    : index_of_source_file(f);
+  };
+
+  vector<vector<database_vertex_t>> file_verts(num_files);
+  for (database_vertex_t v = 0; v < vert_f.size(); ++v) {
+    if (is_whole_file_or_dummy({vert_f[v], vert_beg[v], vert_end[v]}))
+      continue;
+
+    size_t slot = slot_of_source_file(vert_f[v]);
+    if (slot < num_files)
+      file_verts[slot].push_back(v);
+  }
+
+  vector<uint64_t> file_ranges;
+  vector<database_vertex_t> ranges;
+  vector<source_location_t> ranges_max_end;
+
+  file_ranges.reserve(num_files + 1);
+  for (vector<database_vertex_t> &verts : file_verts) {
+    sort(verts.begin(), verts.end(),
+         [&](database_vertex_t lhs, database_vertex_t rhs) {
+           if (vert_beg[lhs] != vert_beg[rhs])
+             return vert_beg[lhs] < vert_beg[rhs];
+           return vert_end[lhs] > vert_end[rhs];
+         });
+
+    file_ranges.push_back(ranges.size());
+
+    source_location_t max_end = INT32_MIN;
+    for (database_vertex_t v : verts) {
+      max_end = max(max_end, vert_end[v]);
+      ranges.push_back(v);
+      ranges_max_end.push_back(max_end);
+    }
+  }
+  file_ranges.push_back(ranges.size());
+
+  //
+  // lay it all out
+  //
+  database_header_t hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.magic = database_magic;
+  hdr.version = database_version;
+  hdr.num_verts = vert_f.size();
+  hdr.num_edges = out_verts.size();
+  hdr.inputs = inputs;
+
+  const void *data[DB_NUM_SECTIONS];
+  uint64_t off = sizeof(hdr);
+
+  auto lay_out = [&](DATABASE_SECTION s, const void *p, size_t len) {
+    off = (off + 7) & ~uint64_t(7);
+    hdr.sections[s].off = off;
+    hdr.sections[s].len = len;
+    data[s] = p;
+    off += len;
+  };
+
+#define LAY_OUT(s, v) lay_out(s, v.data(), v.size() * sizeof(v[0]))
+  LAY_OUT(DB_VERT_F, vert_f);
+  LAY_OUT(DB_VERT_BEG, vert_beg);
+  LAY_OUT(DB_VERT_END, vert_end);
+  LAY_OUT(DB_OUT_OFFS, out_offs);
+  LAY_OUT(DB_OUT_VERTS, out_verts);
+  LAY_OUT(DB_OUT_TYPES, out_types);
+  LAY_OUT(DB_IN_OFFS, in_offs);
+  LAY_OUT(DB_IN_VERTS, in_verts);
+  LAY_OUT(DB_IN_TYPES, in_types);
+  LAY_OUT(DB_STRINGS, strings);
+  LAY_OUT(DB_USER_PATHS, user_paths);
+  LAY_OUT(DB_USER_PATHS_SORTED, user_paths_sorted);
+  LAY_OUT(DB_SYST_PATHS, syst_paths);
+  LAY_OUT(DB_TOPLVL_PATHS, toplvl_paths);
+  LAY_OUT(DB_INCLUDE_DIRS, include_dirs);
+  LAY_OUT(DB_GLBL_DEFS, glbl_defs);
+  LAY_OUT(DB_STATIC_DEFS, static_defs);
+  LAY_OUT(DB_FILE_RANGES, file_ranges);
+  LAY_OUT(DB_RANGES, ranges);
+  LAY_OUT(DB_RANGES_MAX_END, ranges_max_end);
+#undef LAY_OUT
+
+  //
+  // written to the side, and moved into place, so that nobody maps a database
+  // which is half-written
+  //
+  fs::path tmp_p(p.string() + ".tmp");
+  {
+    ofstream ofs(tmp_p.string(), ios::binary | ios::trunc);
+    ofs.write(reinterpret_cast<const char *>(&hdr), sizeof(hdr));
+
+    static const char padding[8] = {};
+    uint64_t pos = sizeof(hdr);
+    for (unsigned s = 0; s < DB_NUM_SECTIONS; ++s) {
+      ofs.write(padding, static_cast<streamsize>(hdr.sections[s].off - pos));
+      ofs.write(static_cast<const char *>(data[s]),
+                static_cast<streamsize>(hdr.sections[s].len));
+      pos = hdr.sections[s].off + hdr.sections[s].len;
+    }
+
+    if (!ofs) {
+      cerr << "error: failed to write " << tmp_p.string() << endl;
+      exit(1);
+    }
+  }
+  fs::rename(tmp_p, p);
+
+  cerr << "wrote dependency database (" << off << " bytes)." << endl;
+}
+
+bool read_database_header(database_header_t &hdr, const fs::path &p) {
+  ifstream ifs(p.string(), ios::binary);
+  ifs.read(reinterpret_cast<char *>(&hdr), sizeof(hdr));
+  return ifs && hdr.magic == database_magic &&
+         hdr.version == database_version;
+}
+
+database_t::~database_t() {
+  if (base)
+    munmap(const_cast<char *>(base), size);
+  if (fd >= 0)
+    close(fd);
+}
+
+bool database_t::open(const fs::path &p) {
+  fd = ::open(p.c_str(), O_RDONLY);
+  if (fd < 0) {
+    cerr << "error: could not open " << p.string() << endl;
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) < 0 ||
+      static_cast<size_t>(st.st_size) < sizeof(database_header_t)) {
+    cerr << "error: " << p.string() << " is not a dependency database" << endl;
+    return false;
+  }
+  size = static_cast<size_t>(st.st_size);
+
+  void *mem = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (mem == MAP_FAILED) {
+    cerr << "error: could not map " << p.string() << endl;
+    return false;
+  }
+  base = static_cast<const char *>(mem);
+
+  if (header().magic != database_magic) {
+    cerr << "error: " << p.string() << " is not a dependency database" << endl;
+    return false;
+  }
+
+  if (header().version != database_version) {
+    cerr << "error: " << p.string() << " is of another version ("
+         << header().version << "); link it again" << endl;
+    return false;
+  }
+
+  for (unsigned s = 0; s < DB_NUM_SECTIONS; ++s) {
+    const database_section_t &sect = header().sections[s];
+    if (sect.off % 8 != 0 || sect.off > size || sect.len > size - sect.off) {
+      cerr << "error: " << p.string() << " is truncated" << endl;
+      return false;
+    }
+  }
+
+  return true;
+}
+
+pair<const database_vertex_t *, const database_vertex_t *>
+database_t::out_edges(database_vertex_t v) const {
+  const uint64_t *offs = section<uint64_t>(DB_OUT_OFFS);
+  const database_vertex_t *verts = section<database_vertex_t>(DB_OUT_VERTS);
+  return make_pair(verts + offs[v], verts + offs[v + 1]);
+}
+
+const uint8_t *database_t::out_edge_types(database_vertex_t v) const {
+  return section<uint8_t>(DB_OUT_TYPES) + section<uint64_t>(DB_OUT_OFFS)[v];
+}
+
+pair<const database_vertex_t *, const database_vertex_t *>
+database_t::in_edges(database_vertex_t v) const {
+  const uint64_t *offs = section<uint64_t>(DB_IN_OFFS);
+  const database_vertex_t *verts = section<database_vertex_t>(DB_IN_VERTS);
+  return make_pair(verts + offs[v], verts + offs[v + 1]);
+}
+
+const uint8_t *database_t::in_edge_types(database_vertex_t v) const {
+  return section<uint8_t>(DB_IN_TYPES) + section<uint64_t>(DB_IN_OFFS)[v];
+}
+
+const char *database_t::path_of_source_file(source_file_t f) const {
+  return string_at(section<uint32_t>(is_system_source_file(f)
+                                         ? DB_SYST_PATHS
+                                         : DB_USER_PATHS)[index_of_source_file(f)]);
+}
+
+const char *database_t::top_level_system_header(source_file_t f) const {
+  assert(is_system_source_file(f));
+  return string_at(section<uint32_t>(DB_TOPLVL_PATHS)[index_of_source_file(f)]);
+}
+
+source_file_t database_t::user_source_file(const string &path) const {
+  const uint32_t *paths = section<uint32_t>(DB_USER_PATHS);
+  const uint32_t *sorted = section<uint32_t>(DB_USER_PATHS_SORTED);
+  const uint32_t *sorted_end =
+      sorted + section_size<uint32_t>(DB_USER_PATHS_SORTED);
+
+  const uint32_t *it =
+      lower_bound(sorted, sorted_end, path, [&](uint32_t i, const string &s) {
+        return s.compare(string_at(paths[i])) > 0;
+      });
+  if (it == sorted_end || path != string_at(paths[*it]))
+    return -1;
+
+  return static_cast<source_file_t>(*it);
+}
+
+static pair<const database_symbol_t *, const database_symbol_t *>
+symbols_named(const database_t &db, const database_symbol_t *first,
+              const database_symbol_t *last, const string &name) {
+  const database_symbol_t *beg = lower_bound(
+      first, last, name,
+      [&](const database_symbol_t &sym, const string &s) -> bool {
+        return s.compare(db.string_at(sym.name)) > 0;
+      });
+  const database_symbol_t *end = upper_bound(
+      beg, last, name,
+      [&](const string &s, const database_symbol_t &sym) -> bool {
+        return s.compare(db.string_at(sym.name)) < 0;
+      });
+  return make_pair(beg, end);
+}
+
+pair<const database_symbol_t *, const database_symbol_t *>
+database_t::global_definition(const string &name) const {
+  const database_symbol_t *syms = section<database_symbol_t>(DB_GLBL_DEFS);
+  return symbols_named(*this, syms,
+                       syms + section_size<database_symbol_t>(DB_GLBL_DEFS),
+                       name);
+}
+
+pair<const database_symbol_t *, const database_symbol_t *>
+database_t::static_definitions(const string &name) const {
+  const database_symbol_t *syms = section<database_symbol_t>(DB_STATIC_DEFS);
+  return symbols_named(*this, syms,
+                       syms + section_size<database_symbol_t>(DB_STATIC_DEFS),
+                       name);
+}
+
+database_vertex_t database_t::vertex_at(source_file_t f,
+                                        source_location_t loc) const {
+  size_t slot = is_system_source_file(f)
+                    ? num_user_files() + index_of_source_file(f)
+                    : index_of_source_file(f);
+  if (slot >= num_user_files() + num_syst_files())
+    return database_nil;
+
+  const uint64_t *file_ranges = section<uint64_t>(DB_FILE_RANGES);
+  const database_vertex_t *ranges = section<database_vertex_t>(DB_RANGES);
+  const source_location_t *max_end =
+      section<source_location_t>(DB_RANGES_MAX_END);
+  const source_location_t *beg = section<source_location_t>(DB_VERT_BEG);
+
+  size_t first = file_ranges[slot];
+  size_t last = file_ranges[slot + 1];
+
+  //
+  // the outermost code around the location is the first which ends after it
+  // (as the furthest end so far only grows where some code ends further). it
+  // must also begin at or before it.
+  //
+  const source_location_t *it =
+      upper_bound(max_end + first, max_end + last, loc);
+  if (it == max_end + last)
+    return database_nil;
+
+  database_vertex_t v = ranges[it - max_end];
+  if (beg[v] > loc)
+    return database_nil;
+
+  return v;
+}
+
+void reachable_code_of_database(depends_t &out,
+                                unordered_set<code_t> &reachable,
+                                const database_t &db,
+                                const code_location_list_t &cll,
+                                const global_symbol_list_t &gsl,
+                                bool only_tys) {
+  cerr << "computing dependency subgraph" << endl;
+
+  vector<database_vertex_t> verts;
+
+  //
+  // map code location list to vertices
+  //
+  for (const auto &cl : cll) {
+    string path;
+    unsigned off;
+    tie(path, off) = cl;
+
+    source_file_t f = db.user_source_file(path);
+    if (f < 0) {
+      cerr << "source file '" << path
+           << "' for given code location does not exist in the database"
+           << endl;
+      exit(1);
+    }
+
+    database_vertex_t v =
+        db.vertex_at(f, static_cast<source_location_t>(off));
+    if (v == database_nil) {
+      cerr << "given code location does not exist in source file '" << path
+           << '\'' << endl;
+      exit(1);
+    }
+
+    verts.push_back(v);
+  }
+
+  //
+  // map global symbol list to vertices
+  //
+  for (const string &gs : gsl) {
+    auto defs = db.global_definition(gs);
+    if (defs.first == defs.second)
+      defs = db.static_definitions(gs); /* FIXME arbitrarily chosen static
+                                           definition */
+    if (defs.first == defs.second) {
+      cerr << "symbol " << gs << " not found (skipping) " << endl;
+      continue;
+    }
+
+    database_vertex_t v = db.vertex_at(defs.first->f, defs.first->beg);
+    if (v == database_nil) {
+      cerr << "source range for symbol " << gs << " not found (skipping) "
+           << endl;
+      continue;
+    }
+
+    verts.push_back(v);
+  }
+
+  if (verts.empty()) {
+    cerr << "failed to extract code" << endl;
+    exit(1);
+  }
+
+  //
+  // search the graph from every vertex (as reachable_code() does). then, so
+  // that the code is ordered as it would be in the whole graph, search on from
+  // there along every edge: every path between two pieces of reachable code is
+  // then in the subgraph.
+  //
+  enum : uint8_t { SEEN = 1, NEEDED = 2 };
+  vector<uint8_t> marks(db.num_vertices(), 0);
+  vector<database_vertex_t> found;
+
+  auto search = [&](bool needed) -> void {
+    vector<database_vertex_t> stack(found);
+    while (!stack.empty()) {
+      database_vertex_t v = stack.back();
+      stack.pop_back();
+
+      const database_vertex_t *nbr, *nbr_end;
+      tie(nbr, nbr_end) = db.out_edges(v);
+      const uint8_t *ty = db.out_edge_types(v);
+      for (; nbr != nbr_end; ++nbr, ++ty) {
+        if (needed && (only_tys ? *ty != DEPENDS_NORMAL_EDGE
+                                : *ty == DEPENDS_FOLLOWS_EDGE))
+          continue;
+
+        uint8_t m = needed ? (SEEN | NEEDED) : SEEN;
+        if ((marks[*nbr] & m) == m)
+          continue;
+
+        if (!marks[*nbr])
+          found.push_back(*nbr);
+        marks[*nbr] |= m;
+        stack.push_back(*nbr);
+      }
+    }
+  };
+
+  for (database_vertex_t v : verts) {
+    if (!marks[v])
+      found.push_back(v);
+    marks[v] = SEEN | NEEDED;
+  }
+  search(true);
+  search(false);
+
+  //
+  // make the subgraph, with only the source files it lies in
+  //
+  depends_context_t &depctx = out[boost::graph_bundle];
+
+  unordered_map<source_file_t, source_file_t> f_map;
+  auto map_source_file = [&](source_file_t f) -> source_file_t {
+    auto it = f_map.find(f);
+    if (it != f_map.end())
+      return (*it).second;
+
+    source_file_t res;
+    if (is_system_source_file(f)) {
+      res = syst_index_of_index(
+          static_cast<unsigned>(depctx.syst_src_f_paths.size()));
+      depctx.syst_src_f_paths.push_back(db.path_of_source_file(f));
+      depctx.toplvl_syst_src_f_paths.push_back(db.top_level_system_header(f));
+    } else {
+      res = static_cast<source_file_t>(depctx.user_src_f_paths.size());
+      depctx.user_src_f_paths.push_back(db.path_of_source_file(f));
+    }
+
+    f_map[f] = res;
+    return res;
+  };
+
+  const uint32_t *dir, *dir_end;
+  for (tie(dir, dir_end) = db.include_dirs(); dir != dir_end; ++dir)
+    depctx.include.dirs.insert(db.string_at(*dir));
+
+  unordered_map<database_vertex_t, depends_vertex_t> vert_map;
+  vert_map.reserve(found.size());
+  for (database_vertex_t v : found) {
+    source_range_t src_rng(db.range(v));
+    src_rng.f = map_source_file(src_rng.f);
+
+    depends_vertex_t _v = boost::add_vertex(src_rng, out);
+    vert_map[v] = _v;
+    if (marks[v] & NEEDED)
+      reachable.insert(_v);
+  }
+
+  for (database_vertex_t v : found) {
+    const database_vertex_t *nbr, *nbr_end;
+    tie(nbr, nbr_end) = db.out_edges(v);
+    const uint8_t *ty = db.out_edge_types(v);
+    for (; nbr != nbr_end; ++nbr, ++ty) {
+      depends_edge_type_t e;
+      e.t = static_cast<DEPENDS_EDGE_TYPE>(*ty);
+      boost::add_edge(vert_map[v], vert_map[*nbr], e, out);
+    }
+  }
+
+  cerr << "computed dependency subgraph (" << reachable.size() << " of "
+       << db.num_vertices() << " vertices)." << endl;
+}
+}
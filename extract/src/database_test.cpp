@@ -0,0 +1,178 @@
+#include "check.h"
+#include "database.h"
+#include <map>
+#include <random>
+#include <set>
+#include <tuple>
+#include <unistd.h>
+
+using namespace std;
+using namespace carbon;
+namespace fs = boost::filesystem;
+
+//
+// a database reads back as the graph which was written, and finds the code at
+// a location as a walk through the graph would
+//
+
+static const unsigned num_user_files = 3;
+static const unsigned num_syst_files = 2;
+static const source_location_t file_size = 400;
+
+static source_file_t file_of_slot(unsigned slot) {
+  return slot < num_user_files ? static_cast<source_file_t>(slot)
+                               : syst_index_of_index(slot - num_user_files);
+}
+
+int main() {
+  mt19937 rng(1);
+
+  depends_t g;
+  depends_context_t &depctx = g[boost::graph_bundle];
+  for (unsigned i = 0; i < num_user_files; ++i)
+    depctx.user_src_f_paths.push_back("/src/f" + to_string(i) + ".c");
+  for (unsigned i = 0; i < num_syst_files; ++i) {
+    depctx.syst_src_f_paths.push_back("/usr/include/h" + to_string(i) + ".h");
+    depctx.toplvl_syst_src_f_paths.push_back("/usr/include/h0.h");
+  }
+
+  //
+  // code which nests, overlaps, touches, or is on its own, in every file, and
+  // code which stands for a whole file or for nothing in particular (which is
+  // not at any location)
+  //
+  vector<depends_vertex_t> verts;
+  set<tuple<source_file_t, source_location_t, source_location_t>> seen;
+  while (verts.size() < 300) {
+    source_file_t f = file_of_slot(rng() % (num_user_files + num_syst_files));
+    source_location_t beg = rng() % file_size;
+    source_location_t end = beg + 1 + rng() % (rng() % 10 ? 20 : 200);
+    if (!seen.insert(make_tuple(f, beg, end)).second)
+      continue;
+
+    verts.push_back(boost::add_vertex(source_range_t{f, beg, end}, g));
+  }
+  verts.push_back(boost::add_vertex(
+      source_range_t{0, location_entire_file_beg, location_entire_file_end},
+      g));
+  verts.push_back(boost::add_vertex(
+      source_range_t{syst_index_of_index(1), location_dummy_beg,
+                     location_dummy_end},
+      g));
+
+  for (unsigned i = 0; i < 1000; ++i) {
+    depends_edge_type_t t;
+    t.t = static_cast<DEPENDS_EDGE_TYPE>(rng() % 3);
+    boost::add_edge(verts[rng() % verts.size()], verts[rng() % verts.size()],
+                    t, g);
+  }
+
+  depctx.glbl_defs["main"] = {0, g[verts[0]].beg};
+  depctx.static_defs["helper"] = {{1, g[verts[1]].beg}};
+
+  fs::path p(fs::temp_directory_path() /
+             ("carbon-database-test-" + to_string(getpid())));
+  write_database(p, g);
+
+  database_t db;
+  bool opened = db.open(p);
+  CHECK(opened);
+  fs::remove(p);
+  if (!opened)
+    return check::result();
+
+  CHECK(db.num_vertices() == verts.size());
+  CHECK(db.num_edges() == boost::num_edges(g));
+  CHECK(db.num_user_files() == num_user_files);
+  CHECK(db.num_syst_files() == num_syst_files);
+
+  //
+  // (the vertices are numbered in the order of the graph's)
+  //
+  map<depends_vertex_t, database_vertex_t> idx;
+  for (database_vertex_t v = 0; v < verts.size(); ++v) {
+    idx[verts[v]] = v;
+
+    source_range_t rng_v = db.range(v);
+    CHECK(rng_v.f == g[verts[v]].f);
+    CHECK(rng_v.beg == g[verts[v]].beg);
+    CHECK(rng_v.end == g[verts[v]].end);
+  }
+
+  for (database_vertex_t v = 0; v < verts.size(); ++v) {
+    set<pair<database_vertex_t, uint8_t>> out, in, db_out, db_in;
+
+    depends_t::out_edge_iterator oi, oi_end;
+    for (tie(oi, oi_end) = boost::out_edges(verts[v], g); oi != oi_end; ++oi)
+      out.insert(make_pair(idx[boost::target(*oi, g)], g[*oi].t));
+    depends_t::in_edge_iterator ii, ii_end;
+    for (tie(ii, ii_end) = boost::in_edges(verts[v], g); ii != ii_end; ++ii)
+      in.insert(make_pair(idx[boost::source(*ii, g)], g[*ii].t));
+
+    auto db_edges = db.out_edges(v);
+    for (const database_vertex_t *it = db_edges.first; it != db_edges.second;
+         ++it)
+      db_out.insert(
+          make_pair(*it, db.out_edge_types(v)[it - db_edges.first]));
+    db_edges = db.in_edges(v);
+    for (const database_vertex_t *it = db_edges.first; it != db_edges.second;
+         ++it)
+      db_in.insert(make_pair(*it, db.in_edge_types(v)[it - db_edges.first]));
+
+    CHECK(out == db_out);
+    CHECK(in == db_in);
+  }
+
+  //
+  // the code at every location of every file is the outermost code around it:
+  // of the code which begins at or before it and ends after it, that which
+  // begins first (and, of those, ends last)
+  //
+  for (unsigned slot = 0; slot < num_user_files + num_syst_files; ++slot) {
+    source_file_t f = file_of_slot(slot);
+
+    for (source_location_t loc = -1; loc < file_size + 250; ++loc) {
+      database_vertex_t expected = database_nil;
+      for (database_vertex_t v = 0; v < verts.size(); ++v) {
+        source_range_t r = db.range(v);
+        if (r.f != f || r.beg == location_entire_file_beg ||
+            r.beg == location_dummy_beg || !(r.beg <= loc && loc < r.end))
+          continue;
+
+        if (expected == database_nil ||
+            make_pair(r.beg, -r.end) <
+                make_pair(db.range(expected).beg, -db.range(expected).end))
+          expected = v;
+      }
+
+      CHECK(db.vertex_at(f, loc) == expected);
+    }
+  }
+
+  CHECK(db.vertex_at(num_user_files, 0) == database_nil);
+  CHECK(db.vertex_at(syst_index_of_index(num_syst_files), 0) ==
+        database_nil);
+
+  //
+  // the symbols, and the source files by path
+  //
+  auto defs = db.global_definition("main");
+  CHECK(defs.second - defs.first == 1);
+  if (defs.first != defs.second)
+    CHECK(db.vertex_at(defs.first->f, defs.first->beg) != database_nil);
+  defs = db.global_definition("helper");
+  CHECK(defs.first == defs.second);
+  defs = db.static_definitions("helper");
+  CHECK(defs.second - defs.first == 1);
+
+  for (unsigned i = 0; i < num_user_files; ++i) {
+    CHECK(db.user_source_file(depctx.user_src_f_paths[i]) ==
+          static_cast<source_file_t>(i));
+    CHECK(depctx.user_src_f_paths[i] == db.path_of_source_file(i));
+  }
+  CHECK(db.user_source_file("/src/none.c") == -1);
+  CHECK(depctx.syst_src_f_paths[1] ==
+        db.path_of_source_file(syst_index_of_index(1)));
+
+  return check::result();
+}
@@ -0,0 +1,230 @@
+#include <collect_impl.h>
+#include <depends_builder.h>
+#include <depends_codec.h>
+#include <chrono>
+#include <boost/filesystem.hpp>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <boost/graph/adj_list_serialize.hpp>
+#include <boost/serialization/vector.hpp>
+#include <boost/serialization/string.hpp>
+#include <boost/serialization/unordered_map.hpp>
+#include <boost/serialization/set.hpp>
+#include <boost/serialization/list.hpp>
+#include <boost/archive/binary_iarchive.hpp>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/program_options.hpp>
+
+using namespace std;
+using namespace carbon;
+namespace po = boost::program_options;
+namespace fs = boost::filesystem;
+
+//
+// a graph the size of a large program's, made up: every file has the same
+// number of code ranges, one in ten of them a global definition, and every
+// vertex uses four before it (three of them in the previous fifty), so that
+// the graph has no cycles for toposort to break
+//
+static void make_graph(depends_archive_t &g, unsigned num_files, unsigned per_file,
+                       const fs::path &src_dir) {
+  depends_context_t &depctx = g[boost::graph_bundle];
+  vector<depends_archive_t::vertex_descriptor> verts;
+
+  for (unsigned f = 0; f < num_files; ++f) {
+    depctx.user_src_f_paths.push_back(
+        (src_dir / ("f" + to_string(f) + ".c")).string());
+
+    for (unsigned i = 0; i < per_file; ++i) {
+      source_location_t beg = static_cast<source_location_t>(i * 100);
+      verts.push_back(boost::add_vertex(
+          source_range_t{static_cast<source_file_t>(f), beg, beg + 90}, g));
+      if (i % 10 == 0)
+        depctx.glbl_defs["sym" + to_string(f) + "_" + to_string(i)] = {
+            static_cast<source_file_t>(f), beg};
+    }
+  }
+
+  mt19937 rng(1);
+  for (size_t i = 1; i < verts.size(); ++i)
+    for (unsigned k = 0; k < 4; ++k) {
+      size_t j = k < 3 ? i - 1 - rng() % min<size_t>(i, 50) : rng() % i;
+      boost::add_edge(verts[i], verts[j], g);
+    }
+}
+
+static double seconds_since(chrono::steady_clock::time_point t0) {
+  return chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+}
+
+//
+// times the encoding of graphs (see depends_codec.h) against the boost archive
+// it replaced, and the reads which skip all but the header or the context, and
+// measures how often the header's Bloom filter lets through a collection
+// which does not define the symbol looked for. with --out, it writes the graph
+// as the collection of a build (and its source files), on which carbon-link
+// and carbon-extract can be timed.
+//
+int main(int argc, char **argv) {
+  unsigned num_files, per_file;
+  fs::path out_dir;
+
+  try {
+    po::options_description desc("Allowed options");
+    desc.add_options()
+      ("help,h", "produce help message")
+
+      ("files", po::value<unsigned>(&num_files)->default_value(1000),
+       "number of source files")
+
+      ("per-file", po::value<unsigned>(&per_file)->default_value(500),
+       "number of code ranges in every source file")
+
+      ("out,o", po::value<fs::path>(&out_dir),
+       "write the graph as a collection under the given directory's bin/.carbon "
+       "(and the source files under its src)")
+
+      ("archive", "write that collection as a boost archive, as older "
+       "collectors did")
+    ;
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+
+    if (vm.count("help")) {
+      cout << "Usage: depends_bench [options]\n";
+      cout << desc;
+      return 0;
+    }
+
+    if (vm.count("archive") && out_dir.empty()) {
+      cerr << "--archive needs --out" << endl;
+      return 1;
+    }
+
+    fs::path src_dir(out_dir.empty() ? fs::path("/src") : out_dir / "src");
+
+    depends_archive_t g;
+    make_graph(g, num_files, per_file, src_dir);
+    cout << boost::num_vertices(g) << " vertices, " << boost::num_edges(g)
+         << " edges" << endl;
+
+    chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+    string archive;
+    {
+      ostringstream oss;
+      boost::archive::binary_oarchive oa(oss);
+      oa << g;
+      archive = oss.str();
+    }
+    double archive_write = seconds_since(t0);
+
+    //
+    // (the collector reads summaries and blobs into a depends_archive_t, and
+    // carbon-extract reads collections into a depends_t)
+    //
+    double archive_read[2], encoded_read[2];
+    for (unsigned i = 0; i < 2; ++i) {
+      t0 = chrono::steady_clock::now();
+      {
+        istringstream iss(archive);
+        boost::archive::binary_iarchive ia(iss);
+        depends_archive_t ra;
+        depends_t rg;
+        if (i == 0)
+          ia >> ra;
+        else
+          ia >> rg;
+      }
+      archive_read[i] = seconds_since(t0);
+    }
+
+    t0 = chrono::steady_clock::now();
+    string encoded;
+    write_depends(encoded, g);
+    double encoded_write = seconds_since(t0);
+
+    for (unsigned i = 0; i < 2; ++i) {
+      t0 = chrono::steady_clock::now();
+      {
+        istringstream iss(encoded);
+        depends_archive_t ra;
+        depends_t rg;
+        if (i == 0)
+          read_depends(iss, ra);
+        else
+          read_depends(iss, rg);
+      }
+      encoded_read[i] = seconds_since(t0);
+    }
+
+    cout << "boost archive: " << archive.size() << " bytes, written in "
+         << archive_write << " s, read in " << archive_read[0] << " s ("
+         << archive_read[1] << " s as a depends_t)" << endl;
+    cout << "encoding:      " << encoded.size() << " bytes, written in "
+         << encoded_write << " s, read in " << encoded_read[0] << " s ("
+         << encoded_read[1] << " s as a depends_t)" << endl;
+
+    //
+    // (a header is read from a file, as the scan for a symbol does, which is
+    // most of what it costs)
+    //
+    fs::path tmp_p(fs::temp_directory_path() / fs::unique_path());
+    ofstream(tmp_p.string(), ios::binary) << encoded;
+
+    const unsigned num_header_reads = 10000;
+    t0 = chrono::steady_clock::now();
+    for (unsigned i = 0; i < num_header_reads; ++i) {
+      ifstream ifs(tmp_p.string(), ios::binary);
+      depends_header_t hdr;
+      read_depends_header(ifs, hdr);
+    }
+    double header_read = seconds_since(t0) / num_header_reads;
+    fs::remove(tmp_p);
+
+    t0 = chrono::steady_clock::now();
+    {
+      istringstream iss(encoded);
+      depends_context_t depctx;
+      depends_reader_t(iss).read_context(depctx);
+    }
+    double context_read = seconds_since(t0);
+
+    cout << "header read in " << header_read * 1e6 << " us, context in "
+         << context_read * 1e3 << " ms" << endl;
+
+    const unsigned num_lookups = 200000;
+    for (unsigned n : {50, 200, 500, 1000, 2000}) {
+      depends_header_t hdr = {};
+      for (unsigned i = 0; i < n; ++i)
+        hdr.add_symbol("sym_" + to_string(i) + "_x");
+
+      unsigned num_fps = 0;
+      for (unsigned i = 0; i < num_lookups; ++i)
+        num_fps += hdr.may_define("other_" + to_string(i));
+
+      cout << "Bloom filter of " << n << " definitions: "
+           << 100.0 * num_fps / num_lookups << "% false positives" << endl;
+    }
+
+    if (out_dir.empty())
+      return 0;
+
+    fs::create_directories(src_dir);
+    for (const string &p : g[boost::graph_bundle].user_src_f_paths)
+      ofstream(p) << string(per_file * 100, ' ');
+
+    fs::path carbon_dir(out_dir / "bin" / ".carbon");
+    fs::create_directories(carbon_dir);
+    ofstream ofs((carbon_dir / "all.c.carbon").string(), ios::binary);
+    ofs << (vm.count("archive") ? archive : encoded);
+  } catch (exception &e) {
+    cerr << e.what() << endl;
+    return 1;
+  }
+
+  return 0;
+}
@@ -2,6 +2,8 @@
 #include "read_collection.h"
 #include <boost/icl/interval_map.hpp>
 #include <collect_impl.h>
+#include <algorithm>
+#include <fstream>
 #include <iostream>
 #include <queue>
 #include <set>
@@ -35,7 +37,36 @@ static void vertex_interval_maps_of_graph(
         &syst_sl_vert_map,
     depends_t &g);
 
-void link(depends_t &into, const collection_sources_t &cfl) {
+bool is_shared_collection_dir(const fs::directory_entry &ent) {
+  return (ent.path().filename() == syst_summaries_dir_name ||
+          ent.path().filename() == user_hdr_blobs_dir_name) &&
+         fs::is_directory(ent.status());
+}
+
+void all_collections(collection_sources_t &cfl, journal_index_t &journal) {
+  for (const auto &rec : journal)
+    cfl.second.insert(rec.first);
+
+  fs::recursive_directory_iterator end_iter;
+  for (fs::recursive_directory_iterator dir_itr(cfl.first);
+       dir_itr != end_iter; ++dir_itr) {
+    if (is_shared_collection_dir(*dir_itr)) {
+      dir_itr.disable_recursion_pending();
+      continue;
+    }
+
+    // (the journal, and whatever else carbon-cc keeps there, aren't
+    // collections)
+    if (!fs::is_regular_file(dir_itr->status()) ||
+        dir_itr->path().extension() != ".carbon")
+      continue;
+
+    cfl.second.insert(dir_itr->path());
+  }
+}
+
+void link(depends_t &into, const collection_sources_t &cfl,
+          const journal_index_t &journal) {
   cerr << "linking dependency graphs..." << endl;
 
   vector<boost::icl::interval_map<source_location_t, set<depends_vertex_t>>>
@@ -44,14 +75,101 @@ void link(depends_t &into, const collection_sources_t &cfl) {
       into_syst_sl_vert_map;
   vertex_interval_maps_of_graph(into_user_sl_vert_map, into_syst_sl_vert_map,
                                 into);
+
+  //
+  // the code left out of a graph is in the summaries of system headers and the
+  // blobs of user headers which it refers to. those are shared between graphs,
+  // and are each linked once.
+  //
+  set<string> linked_shared;
+
+  auto link_shared = [&](const char *dir_name,
+                         const vector<string> &names) -> void {
+    for (const string &name : names) {
+      if (!linked_shared.insert(name).second)
+        continue;
+
+      fs::path shared_fp(cfl.first / dir_name / (name + ".carbon"));
+      if (!fs::is_regular_file(shared_fp)) {
+        cerr << "warning: " << shared_fp.string() << " not found" << endl;
+        continue;
+      }
+
+      depends_t shared;
+      read_collection_file(shared, shared_fp);
+
+      relocate(into, shared, into_user_sl_vert_map, into_syst_sl_vert_map);
+      link_into(into, shared, into_user_sl_vert_map, into_syst_sl_vert_map);
+    }
+  };
+
+  //
+  // the records in the journal go first, in the order they were written, so
+  // that it is read from beginning to end
+  //
+  vector<pair<const fs::path *, const journal_record_t *>> srcs;
+  srcs.reserve(cfl.second.size());
   for (const fs::path &fp : cfl.second) {
+    auto it = journal.find(fp);
+    srcs.push_back(
+        make_pair(&fp, it == journal.end() ? nullptr : &(*it).second));
+  }
+
+  sort(srcs.begin(), srcs.end(),
+       [](const pair<const fs::path *, const journal_record_t *> &lhs,
+          const pair<const fs::path *, const journal_record_t *> &rhs) {
+         if (!lhs.second || !rhs.second)
+           return lhs.second && !rhs.second;
+         return lhs.second->off < rhs.second->off;
+       });
+
+  ifstream journal_f;
+  if (!journal.empty())
+    journal_f.open((cfl.first / journal_file_name).string(), ios::binary);
+
+  //
+  // the headers of the graphs tell how many symbols they define, which bounds
+  // how many the linked graph will, so its tables of them are sized once (the
+  // graphs of older collectors have no header, and aren't counted)
+  //
+  {
+    uint64_t num_verts = 0, num_edges = 0, num_glbl_defs = 0,
+             num_static_defs = 0;
+    for (const auto &src : srcs) {
+      depends_header_t hdr;
+      if (src.second
+              ? !read_collection_record_header(hdr, journal_f, *src.second)
+              : !read_collection_file_header(hdr, *src.first))
+        continue;
+
+      num_verts += hdr.num_verts;
+      num_edges += hdr.num_edges;
+      num_glbl_defs += hdr.num_glbl_defs;
+      num_static_defs += hdr.num_static_defs;
+    }
+
+    into[boost::graph_bundle].glbl_defs.reserve(
+        into[boost::graph_bundle].glbl_defs.size() + num_glbl_defs);
+    into[boost::graph_bundle].static_defs.reserve(
+        into[boost::graph_bundle].static_defs.size() + num_static_defs);
+
+    cerr << "linking " << srcs.size() << " dependency graphs (" << num_verts
+         << " vertices, " << num_edges << " edges, before summaries and blobs)"
+         << endl;
+  }
+
+  for (const auto &src : srcs) {
+    const fs::path &fp = *src.first;
     depends_t g;
 
     cerr << "linking "
-         << fs::relative(fp, cfl.first).replace_extension("").string()
+         << fp.lexically_relative(cfl.first).replace_extension("").string()
          << endl;
 
-    read_collection_file(g, fp);
+    if (src.second)
+      read_collection_record(g, journal_f, *src.second);
+    else
+      read_collection_file(g, fp);
 
     for (const string& sym : g[boost::graph_bundle].macros.def)
       into[boost::graph_bundle].macros.def.insert(sym);
@@ -105,6 +223,9 @@ void link(depends_t &into, const collection_sources_t &cfl) {
     cerr << "link_into" << endl;
 #endif
     link_into(into, g, into_user_sl_vert_map, into_syst_sl_vert_map);
+
+    link_shared(syst_summaries_dir_name, g[boost::graph_bundle].syst_summaries);
+    link_shared(user_hdr_blobs_dir_name, g[boost::graph_bundle].user_hdr_blobs);
   }
 
   resolve_references(into, into_user_sl_vert_map, into_syst_sl_vert_map);
@@ -1,6 +1,8 @@
 #include "read_collection.h"
 #include <collect_impl.h>
+#include <journal.h>
 #include <fstream>
+#include <iostream>
 #include <boost/graph/adj_list_serialize.hpp>
 #include <boost/serialization/vector.hpp>
 #include <boost/serialization/string.hpp>
@@ -19,14 +21,88 @@ namespace fs = boost::filesystem;
 
 namespace carbon {
 
-void read_collection_file(depends_t &g, const fs::path &p) {
-  ifstream ifs(p.string());
+//
+// graphs are read straight from the stream. those written by older collectors
+// are boost archives, which are read whole.
+//
+static void read_collection(depends_t &g, istream &is) {
+  if (is_depends_encoding(is)) {
+    read_depends(is, g);
+    return;
+  }
+
 #ifdef CARBON_BINARY
-  boost::archive::binary_iarchive ia(ifs);
+  boost::archive::binary_iarchive ia(is);
 #else
-  boost::archive::text_iarchive ia(ifs);
+  boost::archive::text_iarchive ia(is);
 #endif
   ia >> g;
 }
 
+static void read_collection_context(depends_context_t &depctx, istream &is) {
+  if (is_depends_encoding(is)) {
+    depends_reader_t(is).read_context(depctx);
+    return;
+  }
+
+  depends_t g;
+  read_collection(g, is);
+  depctx = g[boost::graph_bundle];
+}
+
+void read_collection_file(depends_t &g, const fs::path &p) {
+  ifstream ifs(p.string(), ios::binary);
+  read_collection(g, ifs);
+}
+
+void read_collection_file_context(depends_context_t &depctx,
+                                  const fs::path &p) {
+  ifstream ifs(p.string(), ios::binary);
+  read_collection_context(depctx, ifs);
+}
+
+bool read_collection_file_header(depends_header_t &hdr, const fs::path &p) {
+  ifstream ifs(p.string(), ios::binary);
+  return read_depends_header(ifs, hdr);
+}
+
+void read_journal_index(journal_index_t &out, const fs::path &carbon_dir) {
+  fs::path p(carbon_dir / journal_file_name);
+  if (!fs::exists(p))
+    return;
+
+  uint64_t skipped;
+  for (auto &rec : latest_journal_records(p.string(), skipped)) {
+    journal_record_t &out_rec = out[carbon_dir / (rec.first + ".carbon")];
+    out_rec.off = rec.second.first;
+    out_rec.len = rec.second.second;
+  }
+
+  if (skipped)
+    cerr << "warning: " << p.string() << " has " << skipped
+         << " bytes of records which were cut short" << endl;
+}
+
+void read_collection_record(depends_t &g, istream &journal,
+                            const journal_record_t &rec) {
+  journal.clear();
+  journal.seekg(rec.off, ios::beg);
+  read_collection(g, journal);
+}
+
+void read_collection_record_context(depends_context_t &depctx,
+                                    istream &journal,
+                                    const journal_record_t &rec) {
+  journal.clear();
+  journal.seekg(rec.off, ios::beg);
+  read_collection_context(depctx, journal);
+}
+
+bool read_collection_record_header(depends_header_t &hdr, istream &journal,
+                                   const journal_record_t &rec) {
+  journal.clear();
+  journal.seekg(rec.off, ios::beg);
+  return read_depends_header(journal, hdr);
+}
+
 }
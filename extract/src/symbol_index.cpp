@@ -0,0 +1,225 @@
+#include "symbol_index.h"
+#include <collect_impl.h>
+#include <algorithm>
+#include <cerrno>
+#include <iostream>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+using namespace std;
+namespace fs = boost::filesystem;
+
+namespace carbon {
+
+typedef map<string, vector<pair<char, string>>> symbol_blocks_t;
+
+//
+// the latest block of every source file in what the collector appended. a line
+// cut short (its writer having been killed) ends it.
+//
+static void parse_symbol_blocks(symbol_blocks_t &out, const string &data) {
+  vector<pair<char, string>> *block = nullptr;
+
+  string::size_type beg = 0;
+  for (;;) {
+    string::size_type end = data.find('\n', beg);
+    if (end == string::npos)
+      break;
+
+    if (end - beg >= 2 && data[beg + 1] == '\t') {
+      string field(data.substr(beg + 2, end - beg - 2));
+      if (data[beg] == '@') {
+        block = &out[field];
+        block->clear();
+      } else if (block && (data[beg] == 'g' || data[beg] == 's')) {
+        block->push_back(make_pair(data[beg], field));
+      }
+    }
+
+    beg = end + 1;
+  }
+}
+
+static bool read_fd(int fd, string &out) {
+  char buf[1 << 16];
+  for (;;) {
+    ssize_t n = read(fd, buf, sizeof(buf));
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    if (n == 0)
+      return true;
+    out.append(buf, n);
+  }
+}
+
+// the source file of a line of the index (its last field)
+static string rel_of_index_line(const string &ln) {
+  string::size_type tab = ln.find('\t');
+  return tab == string::npos || tab + 2 >= ln.size() ? string()
+                                                     : ln.substr(tab + 3);
+}
+
+//
+// rewrites the index at the given path with the given blocks in place of what
+// it had of their source files
+//
+static bool fold_symbol_blocks(const fs::path &p,
+                               const symbol_blocks_t &blocks) {
+  vector<string> lns;
+
+  {
+    ifstream ifs(p.string(), ios::binary);
+    string ln;
+    while (getline(ifs, ln))
+      if (blocks.find(rel_of_index_line(ln)) == blocks.end())
+        lns.push_back(ln);
+  }
+
+  for (const auto &block : blocks)
+    for (const auto &sym : block.second)
+      lns.push_back(sym.second + '\t' + sym.first + '\t' + block.first);
+
+  sort(lns.begin(), lns.end());
+
+  // (so that nobody reads one which is half-written)
+  fs::path tmp_p(p.string() + ".tmp");
+  {
+    ofstream ofs(tmp_p.string(), ios::binary | ios::trunc);
+    for (const string &ln : lns)
+      ofs << ln << '\n';
+
+    if (!ofs)
+      return false;
+  }
+
+  boost::system::error_code ec;
+  fs::rename(tmp_p, p, ec);
+  return !ec;
+}
+
+bool symbol_index_t::open(const fs::path &carbon_dir) {
+  fs::path index_p(carbon_dir / symbols_index_file_name);
+
+  //
+  // appends to the collector's file are locked out while it is read (and
+  // emptied, once folded into the index), and until the index is open
+  //
+  fs::path symbols_p(carbon_dir / symbols_file_name);
+  bool writable = true;
+  int fd = ::open(symbols_p.c_str(), O_RDWR | O_CLOEXEC);
+  if (fd < 0 && errno != ENOENT) {
+    writable = false;
+    fd = ::open(symbols_p.c_str(), O_RDONLY | O_CLOEXEC);
+  }
+
+  if (fd >= 0) {
+    string data;
+    if (flock(fd, writable ? LOCK_EX : LOCK_SH) < 0 || !read_fd(fd, data)) {
+      cerr << "warning: failed to read " << symbols_p.string() << endl;
+      close(fd);
+      return false;
+    }
+
+    symbol_blocks_t blocks;
+    parse_symbol_blocks(blocks, data);
+
+    if (writable && (blocks.empty() || fold_symbol_blocks(index_p, blocks))) {
+      if (ftruncate(fd, 0) < 0)
+        cerr << "warning: failed to truncate " << symbols_p.string() << endl;
+    } else {
+      pending.swap(blocks);
+    }
+  }
+
+  index.open(index_p.string(), ios::binary);
+  if (index) {
+    index.seekg(0, ios::end);
+    size = index.tellg();
+  }
+
+  // (closing it drops the lock)
+  if (fd >= 0)
+    close(fd);
+
+  return index.is_open() || !pending.empty();
+}
+
+uint64_t symbol_index_t::line_at(uint64_t off) {
+  if (off == 0)
+    return 0;
+
+  // (skipping the rest of the line which the byte before it is in)
+  index.clear();
+  index.seekg(off - 1, ios::beg);
+  string ln;
+  if (!getline(index, ln))
+    return size;
+
+  index.clear();
+  uint64_t res = index.tellg();
+  return res < size ? res : size;
+}
+
+void symbol_index_t::definitions(vector<symbol_definition_t> &out,
+                                 const string &name) {
+  auto add = [&](char kind, const string &rel) -> void {
+    symbol_definition_t def;
+    def.is_static = kind == 's';
+    def.rel = rel;
+    out.push_back(def);
+  };
+
+  if (index.is_open()) {
+    string ln;
+    auto name_at = [&](uint64_t off) -> string {
+      index.clear();
+      index.seekg(off, ios::beg);
+      getline(index, ln);
+      return ln.substr(0, ln.find('\t'));
+    };
+
+    //
+    // the first line of a name not less than the one given: the lines before
+    // it start before lo, and those at or after hi are no less than it
+    //
+    uint64_t lo = 0, hi = size;
+    while (lo < hi) {
+      uint64_t mid = lo + (hi - lo) / 2;
+      uint64_t ln_off = line_at(mid);
+      if (ln_off < size && name_at(ln_off) < name)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+    for (uint64_t off = line_at(lo); off < size;) {
+      if (name_at(off) != name)
+        break;
+      off += ln.size() + 1;
+
+      string::size_type tab = ln.find('\t');
+      if (tab + 2 >= ln.size())
+        continue;
+
+      string rel(ln.substr(tab + 3));
+      if (pending.find(rel) == pending.end())
+        add(ln[tab + 1], rel);
+    }
+  }
+
+  for (const auto &block : pending)
+    for (const auto &sym : block.second)
+      if (sym.second == name)
+        add(sym.first, block.first);
+
+  stable_sort(out.begin(), out.end(),
+              [](const symbol_definition_t &lhs,
+                 const symbol_definition_t &rhs) {
+                return !lhs.is_static && rhs.is_static;
+              });
+}
+}
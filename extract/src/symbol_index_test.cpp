@@ -0,0 +1,113 @@
+#include "check.h"
+#include "symbol_index.h"
+#include <collect_impl.h>
+#include <random>
+#include <set>
+#include <unistd.h>
+
+using namespace std;
+using namespace carbon;
+namespace fs = boost::filesystem;
+
+//
+// the index answers with the latest block of every translation unit the
+// collector appended, whether it was folded in by an earlier open or not
+//
+
+typedef map<string, vector<pair<char, string>>> blocks_t;
+
+static void append_blocks(const fs::path &carbon_dir, mt19937 &rng,
+                          blocks_t &tus, unsigned from, unsigned to) {
+  ofstream ofs((carbon_dir / symbols_file_name).string(),
+               ios::binary | ios::app);
+  for (unsigned t = from; t < to; ++t) {
+    string rel("d" + to_string(t % 7) + "/tu" + to_string(t) + ".c");
+    vector<pair<char, string>> &block = tus[rel];
+    block.clear();
+
+    ofs << "@\t" << rel << '\n';
+    for (unsigned i = 0; i < 20; ++i) {
+      char kind = rng() % 4 ? 'g' : 's';
+      string name("f" + to_string(rng() % 5000));
+      block.push_back(make_pair(kind, name));
+      ofs << kind << '\t' << name << '\n';
+    }
+  }
+}
+
+static void check_definitions(symbol_index_t &index, const blocks_t &tus) {
+  map<string, multiset<pair<char, string>>> expected;
+  for (const auto &tu : tus)
+    for (const auto &sym : tu.second)
+      expected[sym.second].insert(make_pair(sym.first, tu.first));
+
+  for (int i = -1; i < 5001; ++i) {
+    string name("f" + to_string(i));
+    vector<symbol_definition_t> defs;
+    index.definitions(defs, name);
+
+    multiset<pair<char, string>> found;
+    for (const symbol_definition_t &def : defs)
+      found.insert(make_pair(def.is_static ? 's' : 'g', def.rel));
+    CHECK(found == expected[name]);
+
+    for (size_t j = 1; j < defs.size(); ++j)
+      CHECK(!defs[j - 1].is_static || defs[j].is_static);
+  }
+
+  // (nor is a prefix of a name, or a name cut short, a definition)
+  vector<symbol_definition_t> defs;
+  index.definitions(defs, "f");
+  index.definitions(defs, "partial");
+  CHECK(defs.empty());
+}
+
+int main() {
+  mt19937 rng(1);
+
+  fs::path carbon_dir(fs::temp_directory_path() /
+                      ("carbon-symbol-index-test-" + to_string(getpid())));
+  fs::create_directories(carbon_dir);
+
+  blocks_t tus;
+
+  {
+    symbol_index_t index;
+    CHECK(!index.open(carbon_dir));
+  }
+
+  append_blocks(carbon_dir, rng, tus, 0, 2000);
+  {
+    symbol_index_t index;
+    CHECK(index.open(carbon_dir));
+    check_definitions(index, tus);
+  }
+  CHECK(fs::file_size(carbon_dir / symbols_file_name) == 0);
+
+  //
+  // translation units collected again (one of which no longer defines
+  // anything), and a block cut short by a killed collector
+  //
+  append_blocks(carbon_dir, rng, tus, 100, 300);
+  {
+    ofstream ofs((carbon_dir / symbols_file_name).string(),
+                 ios::binary | ios::app);
+    ofs << "@\td1/tu50.c\n";
+    tus["d1/tu50.c"].clear();
+    ofs << "g\tpartial";
+  }
+  {
+    symbol_index_t index;
+    CHECK(index.open(carbon_dir));
+    check_definitions(index, tus);
+  }
+
+  {
+    symbol_index_t index;
+    CHECK(index.open(carbon_dir));
+    check_definitions(index, tus);
+  }
+
+  fs::remove_all(carbon_dir);
+  return check::result();
+}